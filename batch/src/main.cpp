@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+#include "tiny.hpp"
+#include "tiny/arena.hpp"
+#include "tiny/batch.hpp"
+#include "tiny/codec.hpp"
+#include "tiny/cull.hpp"
+#include "tiny/raster.hpp"
+#include "tiny/scheduler.hpp"
+#include "tiny/vertex.hpp"
+
+using json = nlohmann::json;
+using clock_type = std::chrono::steady_clock;
+
+// One thumbnail: lesson2's flat shaded, depth tested model.
+struct job {
+    std::string model;
+    int32_t width = 512;
+    int32_t height = 512;
+    tiny::vec3<float> light{0, 0, -1};
+    std::string output;
+};
+
+struct result {
+    bool ok = false;
+    std::string error;
+    bool model_hit = false;
+    double load_ms = 0;
+    double render_ms = 0;
+    double write_ms = 0;
+    double latency_ms = 0;
+};
+
+struct draw {
+    std::array<tiny::vec2<int32_t>, 3> pts;
+    std::array<float, 3> depth;
+    tiny::color color;
+};
+
+// Reads { "jobs": [...] } or a bare array of jobs. Every job needs a model
+// and an output; the format follows the output's extension. A field of the
+// wrong type fails the list rather than the process.
+bool parse_jobs(json const& document, std::vector<job>& jobs,
+                std::string& error) {
+    const bool listed = document.is_object() && document.contains("jobs");
+    if (!document.is_array() && !listed) {
+        error = "no job list";
+        return false;
+    }
+    json const& list = document.is_array() ? document : document.at("jobs");
+    if (!list.is_array()) {
+        error = "no job list";
+        return false;
+    }
+    for (auto const& entry : list) {
+        const auto name = "job " + std::to_string(jobs.size());
+        job j;
+        if (!entry.is_object() || !entry.contains("model") ||
+            !entry.contains("output")) {
+            error = name + " needs a model and an output";
+            return false;
+        }
+        try {
+            j.model = entry.at("model").get<std::string>();
+            j.output = entry.at("output").get<std::string>();
+            j.width = entry.value("width", j.width);
+            j.height = entry.value("height", j.height);
+            if (entry.contains("light")) {
+                const auto light = entry.at("light").get<std::vector<float>>();
+                if (light.size() == 3) j.light = {light[0], light[1], light[2]};
+            }
+        } catch (json::exception const& e) {
+            error = name + ": " + e.what();
+            return false;
+        }
+        j.light = tiny::math::normalise(j.light);
+        if (j.width <= 0 || j.height <= 0) {
+            error = name + " has no pixels";
+            return false;
+        }
+        jobs.push_back(j);
+    }
+    return true;
+}
+
+// Screen vertices and draws of a job, in its worker's arena, with
+// lesson2's camera and culling.
+tiny::span<draw> setup(tiny::model const& model, job const& j,
+                       tiny::arena& arena) {
+    const auto positions = model.positions();
+    auto screen = arena.allocate<tiny::vec2<int32_t>>(positions.size());
+    auto depth = arena.allocate<float>(positions.size());
+    using namespace tiny::math;
+    const auto m = viewport<double>(0, 0, j.width, j.height) *
+                   orthographic<double>(-1, 1, -1, 1, 0, 2) *
+                   look_at<double>({0, 0, 1}, {0, 0, 0}, {0, 1, 0});
+    tiny::vertex::transform(positions, m, screen, depth);
+    auto draws = arena.allocate<draw>(model.nfaces());
+    size_t count = 0;
+    const tiny::rect frame{0, 0, j.width, j.height};
+    std::array<tiny::cull::piece, tiny::cull::max_pieces> pieces;
+    for (int32_t i = 0; i < model.nfaces(); i++) {
+        const auto face = model.face_indices(i);
+        const std::array<tiny::vec2<int32_t>, 3> pts{
+            screen[face[0]], screen[face[1]], screen[face[2]]};
+        const auto kept = tiny::cull::triangle(
+            pts, {depth[face[0]], depth[face[1]], depth[face[2]]}, frame,
+            pieces);
+        if (kept == 0) continue;
+        auto const& a = positions[face[0]];
+        const auto n = tiny::math::normalise(tiny::math::cross(
+            positions[face[2]] - a, positions[face[1]] - a));
+        const auto intensity = std::max(0.f, tiny::math::dot(n, j.light));
+        const auto c = uint8_t(intensity * 255.);
+        if (count + kept > draws.size()) {
+            auto grown = arena.allocate<draw>(draws.size() * 2 + kept);
+            std::copy(draws.begin(), draws.begin() + count, grown.begin());
+            draws = grown;
+        }
+        for (int32_t k = 0; k < kept; k++)
+            draws[count++] = {pieces[k].pts, pieces[k].depth,
+                              tiny::color(c, c, c)};
+    }
+    return draws.subspan(0, count);
+}
+
+// What a worker keeps between its jobs, so that a steady stream of jobs
+// of one size allocates nothing but the encoded file.
+struct worker {
+    std::unique_ptr<tiny::depth_buffer> depth;
+    tiny::arena arena;
+};
+
+result run(job const& j, worker& w, tiny::batch::model_cache& models,
+           tiny::image_pool& images) {
+    using ms = std::chrono::duration<double, std::milli>;
+    result r;
+    const auto start = clock_type::now();
+    const auto model = models.get(j.model, &r.model_hit);
+    const auto loaded = clock_type::now();
+    r.load_ms = ms(loaded - start).count();
+    if (!model) {
+        r.error = "cannot load " + j.model;
+        r.latency_ms = r.load_ms;
+        return r;
+    }
+
+    auto image = images.acquire(j.width, j.height);
+    if (!w.depth || w.depth->get_width() != j.width ||
+        w.depth->get_height() != j.height)
+        w.depth = std::make_unique<tiny::depth_buffer>(j.width, j.height);
+    else
+        w.depth->clear();
+    w.arena.reset();
+    const auto draws = setup(*model, j, w.arena);
+    const tiny::rect frame{0, 0, j.width, j.height};
+    for (auto const& d : draws)
+        tiny::raster::triangle(d.pts, d.depth, frame, image, *w.depth,
+                               d.color);
+    const auto rendered = clock_type::now();
+    r.render_ms = ms(rendered - loaded).count();
+
+    r.ok = tiny::codec::write(image, j.output, true);
+    if (!r.ok) r.error = "cannot write " + j.output;
+    images.release(std::move(image));
+    const auto written = clock_type::now();
+    r.write_ms = ms(written - rendered).count();
+    r.latency_ms = ms(written - start).count();
+    return r;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    const auto at = values.begin() + size_t(p * (values.size() - 1) + .5);
+    std::nth_element(values.begin(), at, values.end());
+    return *at;
+}
+
+// batch jobs.json [--threads N] [--cache N] [--repeat N] [--report out.json]
+// Renders every job of the list, one job per worker at a time, and prints
+// a JSON report of each job's latency and the throughput of the whole
+// run. --repeat runs the list again with the caches warm. Exits 1 when a
+// job failed.
+int32_t main(int32_t argc, char const* argv[]) {
+    std::string filename;
+    std::string report_file;
+    uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t cache = 8;
+    int32_t repeat = 1;
+    for (int32_t i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache = size_t(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--report" && i + 1 < argc) {
+            report_file = argv[++i];
+        } else {
+            filename = arg;
+        }
+    }
+    if (filename.empty()) {
+        std::cerr << "usage: batch jobs.json [--threads N] [--cache N] "
+                     "[--repeat N] [--report out.json]\n";
+        return 1;
+    }
+
+    std::vector<job> jobs;
+    {
+        std::ifstream in(filename);
+        const auto document = json::parse(in, nullptr, false);
+        std::string error = "cannot parse " + filename;
+        if (document.is_discarded() || !parse_jobs(document, jobs, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+
+    tiny::batch::model_cache models(cache);
+    tiny::image_pool images(threads * 2);
+    tiny::scheduler scheduler(threads);
+    std::vector<worker> workers(scheduler.size());
+    std::vector<result> results(jobs.size() * repeat);
+
+    const auto start = clock_type::now();
+    scheduler.parallel_for(uint32_t(results.size()), [&](uint32_t i, uint32_t w) {
+        results[i] = run(jobs[i % jobs.size()], workers[w], models, images);
+    });
+    const std::chrono::duration<double, std::milli> wall =
+        clock_type::now() - start;
+
+    json report;
+    report["jobs"] = json::array();
+    std::vector<double> latencies;
+    uint64_t failed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        auto const& j = jobs[i % jobs.size()];
+        auto const& r = results[i];
+        json entry = {
+            {"model", j.model},
+            {"width", j.width},
+            {"height", j.height},
+            {"output", j.output},
+            {"ok", r.ok},
+            {"model_hit", r.model_hit},
+            {"load_ms", r.load_ms},
+            {"render_ms", r.render_ms},
+            {"write_ms", r.write_ms},
+            {"latency_ms", r.latency_ms},
+        };
+        if (!r.ok) entry["error"] = r.error;
+        report["jobs"].push_back(entry);
+        latencies.push_back(r.latency_ms);
+        failed += r.ok ? 0 : 1;
+    }
+    report["summary"] = {
+        {"jobs", results.size()},
+        {"failed", failed},
+        {"threads", scheduler.size()},
+        {"wall_ms", wall.count()},
+        {"jobs_per_second", results.size() / (wall.count() / 1e3)},
+        {"latency_p50_ms", percentile(latencies, .5)},
+        {"latency_p95_ms", percentile(latencies, .95)},
+        {"latency_max_ms", percentile(latencies, 1)},
+        {"model_cache", json::parse(models.get_stats().json())},
+        {"image_pool", json::parse(images.get_stats().json())},
+    };
+
+    if (report_file.empty()) {
+        std::cout << report.dump(2) << "\n";
+    } else {
+        std::ofstream(report_file) << report.dump(2) << "\n";
+        std::cout << report["summary"].dump(2) << "\n";
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,1719 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counts every heap allocation, for the memory bench.
+#define TINY_MEMORY_COUNT_NEW
+#include "tiny/memory.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include "reference.hpp"
+#include "stb/stb_image.h"
+#include "tiny.hpp"
+#include "tiny/arena.hpp"
+#include "tiny/codec.hpp"
+#include "tiny/cull.hpp"
+#include "tiny/lines.hpp"
+#include "tiny/msaa.hpp"
+#include "tiny/profile.hpp"
+#include "tiny/raster.hpp"
+#include "tiny/scheduler.hpp"
+#include "tiny/shader.hpp"
+#include "tiny/texture.hpp"
+#include "tiny/vertex.hpp"
+
+struct draw {
+    std::array<tiny::vec2<int32_t>, 3> pts;
+    std::array<float, 3> depth;
+    tiny::color color;
+};
+
+struct scene {
+    std::string name;
+    int32_t width;
+    int32_t height;
+    std::vector<draw> draws;
+};
+
+// Command line settings shared by the benches.
+struct options {
+    // Thread counts of the frame bench; empty picks 1, 2, 4 and the
+    // hardware's.
+    std::vector<uint32_t> threads;
+    // Where the frame bench writes its JSON report, and the report of an
+    // earlier run to compare against.
+    std::string json;
+    std::string baseline;
+    // Slowdown over the baseline reported as a regression.
+    double threshold = .1;
+    // Least time measure() spends on one figure.
+    double min_time = .25;
+};
+
+options g_options;
+bool g_regressed = false;
+
+// Median seconds per call of fn, over at least five calls and enough to
+// fill min_time; the median keeps a noisy machine from skewing compares.
+double measure(std::function<void()> const& fn) {
+    using clock = std::chrono::steady_clock;
+    fn();
+    std::vector<double> samples;
+    const auto start = clock::now();
+    auto last = start;
+    do {
+        fn();
+        const auto now = clock::now();
+        samples.push_back(std::chrono::duration<double>(now - last).count());
+        last = now;
+    } while (samples.size() < 5 ||
+             std::chrono::duration<double>(last - start).count() <
+                 g_options.min_time);
+    const auto middle = samples.begin() + samples.size() / 2;
+    std::nth_element(samples.begin(), middle, samples.end());
+    return *middle;
+}
+
+// The lesson2 flat shaded model, projected to width x height. With cull
+// off the faces turned away from the light are kept too (shaded by the
+// absolute intensity), which gives the depth test some overdraw to chew on.
+scene model_scene(std::string const& filename, int32_t width, int32_t height,
+                  bool cull = true) {
+    tiny::model model(filename);
+    tiny::vec3<float> light_dir{0, 0, -1};
+    scene s{filename + "@" + std::to_string(width), width, height, {}};
+    const auto positions = model.positions();
+    for (int32_t i = 0; i < model.nfaces(); i++) {
+        const auto face = model.face_indices(i);
+        std::array<tiny::vec2<int32_t>, 3> screen;
+        std::array<tiny::vec3<float>, 3> world;
+        std::array<float, 3> depth;
+        for (int32_t j = 0; j < 3; j++) {
+            world[j] = positions[face[j]];
+            screen[j] = {int32_t((world[j].x + 1.) * width / 2.),
+                         int32_t((world[j].y + 1.) * height / 2.)};
+            depth[j] = (1.f - world[j].z) / 2.f;
+        }
+        auto n = tiny::math::normalise(
+            tiny::math::cross(world[2] - world[0], world[1] - world[0]));
+        const auto intensity = tiny::math::dot(n, light_dir);
+        if (cull && intensity <= 0) continue;
+        const auto c = uint8_t(std::abs(intensity) * 255.);
+        s.draws.push_back({screen, depth, tiny::color(c, c, c)});
+    }
+    return s;
+}
+
+// count triangles of roughly size x size pixels scattered over the frame.
+scene random_scene(int32_t count, int32_t size, int32_t width,
+                   int32_t height) {
+    std::mt19937 rng(size);
+    std::uniform_int_distribution<int32_t> px(0, width - 1);
+    std::uniform_int_distribution<int32_t> py(0, height - 1);
+    std::uniform_int_distribution<int32_t> offset(-size, size);
+    scene s{"random-" + std::to_string(size) + "px", width, height, {}};
+    for (int32_t i = 0; i < count; i++) {
+        const tiny::vec2<int32_t> c{px(rng), py(rng)};
+        std::array<tiny::vec2<int32_t>, 3> pts;
+        for (auto& p : pts) p = {c.x + offset(rng), c.y + offset(rng)};
+        s.draws.push_back({pts, {0.f, 0.f, 0.f}, tiny::color(rng() & 0xFFFFFF)});
+    }
+    return s;
+}
+
+int64_t covered_pixels(scene const& s) {
+    int64_t pixels = 0;
+    const tiny::rect frame{0, 0, s.width, s.height};
+    for (auto const& d : s.draws) {
+        tiny::raster::edges e;
+        if (!tiny::raster::setup(d.pts, frame, e)) continue;
+        tiny::raster::rasterize(
+            e, [&](int32_t, int32_t, int32_t, int32_t, int32_t) { pixels++; });
+    }
+    return pixels;
+}
+
+struct variant {
+    std::string name;
+    std::function<void(draw const&, tiny::rect const&, tiny::image&)> draw;
+};
+
+// Prints Mpix/s per variant, the speedup of the last one over the first,
+// and flags variants whose image differs from the second one (the
+// per-pixel reference of the current rasterizer).
+void bench_raster() {
+    std::vector<variant> variants{
+        {"barycentric",
+         [](draw const& d, tiny::rect const&, tiny::image& image) {
+             reference::triangle(d.pts, image, d.color);
+         }},
+        {"edge",
+         [](draw const& d, tiny::rect const& frame, tiny::image& image) {
+             tiny::raster::edges e;
+             if (!tiny::raster::setup(d.pts, frame, e)) return;
+             tiny::raster::rasterize(
+                 e, [&](int32_t x, int32_t y, int32_t, int32_t, int32_t) {
+                     image.set(x, y, d.color);
+                 });
+         }},
+        {"scanline",
+         [](draw const& d, tiny::rect const& frame, tiny::image& image) {
+             tiny::raster::edges e;
+             if (tiny::raster::setup(d.pts, frame, e))
+                 tiny::raster::scanline(e, image, d.color);
+         }},
+    };
+    variants.push_back(
+        {"by size",
+         [](draw const& d, tiny::rect const& frame, tiny::image& image) {
+             tiny::raster::triangle(d.pts, frame, image, d.color);
+         }});
+
+    std::printf("%-36s", "raster (Mpix/s)");
+    for (auto const& v : variants) std::printf(" %12s", v.name.c_str());
+    std::printf(" %8s\n", "speedup");
+
+    const std::vector<scene> scenes{
+        model_scene("assets/african_head.obj", 800, 800),
+        model_scene("assets/african_head.obj", 3840, 2160),
+        model_scene("assets/suzanne.obj", 800, 800),
+        random_scene(50000, 2, 800, 800),
+        random_scene(20000, 8, 800, 800),
+        random_scene(2000, 64, 800, 800),
+        random_scene(100, 400, 800, 800),
+    };
+    for (auto const& s : scenes) {
+        const tiny::rect frame{0, 0, s.width, s.height};
+        const auto pixels = double(covered_pixels(s));
+        tiny::image expected(s.width, s.height);
+        for (auto const& d : s.draws) variants[1].draw(d, frame, expected);
+
+        std::printf("%-36s", s.name.c_str());
+        std::vector<double> seconds;
+        for (auto const& v : variants) {
+            tiny::image image(s.width, s.height);
+            seconds.push_back(measure([&] {
+                for (auto const& d : s.draws) v.draw(d, frame, image);
+            }));
+            const bool same = std::equal(image.data(),
+                                         image.data() + image.size(),
+                                         expected.data());
+            std::printf(" %11.1f%s", pixels / seconds.back() * 1e-6,
+                        same || v.name == "barycentric" ? " " : "!");
+        }
+        std::printf(" %7.2fx\n", seconds.front() / seconds.back());
+    }
+}
+
+// Frame time of depth tested rendering with and without the early-Z
+// pyramid, per depth format, for models drawn without backface culling in
+// file order and back to front. Also checks that early-Z leaves the image
+// untouched.
+void bench_depth() {
+    std::printf("%-36s %-6s %10s %10s %8s %10s\n", "depth (ms/frame)",
+                "format", "no hi-z", "hi-z", "speedup", "rejected");
+    std::vector<scene> scenes;
+    for (auto const* filename :
+         {"assets/african_head.obj", "assets/suzanne.obj"}) {
+        for (auto size : {std::make_pair(800, 800),
+                          std::make_pair(3840, 2160)}) {
+            auto s = model_scene(filename, size.first, size.second, false);
+            scenes.push_back(s);
+            // Back to front: the worst case for early-Z.
+            std::sort(s.draws.begin(), s.draws.end(),
+                      [](draw const& a, draw const& b) {
+                          return a.depth[0] > b.depth[0];
+                      });
+            s.name += "-far-first";
+            scenes.push_back(s);
+            std::reverse(s.draws.begin(), s.draws.end());
+            s.name.replace(s.name.size() - 9, 9, "near-first");
+            scenes.push_back(s);
+        }
+    }
+
+    const std::pair<char const*, tiny::depth_format> formats[] = {
+        {"f32", tiny::depth_format::f32},
+        {"u16", tiny::depth_format::u16},
+        {"u24", tiny::depth_format::u24},
+    };
+    for (auto const& s : scenes) {
+        const tiny::rect frame{0, 0, s.width, s.height};
+        for (auto const& [name, format] : formats) {
+            double seconds[2];
+            tiny::image images[2] = {tiny::image(s.width, s.height),
+                                     tiny::image(s.width, s.height)};
+            tiny::raster::depth_stats stats;
+            for (int32_t hiz = 0; hiz < 2; hiz++) {
+                tiny::depth_buffer depth(s.width, s.height, format, hiz);
+                auto frame_draw = [&](tiny::raster::depth_stats* counters) {
+                    depth.clear();
+                    for (auto const& d : s.draws)
+                        tiny::raster::triangle(d.pts, d.depth, frame,
+                                               images[hiz], depth, d.color,
+                                               counters);
+                };
+                seconds[hiz] = measure([&] { frame_draw(nullptr); });
+                if (hiz) frame_draw(&stats);
+            }
+            const bool same = std::equal(
+                images[0].data(), images[0].data() + images[0].size(),
+                images[1].data());
+            const auto fragments = stats.fragments_tested +
+                                   stats.fragments_rejected;
+            std::printf("%-36s %-6s %10.3f %9.3f%s %7.2fx %9.1f%%\n",
+                        s.name.c_str(), name, seconds[0] * 1e3,
+                        seconds[1] * 1e3, same ? " " : "!",
+                        seconds[0] / seconds[1],
+                        100. * stats.fragments_rejected / fragments);
+        }
+    }
+}
+
+// Whether model read the same triangles as the reference loader, corner
+// by corner. Vertex numbering differs since model welds corners.
+bool same_mesh(tiny::model& model, reference::obj const& expected) {
+    bool same = model.nfaces() == int32_t(expected.faces.size());
+    for (int32_t i = 0; same && i < model.nfaces(); i++) {
+        const auto face = model.face(i);
+        for (int32_t j = 0; same && j < 3; j++) {
+            const auto v = model.vert(face[j]);
+            const auto e = expected.verts[expected.faces[i][j]];
+            same = v.x == e.x && v.y == e.y && v.z == e.z;
+        }
+    }
+    return same;
+}
+
+// OBJ load throughput of the original istringstream loader against
+// tiny::model parsing the text and mapping its binary sidecar, whether all
+// of them read the same triangles, and how many unique vertices welding
+// left of the face corners.
+void bench_load() {
+    std::printf("%-36s %10s %14s %14s %14s %8s %16s\n", "load (MB/s)",
+                "size", "istringstream", "tiny::model", "cached", "speedup",
+                "vertices/corners");
+    for (auto const* filename :
+         {"assets/african_head.obj", "assets/suzanne.obj"}) {
+        const double megabytes = tiny::mapped_file(filename).size() / 1e6;
+        const auto baseline = measure([&] { reference::load_obj(filename); });
+        tiny::scheduler scheduler;
+        const auto parsed = measure(
+            [&] { tiny::model model(filename, false, &scheduler); });
+        const auto cached = measure([&] { tiny::model model(filename); });
+
+        const auto expected = reference::load_obj(filename);
+        tiny::model parsed_model(filename, false);
+        tiny::model cached_model(filename);
+        const bool parsed_same = same_mesh(parsed_model, expected);
+        const bool cached_same =
+            cached_model.is_cached() && same_mesh(cached_model, expected);
+
+        std::printf("%-36s %8.2fMB %14.1f %13.1f%s %13.1f%s %7.2fx %7d/%-8d\n",
+                    filename, megabytes, megabytes / baseline,
+                    megabytes / parsed, parsed_same ? " " : "!",
+                    megabytes / cached, cached_same ? " " : "!",
+                    baseline / cached, parsed_model.nverts(),
+                    parsed_model.nfaces() * 3);
+    }
+}
+
+using screen_faces = std::vector<std::array<tiny::vec2<int32_t>, 3>>;
+
+// Screen space corners of every face, either transforming each face
+// corner on its own, as lesson2 used to, or each unique vertex once into a
+// buffer the faces index. The buffers are reused from call to call.
+void assemble_corners(tiny::model const& model, int32_t width,
+                      int32_t height, screen_faces& faces) {
+    const auto positions = model.positions();
+    faces.resize(model.nfaces());
+    for (int32_t i = 0; i < model.nfaces(); i++) {
+        const auto face = model.face_indices(i);
+        for (int32_t j = 0; j < 3; j++) {
+            auto const& v = positions[face[j]];
+            faces[i][j] = {int32_t((v.x + 1.) * width / 2.),
+                           int32_t((v.y + 1.) * height / 2.)};
+        }
+    }
+}
+
+void assemble_unique(tiny::model const& model, int32_t width, int32_t height,
+                     std::vector<tiny::vec2<int32_t>>& screen,
+                     screen_faces& faces) {
+    const auto positions = model.positions();
+    screen.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        screen[i] = {int32_t((positions[i].x + 1.) * width / 2.),
+                     int32_t((positions[i].y + 1.) * height / 2.)};
+    faces.resize(model.nfaces());
+    for (int32_t i = 0; i < model.nfaces(); i++) {
+        const auto face = model.face_indices(i);
+        for (int32_t j = 0; j < 3; j++) faces[i][j] = screen[face[j]];
+    }
+}
+
+// Vertex stage time per model for per-corner and per-vertex transforms,
+// before and after the vertex cache / fetch reordering, with the ACMR of
+// a 16 entry FIFO cache for both orders.
+void bench_vertex() {
+    std::printf("%-36s %10s %10s %10s %8s %12s %12s\n", "vertex (us/frame)",
+                "corners", "unique", "optimized", "speedup", "acmr before",
+                "acmr after");
+    for (auto const* filename :
+         {"assets/african_head.obj", "assets/suzanne.obj"}) {
+        tiny::model model(filename);
+        std::vector<tiny::vec2<int32_t>> screen;
+        screen_faces expected, actual;
+        const auto corners = measure(
+            [&] { assemble_corners(model, 800, 800, expected); });
+        const auto unique = measure(
+            [&] { assemble_unique(model, 800, 800, screen, actual); });
+        const bool same = std::equal(
+            actual.begin(), actual.end(), expected.begin(),
+            [](auto const& a, auto const& b) {
+                for (int32_t j = 0; j < 3; j++)
+                    if (a[j].x != b[j].x || a[j].y != b[j].y) return false;
+                return true;
+            });
+        const auto stats = model.optimize();
+        const auto optimized = measure(
+            [&] { assemble_unique(model, 800, 800, screen, actual); });
+        std::printf("%-36s %10.1f %9.1f%s %10.1f %7.2fx %12.3f %12.3f\n",
+                    filename, corners * 1e6, unique * 1e6, same ? " " : "!",
+                    optimized * 1e6, corners / optimized, stats.acmr_before,
+                    stats.acmr_after);
+    }
+}
+
+// Vertex stage over 65536 random positions, which stay in cache, in
+// Mverts/s: the hand-written screen mapping against
+// tiny::vertex::transform per precision and instruction set. '!' marks
+// pixels or depths that differ from the scalar kernel of the same
+// precision.
+void bench_matrix() {
+    constexpr int32_t width = 800, height = 800;
+    std::printf("%-36s %12s %12s %8s\n", "matrix (Mverts/s)", "hand-written",
+                "transform", "speedup");
+    std::vector<tiny::vec3<float>> positions(1 << 16);
+    std::mt19937 rng(16);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    for (auto& p : positions) p = {unit(rng), unit(rng), unit(rng)};
+    std::vector<tiny::vec2<int32_t>> pts(positions.size()),
+        expected_pts(positions.size());
+    std::vector<float> depth(positions.size()), expected_depth(positions.size());
+
+    const auto hand = measure([&] {
+        for (size_t i = 0; i < positions.size(); i++) {
+            pts[i] = {int32_t((positions[i].x + 1.) * width / 2.),
+                      int32_t((positions[i].y + 1.) * height / 2.)};
+            depth[i] = (1.f - positions[i].z) / 2.f;
+        }
+    });
+    auto run = [&](char const* precision, auto const& m) {
+        tiny::span<tiny::vec3<float> const> in(positions.data(),
+                                                positions.size());
+        tiny::vertex::transform(in, m, tiny::span<tiny::vec2<int32_t>>(
+                                           expected_pts),
+                                tiny::span<float>(expected_depth), {},
+                                tiny::simd::isa::scalar);
+        for (auto isa : {tiny::simd::isa::scalar, tiny::simd::isa::sse41,
+                         tiny::simd::isa::avx2}) {
+            if (isa > tiny::simd::active()) break;
+            tiny::span<tiny::vec2<int32_t>> out_pts(pts);
+            tiny::span<float> out_depth(depth);
+            const auto after = measure([&] {
+                tiny::vertex::transform(in, m, out_pts, out_depth, {}, isa);
+            });
+            bool same = expected_depth == depth;
+            for (size_t i = 0; same && i < pts.size(); i++)
+                same = pts[i].x == expected_pts[i].x &&
+                       pts[i].y == expected_pts[i].y;
+            const double verts = positions.size() * 1e-6;
+            std::printf("%-36s %12.1f %11.1f%s %7.2fx\n",
+                        (std::string(precision) + " " + tiny::simd::name(isa))
+                            .c_str(),
+                        verts / hand, verts / after, same ? " " : "!",
+                        hand / after);
+        }
+    };
+    using namespace tiny::math;
+    const auto m = viewport<double>(0, 0, width, height) *
+                   orthographic<double>(-1, 1, -1, 1, 0, 2) *
+                   look_at<double>({0, 0, 1}, {0, 0, 0}, {0, 1, 0});
+    run("double", m);
+    run("float", m.cast<float>());
+    const auto camera =
+        viewport<double>(0, 0, width, height) *
+        perspective<double>(.8, double(width) / height, .1, 10) *
+        look_at<double>({1, 1, 3}, {0, 0, 0}, {0, 1, 0});
+    run("double perspective", camera);
+    run("float perspective", camera.cast<float>());
+}
+
+// Per-triangle setup in ns: flat shading of a model's faces, the
+// rasterizer's edge setup, and triangle_6's span walk written per
+// component and as vector expressions, which must cost the same. '!'
+// marks results that differ from the row above.
+void bench_setup() {
+    std::printf("%-36s %12s %8s\n", "setup (ns/triangle)", "time",
+                "speedup");
+    auto row = [](std::string const& name, double seconds, size_t count,
+                  double baseline, std::string const& note) {
+        std::printf("%-36s %12.1f", name.c_str(), seconds * 1e9 / count);
+        if (baseline > 0)
+            std::printf(" %7.2fx", baseline / seconds);
+        else
+            std::printf(" %8s", "");
+        std::printf(" %s\n", note.c_str());
+    };
+
+    tiny::model model("assets/african_head.obj");
+    const auto positions = model.positions();
+    const tiny::vec3<float> light_dir{0, 0, -1};
+    std::vector<uint8_t> grey(model.nfaces());
+    const auto shading = measure([&] {
+        for (int32_t i = 0; i < model.nfaces(); i++) {
+            const auto face = model.face_indices(i);
+            auto const& a = positions[face[0]];
+            const auto n = tiny::math::normalise(tiny::math::cross(
+                positions[face[2]] - a, positions[face[1]] - a));
+            const auto intensity = tiny::math::dot(n, light_dir);
+            grey[i] = intensity > 0 ? uint8_t(intensity * 255.) : 0;
+        }
+    });
+    row("shading normalise", shading, grey.size(), 0, "");
+
+    const auto s = model_scene("assets/african_head.obj", 800, 800);
+    const tiny::rect frame{0, 0, 800, 800};
+    int64_t kept = 0;
+    const auto edges = measure([&] {
+        kept = 0;
+        for (auto const& d : s.draws) {
+            tiny::raster::edges e;
+            kept += tiny::raster::setup(d.pts, frame, e);
+        }
+    });
+    row("edge setup", edges, s.draws.size(), 0, "");
+
+    // Both walks return the sum of every span's ends.
+    const auto spans = random_scene(10000, 16, 800, 800);
+    auto sorted = [](std::array<tiny::vec2<int32_t>, 3> pts) {
+        std::sort(pts.begin(), pts.end(),
+                  [](auto const& a, auto const& b) { return a.y < b.y; });
+        return pts;
+    };
+    auto components = [&] {
+        int64_t sum = 0;
+        for (auto const& d : spans.draws) {
+            const auto [t0, t1, t2] = sorted(d.pts);
+            const int32_t total_height = t2.y - t0.y;
+            for (int32_t i = 0; i < total_height; i++) {
+                const bool second_half = i > t1.y - t0.y || t1.y == t0.y;
+                const int32_t segment_height =
+                    second_half ? t2.y - t1.y : t1.y - t0.y;
+                const float alpha = float(i) / float(total_height);
+                const float beta =
+                    float(i - (second_half ? t1.y - t0.y : 0)) /
+                    segment_height;
+                const int32_t ax = t0.x + int32_t((t2.x - t0.x) * alpha);
+                const int32_t bx =
+                    second_half ? t1.x + int32_t((t2.x - t1.x) * beta)
+                                : t0.x + int32_t((t1.x - t0.x) * beta);
+                sum += ax + bx;
+            }
+        }
+        return sum;
+    };
+    auto expressions = [&] {
+        int64_t sum = 0;
+        for (auto const& d : spans.draws) {
+            const auto [t0, t1, t2] = sorted(d.pts);
+            const int32_t total_height = t2.y - t0.y;
+            for (int32_t i = 0; i < total_height; i++) {
+                const bool second_half = i > t1.y - t0.y || t1.y == t0.y;
+                const int32_t segment_height =
+                    second_half ? t2.y - t1.y : t1.y - t0.y;
+                const float alpha = float(i) / float(total_height);
+                const float beta =
+                    float(i - (second_half ? t1.y - t0.y : 0)) /
+                    segment_height;
+                const auto a = t0 + (t2 - t0) * alpha;
+                const auto b = second_half ? t1 + (t2 - t1) * beta
+                                           : t0 + (t1 - t0) * beta;
+                sum += a.x + b.x;
+            }
+        }
+        return sum;
+    };
+    int64_t expected = 0, actual = 0;
+    const auto by_component = measure([&] { expected = components(); });
+    const auto by_expression = measure([&] { actual = expressions(); });
+    row("span walk components", by_component, spans.draws.size(), 0, "");
+    row("span walk expressions", by_expression, spans.draws.size(),
+        by_component, actual == expected ? "" : "!");
+}
+
+// Full 4K frame of horizontal spans through the checked image::set(), an
+// unchecked view's set() and fill_span(), per pixel format, in Mpix/s.
+void bench_pixels() {
+    constexpr int32_t width = 3840, height = 2160;
+    std::printf("%-36s %12s %12s %12s %8s\n", "pixels (Mpix/s)", "set",
+                "view set", "fill_span", "speedup");
+    const tiny::color color(0x336699);
+    auto run = [&](char const* name, tiny::image& image, auto view) {
+        const auto set = measure([&] {
+            for (int32_t y = 0; y < height; y++)
+                for (int32_t x = 0; x < width; x++) image.set(x, y, color);
+        });
+        const auto view_set = measure([&] {
+            for (int32_t y = 0; y < height; y++)
+                for (int32_t x = 0; x < width; x++) view.set(x, y, color);
+        });
+        const auto span = measure([&] {
+            for (int32_t y = 0; y < height; y++)
+                view.fill_span(0, width, y, color);
+        });
+        const double pixels = double(width) * height * 1e-6;
+        std::printf("%-36s %12.1f %12.1f %12.1f %7.2fx\n", name, pixels / set,
+                    pixels / view_set, pixels / span, set / span);
+    };
+    tiny::image rgb(width, height, 3), rgba(width, height, 4);
+    run("rgb8", rgb, rgb.view<tiny::pixel_format::rgb8>());
+    run("rgba8", rgba, rgba.view<tiny::pixel_format::rgba8>());
+    run("u32", rgba, rgba.view<tiny::pixel_format::u32>());
+}
+
+bool same_pixels(tiny::image const& a, tiny::image const& b) {
+    return a.size() == b.size() &&
+           std::equal(a.data(), a.data() + a.size(), b.data());
+}
+
+// Whole-image transforms at 4K, per channel count: the per-pixel
+// flips, transpose and flip-then-encode against row swaps, byte shuffles,
+// tiled remapping and encoding bottom-up. '!' marks a result that differs
+// from the old one.
+void bench_transform() {
+    constexpr int32_t width = 3840, height = 2160;
+    std::printf("%-36s %12s %12s %8s\n", "transform (ms)", "before", "after",
+                "speedup");
+    auto row = [](std::string const& name, double before, double after,
+                  bool same) {
+        std::printf("%-36s %12.3f %11.3f%s %7.2fx\n", name.c_str(),
+                    before * 1e3, after * 1e3, same ? " " : "!",
+                    before / after);
+    };
+    for (auto const channels : {3, 4}) {
+        const auto suffix = " (" + std::to_string(channels) + " channels)";
+        tiny::image source(width, height, channels);
+        std::mt19937 rng(channels);
+        for (size_t i = 0; i < source.size(); i++)
+            source.data()[i] = uint8_t(rng());
+        tiny::image a(width, height, channels), b(width, height, channels);
+        auto reset = [&] {
+            std::memcpy(a.data(), source.data(), source.size());
+            std::memcpy(b.data(), source.data(), source.size());
+        };
+
+        reset();
+        auto before = measure([&] { reference::flipv(a); });
+        auto after = measure([&] { b.flipv(); });
+        reset();
+        reference::flipv(a);
+        b.flipv();
+        row("flipv" + suffix, before, after, same_pixels(a, b));
+
+        for (auto isa : {tiny::simd::isa::scalar, tiny::simd::isa::sse41}) {
+            if (isa > tiny::simd::active()) break;
+            std::vector<uint8_t> scratch(size_t(width) * channels + 16);
+            auto flip = [&](tiny::image& image) {
+                for (int32_t y = 0; y < height; y++) {
+                    tiny::pixels::reverse(image.row(y), scratch.data(), width,
+                                          channels, isa);
+                    std::memcpy(image.row(y), scratch.data(),
+                                size_t(width) * channels);
+                }
+            };
+            reset();
+            before = measure([&] { reference::fliph(a); });
+            after = measure([&] { flip(b); });
+            reset();
+            reference::fliph(a);
+            flip(b);
+            row(std::string("fliph ") + tiny::simd::name(isa) + suffix, before,
+                after, same_pixels(a, b));
+        }
+
+        tiny::image transposed(height, width, channels),
+            expected(height, width, channels);
+        before = measure([&] { reference::transpose(a, expected); });
+        after = measure([&] { tiny::transpose(a, transposed); });
+        row("transpose" + suffix, before, after,
+            same_pixels(expected, transposed));
+
+        // A gradient frame rather than the noise, which would spend all
+        // the time in deflate. Both files must come out byte for byte the
+        // same.
+        auto gradient = [&](tiny::image& image) {
+            for (int32_t y = 0; y < height; y++)
+                for (int32_t x = 0; x < width * channels; x++)
+                    image.row(y)[x] = uint8_t((x / channels + y) >> 4);
+        };
+        gradient(a);
+        gradient(b);
+        auto read = [](char const* filename) {
+            std::ifstream in(filename, std::ios::binary);
+            return std::string(std::istreambuf_iterator<char>(in), {});
+        };
+        before = measure([&] {
+            a.flipv();
+            a.write_png("benchmark-a.png");
+        });
+        after = measure([&] { b.write_png("benchmark-b.png", true); });
+        gradient(a);
+        a.flipv();
+        a.write_png("benchmark-a.png");
+        const bool same_png =
+            read("benchmark-a.png") == read("benchmark-b.png");
+        std::remove("benchmark-a.png");
+        std::remove("benchmark-b.png");
+        row("flipv+png / flipped png" + suffix, before, after, same_png);
+    }
+}
+
+// The lesson2 frame: the model is transformed once per unique vertex,
+// assembled and flat shaded, then drawn depth tested, binned over the
+// scheduler's threads when it has more than one. Everything transient
+// lives in the frame's arena.
+tiny::span<draw> frame_setup(tiny::model const& model, int32_t width,
+                             int32_t height, tiny::arena& arena) {
+    const tiny::vec3<float> light_dir{0, 0, -1};
+    const auto positions = model.positions();
+    auto screen = arena.allocate<tiny::vec2<int32_t>>(positions.size());
+    auto depth = arena.allocate<float>(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        screen[i] = {int32_t((positions[i].x + 1.) * width / 2.),
+                     int32_t((positions[i].y + 1.) * height / 2.)};
+        depth[i] = (1.f - positions[i].z) / 2.f;
+    }
+    auto draws = arena.allocate<draw>(model.nfaces());
+    size_t count = 0;
+    for (int32_t i = 0; i < model.nfaces(); i++) {
+        const auto face = model.face_indices(i);
+        auto const& a = positions[face[0]];
+        const auto n = tiny::math::normalise(tiny::math::cross(
+            positions[face[2]] - a, positions[face[1]] - a));
+        const auto intensity = tiny::math::dot(n, light_dir);
+        if (intensity <= 0) continue;
+        const auto c = uint8_t(intensity * 255.);
+        draws[count++] = {{screen[face[0]], screen[face[1]], screen[face[2]]},
+                          {depth[face[0]], depth[face[1]], depth[face[2]]},
+                          tiny::color(c, c, c)};
+    }
+    return draws.subspan(0, count);
+}
+
+void frame_raster(tiny::span<draw> const& draws, tiny::scheduler& scheduler,
+                  tiny::tile_bins& bins, tiny::image& image,
+                  tiny::depth_buffer& depth, tiny::arena* arena = nullptr) {
+    std::fill(image.data(), image.data() + image.size(), 0);
+    depth.clear();
+    if (scheduler.size() == 1) {
+        const tiny::rect frame{0, 0, image.get_width(), image.get_height()};
+        for (auto const& d : draws)
+            tiny::raster::triangle(d.pts, d.depth, frame, image, depth,
+                                   d.color);
+        return;
+    }
+    bins.build(uint32_t(draws.size()),
+               [&](uint32_t i) { return tiny::raster::bounds(draws[i].pts); },
+               arena);
+    scheduler.parallel_for(bins.ntiles(), [&](uint32_t tile, uint32_t) {
+        const auto clip = bins.tile(tile);
+        for (auto const i : bins.items(tile)) {
+            auto const& d = draws[i];
+            tiny::raster::triangle(d.pts, d.depth, clip, image, depth,
+                                   d.color);
+        }
+    });
+}
+
+// lesson2's setup and depth tested raster in ms, with the model zoomed so
+// that more and more of it falls off screen: culling by the lighting
+// normal and leaving the rest to the rasterizer's scissor, against the
+// cull stage. The counts are what the stage removed; at 256x the faces
+// that cover the viewport reach past the guard band and are clipped,
+// where the old path leaves the rasterizer's 32 bit edges to overflow.
+void bench_cull() {
+    constexpr int32_t width = 800, height = 800;
+    std::printf("%-36s %10s %10s %8s %10s %10s %10s\n", "cull (ms)", "before",
+                "after", "speedup", "backface", "frustum", "clipped");
+    tiny::model model("assets/african_head.obj");
+    const auto positions = model.positions();
+    const tiny::vec3<float> light_dir{0, 0, -1};
+    const tiny::rect frame{0, 0, width, height};
+    std::vector<tiny::vec2<int32_t>> screen(positions.size());
+    std::vector<float> z(positions.size());
+    tiny::image image(width, height);
+    tiny::depth_buffer depth(width, height);
+    for (const double zoom : {1., 4., 16., 32., 256.}) {
+        using namespace tiny::math;
+        const auto m = viewport<double>(0, 0, width, height) *
+                       scale<double>({zoom, zoom, 1}) *
+                       orthographic<double>(-1, 1, -1, 1, 0, 2) *
+                       look_at<double>({0, 0, 1}, {0, 0, 0}, {0, 1, 0});
+        tiny::vertex::transform(positions, m,
+                                tiny::span<tiny::vec2<int32_t>>(screen),
+                                tiny::span<float>(z));
+        auto corners = [&](tiny::span<uint32_t const> face) {
+            return std::array<tiny::vec2<int32_t>, 3>{
+                screen[face[0]], screen[face[1]], screen[face[2]]};
+        };
+        auto depths = [&](tiny::span<uint32_t const> face) {
+            return std::array<float, 3>{z[face[0]], z[face[1]], z[face[2]]};
+        };
+        const auto before = measure([&] {
+            depth.clear();
+            for (int32_t i = 0; i < model.nfaces(); i++) {
+                const auto face = model.face_indices(i);
+                auto const& a = positions[face[0]];
+                const auto n = normalise(cross(positions[face[2]] - a,
+                                               positions[face[1]] - a));
+                const auto intensity = dot(n, light_dir);
+                if (intensity <= 0) continue;
+                const auto c = uint8_t(intensity * 255.);
+                tiny::raster::triangle(corners(face), depths(face), frame,
+                                       image, depth, tiny::color(c, c, c));
+            }
+        });
+        tiny::cull::stats culled;
+        const auto after = measure([&] {
+            depth.clear();
+            culled = {};
+            std::array<tiny::cull::piece, tiny::cull::max_pieces> pieces;
+            for (int32_t i = 0; i < model.nfaces(); i++) {
+                const auto face = model.face_indices(i);
+                const auto kept = tiny::cull::triangle(
+                    corners(face), depths(face), frame, pieces, &culled);
+                if (kept == 0) continue;
+                auto const& a = positions[face[0]];
+                const auto n = normalise(cross(positions[face[2]] - a,
+                                               positions[face[1]] - a));
+                const auto c =
+                    uint8_t(std::max(0.f, dot(n, light_dir)) * 255.);
+                for (int32_t k = 0; k < kept; k++)
+                    tiny::raster::triangle(pieces[k].pts, pieces[k].depth,
+                                           frame, image, depth,
+                                           tiny::color(c, c, c));
+            }
+        });
+        std::printf("%-36s %10.3f %10.3f %7.2fx %10llu %10llu %10llu\n",
+                    ("african_head zoom " + std::to_string(int32_t(zoom)))
+                        .c_str(),
+                    before * 1e3, after * 1e3, before / after,
+                    (unsigned long long)culled.backface,
+                    (unsigned long long)culled.frustum,
+                    (unsigned long long)culled.clipped);
+    }
+}
+
+struct wireframe {
+    std::string name;
+    int32_t width;
+    int32_t height;
+    std::vector<tiny::vec2<int32_t>> pts;
+    std::vector<uint32_t> indices;
+};
+
+// A model through lesson2's camera, zoomed about the centre of the frame.
+wireframe model_wireframe(std::string const& filename, int32_t width,
+                          int32_t height, double zoom) {
+    tiny::model model(filename);
+    const auto positions = model.positions();
+    wireframe w{filename + "@" + std::to_string(width) + " zoom " +
+                    std::to_string(int32_t(zoom)),
+                width, height, std::vector<tiny::vec2<int32_t>>(positions.size()),
+                {model.indices().begin(), model.indices().end()}};
+    std::vector<float> depth(positions.size());
+    using namespace tiny::math;
+    const auto m = viewport<double>(0, 0, width, height) *
+                   scale<double>({zoom, zoom, 1}) *
+                   orthographic<double>(-1, 1, -1, 1, 0, 2) *
+                   look_at<double>({0, 0, 1}, {0, 0, 0}, {0, 1, 0});
+    tiny::vertex::transform(positions, m, tiny::span<tiny::vec2<int32_t>>(w.pts),
+                            tiny::span<float>(depth));
+    return w;
+}
+
+// n x n quads of two triangles each over a square of side pixels from
+// (x, y), which may reach out of the frame.
+wireframe grid_wireframe(int32_t n, int32_t x, int32_t y, int32_t side,
+                         int32_t width, int32_t height) {
+    wireframe w{"grid " + std::to_string(n) + "x" + std::to_string(n),
+                width, height, {}, {}};
+    for (int32_t j = 0; j <= n; j++)
+        for (int32_t i = 0; i <= n; i++)
+            w.pts.push_back({x + i * side / n, y + j * side / n});
+    for (uint32_t j = 0; j < uint32_t(n); j++)
+        for (uint32_t i = 0; i < uint32_t(n); i++) {
+            const uint32_t v = j * (n + 1) + i;
+            for (const uint32_t k : {v, v + 1, v + n + 2, v, v + n + 2, v + n + 1})
+                w.indices.push_back(k);
+        }
+    return w;
+}
+
+// Wireframes in millions of unique edges drawn per second: lesson1's
+// line() over the three sides of every face, tiny::lines::line() over the
+// same sides, the deduplicated edge list in one batch, and the batch
+// anti-aliased. The aliased variants must match line()'s image pixel for
+// pixel, '!' marks one that does not; the grid reaches past the frame on
+// every side, so most of its lines are clipped or rejected.
+void bench_lines() {
+    std::printf("%-36s %10s %10s %10s %10s %8s %10s\n", "lines (Medges/s)",
+                "line()", "per face", "edges", "wu", "speedup", "edges");
+    const std::vector<wireframe> scenes{
+        model_wireframe("assets/african_head.obj", 800, 800, 1),
+        model_wireframe("assets/african_head.obj", 3840, 2160, 1),
+        model_wireframe("assets/african_head.obj", 800, 800, 4),
+        grid_wireframe(256, -200, -200, 1200, 800, 800),
+    };
+    const auto white = tiny::color::white();
+    for (auto const& w : scenes) {
+        const tiny::rect frame{0, 0, w.width, w.height};
+        const tiny::span<tiny::vec2<int32_t> const> pts(w.pts);
+        const auto edges = tiny::lines::unique_edges(w.indices);
+        auto each_side = [&](auto&& fn) {
+            for (size_t i = 0; i + 3 <= w.indices.size(); i += 3)
+                for (int32_t k = 0; k < 3; k++)
+                    fn(w.pts[w.indices[i + k]],
+                       w.pts[w.indices[i + (k + 1) % 3]]);
+        };
+        tiny::image expected(w.width, w.height);
+        const auto line = measure([&] {
+            each_side([&](auto a, auto b) {
+                reference::line(a.x, a.y, b.x, b.y, expected, white);
+            });
+        });
+        tiny::image per_face(w.width, w.height);
+        const auto view = per_face.view<tiny::pixel_format::rgb8>();
+        const auto face = measure([&] {
+            each_side([&](auto a, auto b) {
+                tiny::lines::line(a, b, frame, view, white);
+            });
+        });
+        tiny::image batched(w.width, w.height);
+        const auto batch = measure([&] {
+            tiny::lines::draw(edges, pts, frame, batched, white);
+        });
+        tiny::image smooth(w.width, w.height);
+        const auto wu = measure([&] {
+            tiny::lines::draw(edges, pts, frame, smooth, white,
+                              tiny::lines::mode::antialiased);
+        });
+        auto same = [&](tiny::image const& image) {
+            return std::equal(image.data(), image.data() + image.size(),
+                              expected.data());
+        };
+        const double count = double(edges.size());
+        std::printf("%-36s %10.2f %9.2f%s %9.2f%s %10.2f %7.2fx %10zu\n",
+                    w.name.c_str(), count / line * 1e-6, count / face * 1e-6,
+                    same(per_face) ? " " : "!", count / batch * 1e-6,
+                    same(batched) ? " " : "!", count / wu * 1e-6,
+                    line / batch, edges.size());
+    }
+}
+
+// Texture sampling in Msamples/s along rays in random directions over a
+// 4096x4096 texture, 64 MB at level 0, per layout and filter. 1:1 steps
+// one texel per sample at level 0, as a triangle drawn at the texture's
+// size does; 8:1 steps eight, a triangle drawn at an eighth of it, once
+// at level 0 and once at level 3 of the mip chain, where the step is one
+// texel again. '!' marks a tiled result whose samples differ from the
+// linear one's.
+void bench_texture() {
+    constexpr int32_t size = 4096, rays = 4096, steps = 256;
+    std::vector<uint8_t> pixels(size_t(size) * size * 4);
+    std::mt19937 rng(size);
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        const auto x = uint32_t(i / 4 % size), y = uint32_t(i / 4 / size);
+        pixels[i + 0] = uint8_t(x ^ y);
+        pixels[i + 1] = uint8_t(x * 3 + (rng() & 15));
+        pixels[i + 2] = uint8_t(y * 5);
+        pixels[i + 3] = 0xFF;
+    }
+    const tiny::texture linear(size, size, pixels.data(),
+                               tiny::texture_layout::linear);
+    const tiny::texture tiled(size, size, pixels.data(),
+                              tiny::texture_layout::tiled);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::vector<tiny::vec2<float>> starts(rays), directions(rays);
+    for (int32_t i = 0; i < rays; i++) {
+        starts[i] = {unit(rng), unit(rng)};
+        const float angle = unit(rng) * 6.2831853f;
+        directions[i] = {std::cos(angle) / size, std::sin(angle) / size};
+    }
+
+    std::printf("%-36s %12s %12s %12s %12s %8s\n", "texture (Msamples/s)",
+                "linear near", "tiled near", "linear bilin", "tiled bilin",
+                "speedup");
+    const struct {
+        char const* name;
+        float ratio;
+        int32_t level;
+    } cases[] = {{"4096^2 1:1 level 0", 1, 0},
+                 {"4096^2 8:1 level 0", 8, 0},
+                 {"4096^2 8:1 level 3", 8, 3}};
+    for (auto const& c : cases) {
+        std::printf("%-36s", c.name);
+        std::vector<double> seconds;
+        for (auto filter : {tiny::texture_filter::nearest,
+                            tiny::texture_filter::bilinear}) {
+            uint64_t sums[2] = {};
+            int32_t n = 0;
+            for (auto const* t : {&linear, &tiled}) {
+                uint64_t sum = 0;
+                seconds.push_back(measure([&] {
+                    sum = 0;
+                    for (int32_t i = 0; i < rays; i++) {
+                        auto uv = starts[i];
+                        const auto step = directions[i] * c.ratio;
+                        for (int32_t k = 0; k < steps; k++, uv += step)
+                            sum += t->sample(uv, c.level, filter);
+                    }
+                }));
+                sums[n++] = sum;
+                std::printf(" %11.1f%s",
+                            double(rays) * steps / seconds.back() * 1e-6,
+                            n == 2 && sums[0] != sums[1] ? "!" : " ");
+            }
+        }
+        std::printf(" %7.2fx\n", seconds[2] / seconds[3]);
+    }
+}
+
+// The shaders behind a virtual interface, the way a plugin boundary would
+// call them: the rasterizer sees only virtual_shader and pays an indirect
+// call, and an interpolation it cannot specialise, per fragment.
+struct virtual_shader {
+    virtual ~virtual_shader() = default;
+    virtual void begin(int32_t face) = 0;
+    virtual tiny::color fragment(tiny::vec3<float> const& weights) const = 0;
+};
+
+template <typename Shader>
+struct virtual_adapter : virtual_shader {
+    Shader shader;
+    typename Shader::primitive primitive;
+    typename Shader::varying v[3];
+
+    explicit virtual_adapter(Shader s) : shader(s) {}
+    void begin(int32_t face) override {
+        primitive = shader.setup(face);
+        for (int32_t k = 0; k < 3; k++) v[k] = shader.vertex(primitive, face, k);
+    }
+    tiny::color fragment(tiny::vec3<float> const& weights) const override {
+        return shader.fragment(
+            primitive, tiny::shaders::interpolate(weights, v[0], v[1], v[2]));
+    }
+};
+
+// Frame time in ms of the shipped shaders on a model: drawn through
+// tiny::shaders::draw(), specialised per shader, and through the virtual
+// interface. The template flat shader goes through the SIMD flat fill
+// that only a compile time flat_color can pick; the smooth ones run the
+// same per-pixel loop either way, so what is left between the columns is
+// the dispatch. '!' marks images that differ, the template flat one being
+// checked against lesson2's plain raster::triangle() path.
+void bench_shaders() {
+    std::printf("%-36s %10s %10s %8s %12s\n", "shaders (ms)", "template",
+                "virtual", "speedup", "Mfrag/s");
+    tiny::model model("assets/african_head.obj");
+    const auto positions = model.positions();
+    constexpr int32_t texture_size = 1024;
+    std::vector<uint8_t> pixels(size_t(texture_size) * texture_size * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = uint8_t(i * 2654435761u >> 24 | 0x40);
+    const tiny::texture diffuse(texture_size, texture_size, pixels.data());
+
+    for (auto const& [width, height] :
+         std::vector<std::pair<int32_t, int32_t>>{{800, 800}, {3840, 2160}}) {
+        std::vector<tiny::vec2<int32_t>> screen(positions.size());
+        std::vector<float> z(positions.size()), inv_w(positions.size());
+        using namespace tiny::math;
+        const auto m = viewport<double>(0, 0, width, height) *
+                       perspective<double>(2 * std::atan(.37), 1, 1, 5) *
+                       look_at<double>({0, 0, 3}, {0, 0, 0}, {0, 1, 0});
+        tiny::vertex::transform(positions, m,
+                                tiny::span<tiny::vec2<int32_t>>(screen),
+                                tiny::span<float>(z), tiny::span<float>(inv_w));
+        const tiny::rect frame{0, 0, width, height};
+        // Faces that survive culling; at this zoom none needs clipping.
+        std::vector<int32_t> faces;
+        std::array<tiny::cull::piece, tiny::cull::max_pieces> pieces;
+        auto corners = [&](int32_t i) {
+            const auto f = model.face_indices(i);
+            return std::array<tiny::vec2<int32_t>, 3>{screen[f[0]], screen[f[1]],
+                                                      screen[f[2]]};
+        };
+        auto depths = [&](int32_t i) {
+            const auto f = model.face_indices(i);
+            return std::array<float, 3>{z[f[0]], z[f[1]], z[f[2]]};
+        };
+        auto weights = [&](int32_t i) {
+            const auto f = model.face_indices(i);
+            return std::array<float, 3>{inv_w[f[0]], inv_w[f[1]], inv_w[f[2]]};
+        };
+        for (int32_t i = 0; i < model.nfaces(); i++)
+            if (tiny::cull::triangle(corners(i), depths(i), frame, pieces) == 1)
+                faces.push_back(i);
+
+        tiny::shaders::scene scene{&model, screen, {0, 0, -1}, &diffuse,
+                                   tiny::texture_filter::bilinear};
+        tiny::image image(width, height), expected(width, height);
+        tiny::depth_buffer depth(width, height);
+        auto run = [&](char const* name, auto const& shader,
+                       virtual_shader& dynamic) {
+            tiny::raster::depth_stats stats;
+            const auto specialised = measure([&] {
+                depth.clear();
+                stats = {};
+                for (const auto i : faces)
+                    tiny::shaders::draw(shader, i, corners(i), depths(i),
+                                        corners(i), weights(i), frame, image,
+                                        depth, &stats);
+            });
+            std::swap(image, expected);
+            const auto indirect = measure([&] {
+                depth.clear();
+                for (const auto i : faces) {
+                    tiny::raster::edges e;
+                    if (!tiny::raster::setup(corners(i), frame, e)) continue;
+                    dynamic.begin(i);
+                    const auto w =
+                        tiny::raster::perspective_weights(corners(i), weights(i));
+                    tiny::raster::shade(
+                        e, tiny::raster::plane(corners(i), depths(i)), image,
+                        depth,
+                        [&](int32_t x, int32_t y, int32_t, int32_t, int32_t) {
+                            return dynamic.fragment(w.at(x, y));
+                        });
+                }
+            });
+            if (std::string(name) == "flat") {
+                depth.clear();
+                for (const auto i : faces)
+                    tiny::raster::triangle(corners(i), depths(i), frame, image,
+                                           depth,
+                                           tiny::shaders::flat{scene}
+                                               .setup(i)
+                                               .paint);
+            }
+            const bool same = std::equal(image.data(),
+                                         image.data() + image.size(),
+                                         expected.data());
+            std::printf("%-36s %10.3f %9.3f%s %7.2fx %12.1f\n",
+                        (std::string(name) + " " + std::to_string(width) + "x" +
+                         std::to_string(height))
+                            .c_str(),
+                        specialised * 1e3, indirect * 1e3, same ? " " : "!",
+                        indirect / specialised,
+                        stats.fragments_passed / specialised * 1e-6);
+        };
+        // Picked at run time, so the compiler cannot see through the calls.
+        std::vector<std::unique_ptr<virtual_shader>> dynamic;
+        dynamic.emplace_back(new virtual_adapter<tiny::shaders::flat>({scene}));
+        dynamic.emplace_back(new virtual_adapter<tiny::shaders::gouraud>({scene}));
+        dynamic.emplace_back(new virtual_adapter<tiny::shaders::phong>({scene}));
+        dynamic.emplace_back(new virtual_adapter<tiny::shaders::textured>({scene}));
+        run("flat", tiny::shaders::flat{scene}, *dynamic[0]);
+        run("gouraud", tiny::shaders::gouraud{scene}, *dynamic[1]);
+        run("phong", tiny::shaders::phong{scene}, *dynamic[2]);
+        run("textured", tiny::shaders::textured{scene}, *dynamic[3]);
+    }
+}
+
+// Nanoseconds per timed scope and per counter add of the frame profiler,
+// with no profiler current, as instrumented code runs when profiling is
+// off, and with one. Used directly rather than through the macros, so
+// the figures are there in release builds, where those compile out.
+void bench_profile() {
+    std::printf("%-36s %10s\n", "profile (ns per call)", "ns");
+    constexpr int32_t calls = 1 << 16;
+    tiny::profile::profiler profiler(calls, 1);
+    auto run = [&](char const* name, auto const& fn) {
+        const auto seconds = measure([&] {
+            profiler.begin_frame();
+            for (int32_t i = 0; i < calls; i++) fn();
+        });
+        std::printf("%-36s %10.2f\n", name, seconds / calls * 1e9);
+    };
+    tiny::profile::set_current(nullptr);
+    run("scope, no profiler", [] { tiny::profile::scope scope("bench"); });
+    run("count, no profiler", [] {
+        tiny::profile::count(tiny::profile::counter::fragments_written, 1);
+    });
+    tiny::profile::set_current(&profiler);
+    // The event buffer fills up after the first pass; later passes time
+    // the dropping path, which costs the same atomic increment.
+    run("scope", [] { tiny::profile::scope scope("bench"); });
+    run("count", [] {
+        tiny::profile::count(tiny::profile::counter::fragments_written, 1);
+    });
+    run("now()", [] {
+        volatile uint64_t ticks = tiny::profile::now();
+        (void)ticks;
+    });
+    tiny::profile::set_current(nullptr);
+}
+
+// Box filters factor x factor pixels of src into each pixel of dst.
+void downsample(tiny::image const& src, tiny::image& dst, int32_t factor) {
+    const auto channels = size_t(src.get_channels());
+    const auto n = uint32_t(factor * factor);
+    for (int32_t y = 0; y < dst.get_height(); y++)
+        for (int32_t x = 0; x < dst.get_width(); x++)
+            for (size_t c = 0; c < channels; c++) {
+                uint32_t sum = n / 2;
+                for (int32_t j = 0; j < factor; j++)
+                    for (int32_t i = 0; i < factor; i++)
+                        sum += src.data()[(size_t(y * factor + j) *
+                                               src.get_width() +
+                                           x * factor + i) *
+                                              channels +
+                                          c];
+                dst.data()[(size_t(y) * dst.get_width() + x) * channels + c] =
+                    uint8_t(sum / n);
+            }
+}
+
+// Frame time, memory and edge quality of the lesson2 model with no
+// anti-aliasing, 4x and 8x MSAA resolved into the image, and brute force
+// supersampling: the same triangles drawn at 2x and 4x the size and box
+// filtered down. Error is the mean difference per channel, in levels of
+// 255, from the 4x4 supersampled frame, whose samples sit 1/8 pixel off
+// centre as the scaled vertices stay on whole pixels.
+void bench_msaa() {
+    std::printf("%-36s %10s %10s %10s\n", "msaa", "ms", "MB", "error");
+    const std::string filename = "assets/african_head.obj";
+    for (const auto size : {800, 2048}) {
+        const auto base = model_scene(filename, size, size);
+        const tiny::rect frame{0, 0, size, size};
+        const auto mb = [](size_t bytes) { return double(bytes) / (1 << 20); };
+
+        struct result {
+            std::string name;
+            double seconds;
+            size_t bytes;
+            tiny::image image;
+        };
+        std::vector<result> results;
+        {
+            tiny::image image(size, size);
+            tiny::depth_buffer depth(size, size);
+            const auto seconds = measure([&] {
+                depth.clear();
+                for (auto const& d : base.draws)
+                    tiny::raster::triangle(d.pts, d.depth, frame, image, depth,
+                                           d.color);
+            });
+            results.push_back({"none", seconds,
+                               image.size() + size_t(size) * size * 4,
+                               std::move(image)});
+        }
+        for (const auto samples : {4, 8}) {
+            tiny::image image(size, size);
+            tiny::msaa_buffer msaa(size, size, samples);
+            const auto seconds = measure([&] {
+                msaa.clear();
+                for (auto const& d : base.draws)
+                    tiny::msaa::triangle(d.pts, d.depth, frame, msaa, d.color);
+                msaa.resolve(image);
+            });
+            results.push_back({"msaa " + std::to_string(samples) + "x", seconds,
+                               image.size() + msaa.bytes(), std::move(image)});
+        }
+        for (const auto factor : {2, 4}) {
+            auto big = base;
+            for (auto& d : big.draws)
+                for (auto& p : d.pts)
+                    p = {p.x * factor + factor / 2, p.y * factor + factor / 2};
+            const tiny::rect big_frame{0, 0, size * factor, size * factor};
+            tiny::image image(size, size), hires(size * factor, size * factor);
+            tiny::depth_buffer depth(size * factor, size * factor);
+            const auto seconds = measure([&] {
+                depth.clear();
+                for (auto const& d : big.draws)
+                    tiny::raster::triangle(d.pts, d.depth, big_frame, hires,
+                                           depth, d.color);
+                downsample(hires, image, factor);
+            });
+            const auto samples = std::to_string(factor);
+            results.push_back({"ssaa " + samples + "x" + samples, seconds,
+                               image.size() + hires.size() +
+                                   size_t(size) * factor * size * factor * 4,
+                               std::move(image)});
+        }
+
+        auto const& reference = results.back().image;
+        for (auto const& r : results) {
+            uint64_t difference = 0;
+            for (size_t i = 0; i < reference.size(); i++)
+                difference += uint64_t(
+                    std::abs(int32_t(r.image.data()[i]) - reference.data()[i]));
+            std::printf("%-36s %10.3f %10.1f %10.3f\n",
+                        (r.name + " " + std::to_string(size)).c_str(),
+                        r.seconds * 1e3, mb(r.bytes),
+                        double(difference) / reference.size());
+        }
+    }
+}
+
+// Time and heap allocations of one lesson2 frame: with fresh vectors and
+// a fresh image every frame, as the pipeline used to allocate, against the
+// frame arena and the image pool. Once warm the arena frame must not
+// allocate at all; one that does is flagged and fails the run.
+void bench_memory() {
+    const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::printf("%-36s %12s %12s %8s %10s %10s\n", "memory (ms, allocs/frame)",
+                "vectors", "arena", "speedup", "vectors", "arena");
+    const std::pair<int32_t, int32_t> sizes[] = {{800, 800}, {3840, 2160}};
+    for (auto const* filename :
+         {"assets/african_head.obj", "assets/suzanne.obj"}) {
+        tiny::model model(filename);
+        const auto positions = model.positions();
+        std::string label = filename;
+        label = label.substr(label.find_last_of('/') + 1);
+        label = label.substr(0, label.find_last_of('.'));
+        for (auto const& [width, height] : sizes) {
+            tiny::scheduler scheduler(hardware);
+            tiny::tile_bins bins(width, height);
+            tiny::depth_buffer depth(width, height);
+
+            auto vectors = [&] {
+                tiny::image image(width, height);
+                std::vector<tiny::vec2<int32_t>> screen(positions.size());
+                std::vector<float> z(positions.size());
+                for (size_t i = 0; i < positions.size(); i++) {
+                    screen[i] = {int32_t((positions[i].x + 1.) * width / 2.),
+                                 int32_t((positions[i].y + 1.) * height / 2.)};
+                    z[i] = (1.f - positions[i].z) / 2.f;
+                }
+                std::vector<draw> draws;
+                for (int32_t i = 0; i < model.nfaces(); i++) {
+                    const auto face = model.face_indices(i);
+                    auto const& a = positions[face[0]];
+                    const auto n = tiny::math::normalise(tiny::math::cross(
+                        positions[face[2]] - a, positions[face[1]] - a));
+                    const auto intensity =
+                        tiny::math::dot(n, tiny::vec3<float>{0, 0, -1});
+                    if (intensity <= 0) continue;
+                    const auto c = uint8_t(intensity * 255.);
+                    draws.push_back(
+                        {{screen[face[0]], screen[face[1]], screen[face[2]]},
+                         {z[face[0]], z[face[1]], z[face[2]]},
+                         tiny::color(c, c, c)});
+                }
+                frame_raster(draws, scheduler, bins, image, depth);
+            };
+            auto arena = std::make_unique<tiny::arena>();
+            tiny::image_pool images(1);
+            auto pooled = [&] {
+                arena->reset();
+                auto image = images.acquire(width, height);
+                const auto draws = frame_setup(model, width, height, *arena);
+                frame_raster(draws, scheduler, bins, image, depth, arena.get());
+                images.release(std::move(image));
+            };
+            // The second frame of all, as lesson2 counts it: a first frame
+            // that outgrew the arena is merged between frames, by between,
+            // and must not cost the next one.
+            auto allocations = [](auto const& frame, auto const& between) {
+                frame();
+                between();
+                const auto before = tiny::memory::allocation_count();
+                frame();
+                return tiny::memory::allocation_count() - before;
+            };
+
+            const auto before = measure(vectors);
+            const auto after = measure(pooled);
+            const auto vector_allocs = allocations(vectors, [] {});
+            arena = std::make_unique<tiny::arena>();
+            const auto arena_allocs = allocations(
+                pooled, [&] { arena->reserve(arena->peak()); });
+            g_regressed |= arena_allocs != 0;
+            char name[64];
+            std::snprintf(name, sizeof(name), "%s@%dx%d t%u", label.c_str(),
+                          width, height, hardware);
+            std::printf("%-36s %12.3f %12.3f %7.2fx %10llu %9llu%s\n", name,
+                        before * 1e3, after * 1e3, before / after,
+                        (unsigned long long)vector_allocs,
+                        (unsigned long long)arena_allocs,
+                        arena_allocs == 0 ? " " : "!");
+        }
+    }
+}
+
+constexpr char const* frame_metrics[] = {
+    "load_ms", "load_cached_ms", "transform_ms", "raster_ms", "png_ms",
+    "total_ms",
+};
+
+std::string frame_key(nlohmann::json const& result) {
+    std::stringstream ss;
+    ss << result["model"].get<std::string>() << "@"
+       << result["width"].get<int32_t>() << "x"
+       << result["height"].get<int32_t>() << " t"
+       << result["threads"].get<uint32_t>();
+    return ss.str();
+}
+
+// Flags every metric of report slower than its match in the baseline
+// file by more than the threshold. Configurations missing from either
+// side are skipped.
+void frame_compare(nlohmann::json const& report) {
+    std::ifstream in(g_options.baseline);
+    if (!in) {
+        std::printf("cannot read baseline %s\n", g_options.baseline.c_str());
+        g_regressed = true;
+        return;
+    }
+    nlohmann::json baseline;
+    in >> baseline;
+
+    std::printf("\n%-36s", "change vs baseline");
+    for (auto const* metric : frame_metrics) std::printf(" %15s", metric);
+    std::printf("\n");
+    for (auto const& result : report["results"]) {
+        const auto key = frame_key(result);
+        nlohmann::json const* match = nullptr;
+        for (auto const& candidate : baseline["results"])
+            if (frame_key(candidate) == key) match = &candidate;
+        if (!match) continue;
+        std::printf("%-36s", key.c_str());
+        for (auto const* metric : frame_metrics) {
+            const double before = (*match)[metric].get<double>();
+            const double after = result[metric].get<double>();
+            const double change = before > 0 ? after / before - 1 : 0;
+            const bool regressed = change > g_options.threshold;
+            g_regressed |= regressed;
+            std::printf(" %+13.1f%%%s", change * 100, regressed ? "!" : " ");
+        }
+        std::printf("\n");
+    }
+    std::printf("%s (threshold %.1f%%)\n",
+                g_regressed ? "REGRESSION" : "no regression",
+                g_options.threshold * 100);
+}
+
+// Stage and frame times of lesson2's pipeline for the bundled models at
+// 800x800, 2K and 4K over several thread counts. Load is timed parsing the
+// OBJ and mapping its sidecar; the total frame uses the sidecar, as a
+// repeated job would.
+void bench_frame() {
+    auto threads = g_options.threads;
+    if (threads.empty()) {
+        threads = {1, 2, 4, std::max(1u, std::thread::hardware_concurrency())};
+        std::sort(threads.begin(), threads.end());
+        threads.erase(std::unique(threads.begin(), threads.end()),
+                      threads.end());
+    }
+    const std::pair<int32_t, int32_t> sizes[] = {
+        {800, 800}, {2048, 1080}, {3840, 2160}};
+    const char* png = "benchmark.png";
+
+    nlohmann::json report;
+    report["meta"] = {
+        {"isa", tiny::simd::name(tiny::simd::active())},
+        {"hardware_threads", std::thread::hardware_concurrency()},
+#if defined(__clang__)
+        {"compiler", "clang " __clang_version__},
+#elif defined(__GNUC__)
+        {"compiler", "gcc " __VERSION__},
+#elif defined(_MSC_VER)
+        {"compiler", "msvc " + std::to_string(_MSC_VER)},
+#endif
+#if defined(_DEBUG)
+        {"config", "debug"},
+#else
+        {"config", "release"},
+#endif
+        {"min_time", g_options.min_time},
+    };
+    report["results"] = nlohmann::json::array();
+
+    std::printf("%-36s", "frame (ms)");
+    for (auto const* metric : frame_metrics) std::printf(" %15s", metric);
+    std::printf("\n");
+    for (auto const* filename :
+         {"assets/african_head.obj", "assets/suzanne.obj"}) {
+        tiny::model model(filename);
+        tiny::scheduler parser;
+        const auto load =
+            measure([&] { tiny::model m(filename, false, &parser); });
+        const auto load_cached = measure([&] { tiny::model m(filename); });
+        for (auto const& [width, height] : sizes) {
+            tiny::image image(width, height);
+            tiny::depth_buffer depth(width, height);
+            tiny::tile_bins bins(width, height);
+            tiny::arena arena;
+            tiny::span<draw> draws;
+            const auto transform = measure([&] {
+                arena.reset();
+                draws = frame_setup(model, width, height, arena);
+            });
+            const auto encode = measure([&] {
+                image.write_png(png, true);
+            });
+            for (auto const count : threads) {
+                tiny::scheduler scheduler(count);
+                const auto raster = measure([&] {
+                    frame_raster(draws, scheduler, bins, image, depth);
+                });
+                const auto total = measure([&] {
+                    tiny::model m(filename);
+                    arena.reset();
+                    draws = frame_setup(m, width, height, arena);
+                    frame_raster(draws, scheduler, bins, image, depth, &arena);
+                    image.write_png(png, true);
+                });
+                nlohmann::json result = {
+                    {"model", filename},
+                    {"width", width},
+                    {"height", height},
+                    {"threads", count},
+                    {"load_ms", load * 1e3},
+                    {"load_cached_ms", load_cached * 1e3},
+                    {"transform_ms", transform * 1e3},
+                    {"raster_ms", raster * 1e3},
+                    {"png_ms", encode * 1e3},
+                    {"total_ms", total * 1e3},
+                };
+                std::printf("%-36s", frame_key(result).c_str());
+                for (auto const* metric : frame_metrics)
+                    std::printf(" %15.3f", result[metric].get<double>());
+                std::printf("\n");
+                report["results"].push_back(result);
+            }
+        }
+    }
+    std::remove(png);
+
+    if (!g_options.json.empty()) {
+        std::ofstream out(g_options.json);
+        out << report.dump(2) << "\n";
+    }
+    if (!g_options.baseline.empty()) frame_compare(report);
+}
+
+// QOI back to pixels, with channels as in the file, to check the encoder;
+// stb_image reads the other formats.
+std::vector<uint8_t> decode_qoi(std::vector<uint8_t> const& q) {
+    const auto width = uint32_t(q[4] << 24 | q[5] << 16 | q[6] << 8 | q[7]);
+    const auto height = uint32_t(q[8] << 24 | q[9] << 16 | q[10] << 8 | q[11]);
+    const auto channels = q[12];
+    std::vector<uint8_t> out;
+    out.reserve(size_t(width) * height * channels);
+    uint8_t px[4] = {0, 0, 0, 255}, index[64][4] = {};
+    size_t p = 14;
+    uint32_t run = 0;
+    for (size_t i = 0; i < size_t(width) * height; i++) {
+        if (run > 0) {
+            run--;
+        } else {
+            const uint8_t b = q[p++];
+            if (b == 0xfe) {
+                std::memcpy(px, &q[p], 3);
+                p += 3;
+            } else if (b == 0xff) {
+                std::memcpy(px, &q[p], 4);
+                p += 4;
+            } else if (b >> 6 == 0) {
+                std::memcpy(px, index[b], 4);
+            } else if (b >> 6 == 1) {
+                px[0] += ((b >> 4) & 3) - 2;
+                px[1] += ((b >> 2) & 3) - 2;
+                px[2] += (b & 3) - 2;
+            } else if (b >> 6 == 2) {
+                const int32_t dg = (b & 63) - 32, next = q[p++];
+                px[0] += dg + (next >> 4) - 8;
+                px[1] += dg;
+                px[2] += dg + (next & 15) - 8;
+            } else {
+                run = b & 63;
+            }
+            std::memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64],
+                        px, 4);
+        }
+        out.insert(out.end(), px, px + channels);
+    }
+    return out;
+}
+
+// Writing a 4K frame of the lesson2 model: stb's PNG against the strip
+// parallel PNG on one and all threads, and the uncompressed formats. Each
+// file is read back and compared with the frame. Then a run of frames
+// rendered and written in turn against one handing them to the
+// async_writer.
+void bench_encode() {
+    constexpr int32_t width = 3840, height = 2160;
+    const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+    tiny::model model("assets/african_head.obj");
+    tiny::arena arena;
+    const auto draws = frame_setup(model, width, height, arena);
+    tiny::scheduler scheduler(hardware);
+    tiny::tile_bins bins(width, height);
+    tiny::depth_buffer depth(width, height);
+    tiny::image image(width, height);
+    frame_raster(draws, scheduler, bins, image, depth);
+
+    auto read = [](std::string const& filename) {
+        std::ifstream in(filename, std::ios::binary);
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {});
+    };
+    // The decoded file against the frame as written bottom row first.
+    auto same = [&](std::vector<uint8_t> const& pixels, int32_t channels) {
+        const auto pitch = size_t(width) * channels;
+        if (pixels.size() != pitch * height) return false;
+        for (int32_t y = 0; y < height; y++)
+            if (std::memcmp(pixels.data() + pitch * y,
+                            image.row(height - 1 - y), pitch) != 0)
+                return false;
+        return true;
+    };
+    auto decode = [&](std::string const& filename) {
+        const auto bytes = read(filename);
+        if (tiny::codec::format_of(filename) == tiny::codec::format::qoi)
+            return decode_qoi(bytes);
+        int32_t w, h, n;
+        auto* pixels = stbi_load_from_memory(bytes.data(), int32_t(bytes.size()),
+                                             &w, &h, &n, 3);
+        std::vector<uint8_t> out;
+        if (pixels && w == width && h == height)
+            out.assign(pixels, pixels + size_t(w) * h * 3);
+        stbi_image_free(pixels);
+        return out;
+    };
+
+    std::printf("%-36s %12s %12s %8s\n", "encode 4K (ms)", "time", "MB",
+                "speedup");
+    double stb = 0;
+    auto row = [&](std::string const& name, std::string const& filename,
+                   double time) {
+        if (stb == 0) stb = time;
+        const bool ok = same(decode(filename), 3);
+        std::printf("%-36s %12.3f %11.2f%s %7.2fx\n", name.c_str(), time * 1e3,
+                    read(filename).size() / 1e6, ok ? " " : "!", stb / time);
+        std::remove(filename.c_str());
+    };
+    row("stb png", "benchmark.png",
+        measure([&] { image.write_png("benchmark.png", true); }));
+    tiny::scheduler serial(1);
+    row("png strips 1 thread", "benchmark.png", measure([&] {
+            tiny::codec::write(image, "benchmark.png", true, &serial);
+        }));
+    if (hardware > 1)
+        row("png strips " + std::to_string(hardware) + " threads",
+            "benchmark.png", measure([&] {
+                tiny::codec::write(image, "benchmark.png", true, &scheduler);
+            }));
+    for (auto const* filename : {"benchmark.ppm", "benchmark.qoi", "benchmark.tga"})
+        row(tiny::codec::name(tiny::codec::format_of(filename)), filename,
+            measure([&] { tiny::codec::write(image, filename, true); }));
+
+    // Each frame goes to a file of its own, as an animation would.
+    constexpr int32_t frames = 8;
+    auto name = [](int32_t i) {
+        return "benchmark-" + std::to_string(i) + ".png";
+    };
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    for (int32_t i = 0; i < frames; i++) {
+        frame_raster(draws, scheduler, bins, image, depth);
+        image.write_png(name(i), true);
+    }
+    const double sync = std::chrono::duration<double>(clock::now() - start).count();
+    start = clock::now();
+    {
+        tiny::codec::async_writer writer(hardware);
+        for (int32_t i = 0; i < frames; i++) {
+            tiny::image frame(width, height);
+            frame_raster(draws, scheduler, bins, frame, depth);
+            writer.write(std::move(frame), name(i), true);
+        }
+    }
+    const double async = std::chrono::duration<double>(clock::now() - start).count();
+    bool ok = true;
+    for (int32_t i = 0; i < frames; i++) {
+        ok &= same(decode(name(i)), 3);
+        std::remove(name(i).c_str());
+    }
+    std::printf("%-36s %12.3f %12s %7.2fx\n", "render+stb png / frame",
+                sync / frames * 1e3, "", 1.);
+    std::printf("%-36s %12.3f %11s%s %7.2fx\n", "render+async png / frame",
+                async / frames * 1e3, "", ok ? " " : "!", sync / async);
+}
+
+// benchmark [bench...] [--threads 1,2,4] [--json out.json]
+//           [--baseline old.json] [--threshold 0.1] [--min-time 0.25]
+// Runs the named benches, all of them when none is named, and exits 1 when
+// the frame bench regressed against the baseline.
+int32_t main(int32_t argc, char const *argv[]) {
+    const std::vector<std::pair<std::string, std::function<void()>>> benches{
+        {"raster", bench_raster},
+        {"depth", bench_depth},
+        {"load", bench_load},
+        {"vertex", bench_vertex},
+        {"matrix", bench_matrix},
+        {"setup", bench_setup},
+        {"pixels", bench_pixels},
+        {"transform", bench_transform},
+        {"frame", bench_frame},
+        {"cull", bench_cull},
+        {"lines", bench_lines},
+        {"texture", bench_texture},
+        {"shaders", bench_shaders},
+        {"profile", bench_profile},
+        {"msaa", bench_msaa},
+        {"memory", bench_memory},
+        {"encode", bench_encode},
+    };
+    std::vector<std::string> selected;
+    for (int32_t i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string count;
+            while (std::getline(list, count, ','))
+                g_options.threads.push_back(
+                    uint32_t(std::max(1, std::atoi(count.c_str()))));
+        } else if (arg == "--json" && i + 1 < argc) {
+            g_options.json = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            g_options.baseline = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            g_options.threshold = std::atof(argv[++i]);
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            g_options.min_time = std::atof(argv[++i]);
+        } else {
+            selected.push_back(arg);
+        }
+    }
+    for (auto const& [name, bench] : benches)
+        if (selected.empty() ||
+            std::find(selected.begin(), selected.end(), name) != selected.end())
+            bench();
+    return g_regressed ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tiny.hpp"
+
+// Earlier implementations kept verbatim so the benchmarks have something
+// to measure the current code against.
+namespace reference {
+
+inline tiny::vec3<float> barycentric(
+    std::array<tiny::vec2<int32_t>, 3> const& pts,
+    tiny::vec2<int32_t> const& P) {
+    tiny::vec3<float> u = tiny::math::cross<float>(
+                {
+                    float(pts[2].x - pts[0].x),
+                    float(pts[1].x - pts[0].x),
+                    float(pts[0].x - P.x),
+                },
+                {
+                    float(pts[2].y - pts[0].y),
+                    float(pts[1].y - pts[0].y),
+                    float(pts[0].y - P.y),
+                }
+            );
+    if (std::abs(u.z) < 1) return tiny::vec3<float>{-1.f, 1.f, 1.f};
+    return {
+        1.f - (u.x + u.y) / u.z,
+        u.y / u.z,
+        u.x / u.z
+    };
+}
+
+// lesson2's bounding box rasterizer with a barycentric() call per pixel.
+inline void triangle(std::array<tiny::vec2<int32_t>, 3> const& pts,
+                     tiny::image& image, tiny::color const& color) {
+    tiny::vec2<int32_t> bboxmin{image.get_width() - 1, image.get_height() - 1};
+    tiny::vec2<int32_t> bboxmax{0, 0};
+    tiny::vec2<int32_t> clamp{image.get_width() - 1, image.get_height() - 1};
+    for (int32_t i = 0; i < pts.size(); i++) {
+        bboxmin.x = std::max(0,       std::min(bboxmin.x, pts[i].x));
+        bboxmax.x = std::min(clamp.x, std::max(bboxmax.x, pts[i].x));
+        bboxmin.y = std::max(0,       std::min(bboxmin.y, pts[i].y));
+        bboxmax.y = std::min(clamp.y, std::max(bboxmax.y, pts[i].y));
+    }
+
+    tiny::vec2<int32_t> P;
+    for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++) {
+        for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++) {
+            tiny::vec3<float> bc_screen = barycentric(pts, P);
+            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
+            image.set(P.x, P.y, color);
+        }
+    }
+}
+
+// lesson1's Bresenham: the steep branch and a checked image::set() per
+// pixel, pixels outside the image dropped one by one.
+inline void line(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                 tiny::image& image, tiny::color const& color) {
+    bool steep = false;
+    if (std::abs(x0 - x1) < std::abs(y0 - y1)) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+        steep = true;
+    }
+    if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+    int32_t dx = x1 - x0;
+    int32_t dy = y1 - y0;
+    int32_t d_error2 = std::abs(dy) * 2;
+    int32_t error2 = 0;
+    int32_t y = y0;
+    for (int32_t x = x0; x <= x1; x++) {
+        if (steep)
+            image.set(y, x, color);
+        else
+            image.set(x, y, color);
+        error2 += d_error2;
+        if (error2 > dx) {
+            y += (y1 > y0 ? 1 : -1);
+            error2 -= dx * 2;
+        }
+    }
+}
+
+struct obj {
+    std::vector<tiny::vec3<float>> verts;
+    std::vector<std::vector<int32_t>> faces;
+};
+
+// tiny::model::load() as it was: std::getline plus an istringstream per
+// line.
+inline obj load_obj(std::string const& filename) {
+    obj model;
+    std::ifstream file(filename, std::ios::in);
+    if (file.fail() && !file.is_open()) return model;
+
+    std::string line;
+    while (!file.eof()) {
+        std::getline(file, line);
+        std::istringstream iss(line.c_str());
+        char trash;
+        if (!line.compare(0, 2, "v ")) {
+            iss >> trash;
+            tiny::vec3<float> vertex;
+            iss >> vertex.x;
+            iss >> vertex.y;
+            iss >> vertex.z;
+            model.verts.push_back(vertex);
+        } else if (!line.compare(0, 2, "f ")) {
+            std::vector<int32_t> face;
+            int32_t itrash, idx;
+            iss >> trash;
+            while (iss >> idx >> trash >> itrash >> trash >> itrash) {
+                face.push_back(--idx);
+            }
+            model.faces.push_back(face);
+        }
+    }
+    return model;
+}
+
+// image::flipv() and fliph() through get_color() and set(), two bounds
+// checks and a color per pixel access.
+inline void flipv(tiny::image& image) {
+    const auto width = image.get_width(), height = image.get_height();
+    for (int32_t i = 0; i < height / 2; i++) {
+        for (int32_t j = 0; j < width; j++) {
+            const auto a = image.get_color(j, i);
+            const auto b = image.get_color(j, height - 1 - i);
+            image.set(j, i, b);
+            image.set(j, height - 1 - i, a);
+        }
+    }
+}
+
+inline void fliph(tiny::image& image) {
+    const auto width = image.get_width(), height = image.get_height();
+    for (int32_t i = 0; i < height; i++) {
+        for (int32_t j = 0; j < width / 2; j++) {
+            const auto a = image.get_color(j, i);
+            const auto b = image.get_color(width - 1 - j, i);
+            image.set(j, i, b);
+            image.set(width - 1 - j, i, a);
+        }
+    }
+}
+
+// Transpose the same way, one pixel at a time in source order.
+inline void transpose(tiny::image& src, tiny::image& dst) {
+    for (int32_t y = 0; y < src.get_height(); y++)
+        for (int32_t x = 0; x < src.get_width(); x++)
+            dst.set(y, x, src.get_color(x, y));
+}
+
+}  // namespace reference
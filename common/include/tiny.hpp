@@ -1,20 +1,45 @@
 #pragma once
 
 #include <algorithm>
+#include <cassert>
+#include <charconv>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <cmath>
 
 #include "stb/stb_image_write.h"
+#include "tiny/mapped_file.hpp"
+#include "tiny/memory.hpp"
+#include "tiny/mesh_cache.hpp"
+#include "tiny/mesh_optimize.hpp"
+#include "tiny/pixels.hpp"
+#include "tiny/scheduler.hpp"
 
 namespace tiny {
 
-// TODO: Write operator overload for the vec data types
+// Every vector operator is constexpr, so constant setup such as light
+// directions folds at compile time, and forced inline, so a chain such as
+// t0 + (t2 - t0) * alpha becomes straight-line code with no calls and no
+// temporaries left in memory. * and / are component-wise; dot and cross
+// are the named functions of tiny::math. Scalars of another arithmetic
+// type are applied in the common type and converted back to T, so an
+// integer vector times a float fraction rounds toward zero per component.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TINY_INLINE __forceinline
+#else
+#define TINY_INLINE inline __attribute__((always_inline))
+#endif
+
+template <typename U>
+using if_scalar = std::enable_if_t<std::is_arithmetic<U>::value, int>;
 
 template <typename T>
 struct vec2 {
@@ -27,23 +52,57 @@ struct vec2 {
         };
         T raw[2];
     };
-    vec2<T> operator+(vec2<T> const& rhs) const {
+
+    TINY_INLINE constexpr vec2<T> operator+(vec2<T> const& rhs) const {
         return vec2<T>{x + rhs.x, y + rhs.y};
     }
-    vec2<T> operator+(T const& rhs) const {
-        return vec2<T>{x + rhs, y + rhs};
-    }
-    vec2<T> operator-(vec2<T> const& rhs) const {
+    TINY_INLINE constexpr vec2<T> operator-(vec2<T> const& rhs) const {
         return vec2<T>{x - rhs.x, y - rhs.y};
     }
-    vec2<T> operator-(T const& rhs) const {
-        return vec2<T>{x - rhs, y - rhs};
-    }
-    vec2<T> operator*(vec2<T> const& rhs) const {
+    TINY_INLINE constexpr vec2<T> operator*(vec2<T> const& rhs) const {
         return vec2<T>{x * rhs.x, y * rhs.y};
     }
-    vec2<T> operator*(T const& rhs) const {
-        return vec2<T>{x * rhs, y * rhs};
+    TINY_INLINE constexpr vec2<T> operator/(vec2<T> const& rhs) const {
+        return vec2<T>{x / rhs.x, y / rhs.y};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec2<T> operator+(U rhs) const {
+        return vec2<T>{T(x + rhs), T(y + rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec2<T> operator-(U rhs) const {
+        return vec2<T>{T(x - rhs), T(y - rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec2<T> operator*(U rhs) const {
+        return vec2<T>{T(x * rhs), T(y * rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec2<T> operator/(U rhs) const {
+        return vec2<T>{T(x / rhs), T(y / rhs)};
+    }
+    TINY_INLINE constexpr vec2<T> operator-() const {
+        return vec2<T>{-x, -y};
+    }
+    TINY_INLINE constexpr vec2<T>& operator+=(vec2<T> const& rhs) {
+        return *this = *this + rhs;
+    }
+    TINY_INLINE constexpr vec2<T>& operator-=(vec2<T> const& rhs) {
+        return *this = *this - rhs;
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec2<T>& operator*=(U rhs) {
+        return *this = *this * rhs;
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec2<T>& operator/=(U rhs) {
+        return *this = *this / rhs;
+    }
+    TINY_INLINE constexpr bool operator==(vec2<T> const& rhs) const {
+        return x == rhs.x && y == rhs.y;
+    }
+    TINY_INLINE constexpr bool operator!=(vec2<T> const& rhs) const {
+        return !(*this == rhs);
     }
 };
 
@@ -59,14 +118,56 @@ struct vec3 {
         T raw[3];
     };
 
-    vec3<T> operator+(vec3<T> const& rhs) const {
-        return vec3<T>{ x + rhs.x, y + rhs.y, z + rhs.z };
+    TINY_INLINE constexpr vec3<T> operator+(vec3<T> const& rhs) const {
+        return vec3<T>{x + rhs.x, y + rhs.y, z + rhs.z};
+    }
+    TINY_INLINE constexpr vec3<T> operator-(vec3<T> const& rhs) const {
+        return vec3<T>{x - rhs.x, y - rhs.y, z - rhs.z};
+    }
+    TINY_INLINE constexpr vec3<T> operator*(vec3<T> const& rhs) const {
+        return vec3<T>{x * rhs.x, y * rhs.y, z * rhs.z};
+    }
+    TINY_INLINE constexpr vec3<T> operator/(vec3<T> const& rhs) const {
+        return vec3<T>{x / rhs.x, y / rhs.y, z / rhs.z};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec3<T> operator+(U rhs) const {
+        return vec3<T>{T(x + rhs), T(y + rhs), T(z + rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec3<T> operator-(U rhs) const {
+        return vec3<T>{T(x - rhs), T(y - rhs), T(z - rhs)};
     }
-    vec3<T> operator-(vec3<T> const& rhs) const {
-        return vec3<T>{ x - rhs.x, y - rhs.y, z - rhs.z };
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec3<T> operator*(U rhs) const {
+        return vec3<T>{T(x * rhs), T(y * rhs), T(z * rhs)};
     }
-    T operator*(vec3<T> const& rhs) const {
-        return x * rhs.x + y * rhs.y + z * rhs.z;
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec3<T> operator/(U rhs) const {
+        return vec3<T>{T(x / rhs), T(y / rhs), T(z / rhs)};
+    }
+    TINY_INLINE constexpr vec3<T> operator-() const {
+        return vec3<T>{-x, -y, -z};
+    }
+    TINY_INLINE constexpr vec3<T>& operator+=(vec3<T> const& rhs) {
+        return *this = *this + rhs;
+    }
+    TINY_INLINE constexpr vec3<T>& operator-=(vec3<T> const& rhs) {
+        return *this = *this - rhs;
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec3<T>& operator*=(U rhs) {
+        return *this = *this * rhs;
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec3<T>& operator/=(U rhs) {
+        return *this = *this / rhs;
+    }
+    TINY_INLINE constexpr bool operator==(vec3<T> const& rhs) const {
+        return x == rhs.x && y == rhs.y && z == rhs.z;
+    }
+    TINY_INLINE constexpr bool operator!=(vec3<T> const& rhs) const {
+        return !(*this == rhs);
     }
 };
 
@@ -78,22 +179,134 @@ struct vec4 {
         };
         T raw[4];
     };
+
+    TINY_INLINE constexpr vec4<T> operator+(vec4<T> const& rhs) const {
+        return vec4<T>{x + rhs.x, y + rhs.y, z + rhs.z, w + rhs.w};
+    }
+    TINY_INLINE constexpr vec4<T> operator-(vec4<T> const& rhs) const {
+        return vec4<T>{x - rhs.x, y - rhs.y, z - rhs.z, w - rhs.w};
+    }
+    TINY_INLINE constexpr vec4<T> operator*(vec4<T> const& rhs) const {
+        return vec4<T>{x * rhs.x, y * rhs.y, z * rhs.z, w * rhs.w};
+    }
+    TINY_INLINE constexpr vec4<T> operator/(vec4<T> const& rhs) const {
+        return vec4<T>{x / rhs.x, y / rhs.y, z / rhs.z, w / rhs.w};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec4<T> operator+(U rhs) const {
+        return vec4<T>{T(x + rhs), T(y + rhs), T(z + rhs), T(w + rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec4<T> operator-(U rhs) const {
+        return vec4<T>{T(x - rhs), T(y - rhs), T(z - rhs), T(w - rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec4<T> operator*(U rhs) const {
+        return vec4<T>{T(x * rhs), T(y * rhs), T(z * rhs), T(w * rhs)};
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec4<T> operator/(U rhs) const {
+        return vec4<T>{T(x / rhs), T(y / rhs), T(z / rhs), T(w / rhs)};
+    }
+    TINY_INLINE constexpr vec4<T> operator-() const {
+        return vec4<T>{-x, -y, -z, -w};
+    }
+    TINY_INLINE constexpr vec4<T>& operator+=(vec4<T> const& rhs) {
+        return *this = *this + rhs;
+    }
+    TINY_INLINE constexpr vec4<T>& operator-=(vec4<T> const& rhs) {
+        return *this = *this - rhs;
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec4<T>& operator*=(U rhs) {
+        return *this = *this * rhs;
+    }
+    template <typename U, if_scalar<U> = 0>
+    TINY_INLINE constexpr vec4<T>& operator/=(U rhs) {
+        return *this = *this / rhs;
+    }
+    TINY_INLINE constexpr bool operator==(vec4<T> const& rhs) const {
+        return x == rhs.x && y == rhs.y && z == rhs.z && w == rhs.w;
+    }
+    TINY_INLINE constexpr bool operator!=(vec4<T> const& rhs) const {
+        return !(*this == rhs);
+    }
+};
+
+template <typename U, typename T, if_scalar<U> = 0>
+TINY_INLINE constexpr vec2<T> operator*(U lhs, vec2<T> const& rhs) {
+    return rhs * lhs;
+}
+template <typename U, typename T, if_scalar<U> = 0>
+TINY_INLINE constexpr vec3<T> operator*(U lhs, vec3<T> const& rhs) {
+    return rhs * lhs;
+}
+template <typename U, typename T, if_scalar<U> = 0>
+TINY_INLINE constexpr vec4<T> operator*(U lhs, vec4<T> const& rhs) {
+    return rhs * lhs;
+}
+
+// Non-owning view of a contiguous array, for C++17's lack of std::span.
+template <typename T>
+class span {
+   public:
+    span() : m_data(nullptr), m_size(0) {}
+    span(T* data, size_t size) : m_data(data), m_size(size) {}
+    template <typename Container>
+    span(Container& c) : m_data(c.data()), m_size(c.size()) {}
+
+    T* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T* begin() const { return m_data; }
+    T* end() const { return m_data + m_size; }
+    T& operator[](size_t i) const { return m_data[i]; }
+
+    span<T> subspan(size_t offset, size_t count) const {
+        return span<T>(m_data + offset, count);
+    }
+
+   private:
+    T* m_data;
+    size_t m_size;
 };
 
 namespace math {
 
 template <typename T>
-vec3<T> cross(vec3<T> const& a, vec3<T> const& b) {
+TINY_INLINE constexpr T dot(vec2<T> const& a, vec2<T> const& b) {
+    return a.x * b.x + a.y * b.y;
+}
+
+template <typename T>
+TINY_INLINE constexpr T dot(vec3<T> const& a, vec3<T> const& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename T>
+TINY_INLINE constexpr T dot(vec4<T> const& a, vec4<T> const& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+// z of the cross product of a and b in the plane: twice the signed area
+// of the triangle they span, positive when b is counter-clockwise of a.
+template <typename T>
+TINY_INLINE constexpr T cross(vec2<T> const& a, vec2<T> const& b) {
+    return a.x * b.y - a.y * b.x;
+}
+
+template <typename T>
+TINY_INLINE constexpr vec3<T> cross(vec3<T> const& a, vec3<T> const& b) {
     return vec3<T>{
         a.y * b.z - a.z * b.y,
-        a.z * b.x - a.x * b.y,
+        a.z * b.x - a.x * b.z,
         a.x * b.y - a.y * b.x,
     };
 }
 
 template <typename T>
 T magnitude(vec3<T> const& v) {
-    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return std::sqrt(dot(v, v));
 }
 
 template <typename T>
@@ -106,7 +319,7 @@ vec3<T> normalise(vec3<T> const& v) {
     };
 }
 
-};
+}  // namespace math
 
 class color {
    public:
@@ -126,7 +339,7 @@ class color {
             m_blue  = (hex >>  0) & 0xFF;
         }
     }
-    ~color() {}
+    ~color() = default;
 
    public:
     inline static color white() { return color(0xFFFFFF); }
@@ -167,13 +380,174 @@ class color {
     uint8_t m_alpha;
 };
 
+// In-memory layout of an image's pixels. rgb8 and rgba8 are byte
+// streams in channel order; u32 is a 4 channel pixel handled as one word,
+// the same bytes on a little-endian machine as rgba8.
+enum class pixel_format { rgb8, rgba8, u32 };
+
+template <pixel_format F>
+struct pixel_traits;
+
+template <>
+struct pixel_traits<pixel_format::rgb8> {
+    static constexpr int32_t channels = 3;
+
+    // 16 pixels of one color, copied in 48 byte chunks by fill().
+    struct pattern {
+        uint8_t bytes[16 * 3];
+    };
+
+    static pattern make(color const& c) {
+        pattern p;
+        for (int32_t i = 0; i < 16; i++) store(p.bytes + i * 3, c);
+        return p;
+    }
+    static void store(uint8_t* pixel, color const& c) {
+        pixel[0] = c.get_red();
+        pixel[1] = c.get_green();
+        pixel[2] = c.get_blue();
+    }
+    static void fill(uint8_t* dst, int32_t count, pattern const& p) {
+        for (; count >= 16; count -= 16, dst += sizeof(p.bytes))
+            std::memcpy(dst, p.bytes, sizeof(p.bytes));
+        for (int32_t i = 0; i < count * 3; i++) dst[i] = p.bytes[i];
+    }
+};
+
+template <>
+struct pixel_traits<pixel_format::rgba8> {
+    static constexpr int32_t channels = 4;
+
+    struct pattern {
+        uint8_t bytes[16 * 4];
+    };
+
+    static pattern make(color const& c) {
+        pattern p;
+        for (int32_t i = 0; i < 16; i++) store(p.bytes + i * 4, c);
+        return p;
+    }
+    static void store(uint8_t* pixel, color const& c) {
+        pixel[0] = c.get_red();
+        pixel[1] = c.get_green();
+        pixel[2] = c.get_blue();
+        pixel[3] = c.get_alpha();
+    }
+    static void fill(uint8_t* dst, int32_t count, pattern const& p) {
+        for (; count >= 16; count -= 16, dst += sizeof(p.bytes))
+            std::memcpy(dst, p.bytes, sizeof(p.bytes));
+        for (int32_t i = 0; i < count * 4; i++) dst[i] = p.bytes[i];
+    }
+};
+
+template <>
+struct pixel_traits<pixel_format::u32> {
+    static constexpr int32_t channels = 4;
+
+    struct pattern {
+        uint32_t word;
+    };
+
+    static pattern make(color const& c) {
+        const uint8_t bytes[4] = {c.get_red(), c.get_green(), c.get_blue(),
+                                  c.get_alpha()};
+        pattern p;
+        std::memcpy(&p.word, bytes, 4);
+        return p;
+    }
+    static void store(uint8_t* pixel, color const& c) {
+        const auto p = make(c);
+        std::memcpy(pixel, &p.word, 4);
+    }
+    // A plain word loop, which the compiler turns into vector stores.
+    static void fill(uint8_t* dst, int32_t count, pattern const& p) {
+        for (int32_t i = 0; i < count; i++) std::memcpy(dst + i * 4, &p.word, 4);
+    }
+};
+
+// Unchecked access to the pixels of an image in format F. Coordinates
+// must already be clipped to the image; the rasterizers clip once per
+// triangle or span and then write through a view.
+template <pixel_format F>
+class image_view {
+   public:
+    static constexpr pixel_format format = F;
+    using traits = pixel_traits<F>;
+    using pattern = typename traits::pattern;
+
+    image_view(uint8_t* data, int32_t width, int32_t height)
+        : m_data(data), m_width(width), m_height(height),
+          m_pitch(size_t(width) * traits::channels) {}
+
+    int32_t get_width()  const { return m_width;  }
+    int32_t get_height() const { return m_height; }
+    size_t  get_pitch()  const { return m_pitch;  }
+
+    uint8_t* row(int32_t y) const { return m_data + size_t(y) * m_pitch; }
+    uint8_t* pixel(int32_t x, int32_t y) const {
+        return row(y) + size_t(x) * traits::channels;
+    }
+    // Bytes of pixels [x0, x1) of row y.
+    span<uint8_t> row_span(int32_t y, int32_t x0, int32_t x1) const {
+        return span<uint8_t>(pixel(x0, y), size_t(x1 - x0) * traits::channels);
+    }
+
+    void set(int32_t x, int32_t y, color const& c) const {
+        traits::store(pixel(x, y), c);
+    }
+
+    // Pixels [x0, x1) of row y; nothing when x1 <= x0.
+    void fill_span(int32_t x0, int32_t x1, int32_t y, color const& c) const {
+        if (x1 > x0) traits::fill(pixel(x0, y), x1 - x0, traits::make(c));
+    }
+    void fill_span(int32_t x0, int32_t x1, int32_t y, pattern const& p) const {
+        if (x1 > x0) traits::fill(pixel(x0, y), x1 - x0, p);
+    }
+
+   private:
+    uint8_t* m_data;
+    int32_t m_width;
+    int32_t m_height;
+    size_t m_pitch;
+};
+
 class image {
    public:
+    // The buffer starts on a cache line, which it shares with nothing
+    // else, and suits aligned vector loads.
     image(int32_t width, int32_t height, int32_t channels = 3)
         : m_width(width), m_height(height), m_channels(channels) {
-        m_buffer = new uint8_t[m_width * m_height * m_channels];
+        m_buffer = static_cast<uint8_t*>(memory::allocate(size()));
+        std::memset(m_buffer, 0, size());
+    }
+    ~image() {
+        if (m_buffer) memory::release(m_buffer);
+    }
+    // Moves hand the buffer over, to an encoder thread for instance; a
+    // deep copy of a frame has to be asked for with clone().
+    image(image&& other) noexcept
+        : m_buffer(other.m_buffer),
+          m_width(other.m_width),
+          m_height(other.m_height),
+          m_channels(other.m_channels) {
+        other.m_buffer = nullptr;
+        other.m_width = other.m_height = 0;
+    }
+    image& operator=(image&& other) noexcept {
+        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_width, other.m_width);
+        std::swap(m_height, other.m_height);
+        std::swap(m_channels, other.m_channels);
+        return *this;
+    }
+    image(image const&) = delete;
+    image& operator=(image const&) = delete;
+
+    image clone() const {
+        image copy(m_width, m_height, m_channels);
+        std::memcpy(copy.m_buffer, m_buffer, size());
+        return copy;
     }
-    ~image() { delete[] m_buffer; }
 
    public:
     void set(int32_t const& x, int32_t const& y, color const& color) {
@@ -196,34 +570,74 @@ class image {
         return c;
     }
 
-    int32_t get_width()  const { return m_width;  }
-    int32_t get_height() const { return m_height; }
+    int32_t get_width()    const { return m_width;    }
+    int32_t get_height()   const { return m_height;   }
+    int32_t get_channels() const { return m_channels; }
+
+    uint8_t*       data()       { return m_buffer; }
+    uint8_t const* data() const { return m_buffer; }
+    size_t size() const { return size_t(m_width) * m_height * m_channels; }
+
+    uint8_t* row(int32_t y) { return m_buffer + size_t(y) * m_width * m_channels; }
+    uint8_t const* row(int32_t y) const {
+        return m_buffer + size_t(y) * m_width * m_channels;
+    }
+
+    // Typed, unchecked access. F must match the channel count: rgb8 for 3,
+    // rgba8 or u32 for 4.
+    template <pixel_format F>
+    image_view<F> view() {
+        assert(pixel_traits<F>::channels == m_channels);
+        return image_view<F>(m_buffer, m_width, m_height);
+    }
+
+    // Calls fn with the view matching the channel count, u32 for 4, so a
+    // whole draw is specialised on the format behind a single branch.
+    template <typename Fn>
+    void visit(Fn&& fn) {
+        if (m_channels == 4)
+            fn(view<pixel_format::u32>());
+        else
+            fn(view<pixel_format::rgb8>());
+    }
+
+    // Pixels [x0, x1) of row y, clipped to the image once for the span.
+    void fill_span(int32_t x0, int32_t x1, int32_t y, color const& color) {
+        if (y < 0 || y >= m_height) return;
+        x0 = std::max(x0, 0);
+        x1 = std::min(x1, m_width);
+        visit([&](auto view) { view.fill_span(x0, x1, y, color); });
+    }
 
    public:
-    void write_png(std::string const& filename) {
-        stbi_write_png(filename.c_str(), m_width, m_height, m_channels,
-                       m_buffer, m_width * m_channels);
+    // With flip the rows go out bottom first, as flipv() and then
+    // write_png() would write them, without touching the buffer: stb walks
+    // the rows through a negative stride from the last one.
+    void write_png(std::string const& filename, bool flip = false) const {
+        const auto pitch = m_width * m_channels;
+        if (flip)
+            stbi_write_png(filename.c_str(), m_width, m_height, m_channels,
+                           row(m_height - 1), -pitch);
+        else
+            stbi_write_png(filename.c_str(), m_width, m_height, m_channels,
+                           m_buffer, pitch);
     }
 
+    // Swaps whole rows.
     void flipv() {
-        for (int32_t i = 0; i < m_height / 2; i++) {
-            for (int32_t j = 0; j < m_width; j++) {
-                const auto a = get_color(j, i);
-                const auto b = get_color(j, m_height - 1 - i);
-                set(j, i, b);
-                set(j, m_height - 1 - i, a);
-            }
-        }
+        const auto pitch = size_t(m_width) * m_channels;
+        for (int32_t i = 0; i < m_height / 2; i++)
+            pixels::swap_rows(row(i), row(m_height - 1 - i), pitch);
     }
 
+    // Reverses each row into a scratch row, with byte shuffles where the
+    // CPU has them, and copies it back.
     void fliph() {
+        const auto pitch = size_t(m_width) * m_channels;
+        std::vector<uint8_t> scratch(pitch + 16);
         for (int32_t i = 0; i < m_height; i++) {
-            for (int32_t j = 0; j < m_width / 2; j++) {
-                const auto a = get_color(j, i);
-                const auto b = get_color(m_width - 1 - j, i);
-                set(j, i, b);
-                set(m_width - 1 - j, i, a);
-            }
+            pixels::reverse(row(i), scratch.data(), m_width, m_channels);
+            std::memcpy(row(i), scratch.data(), pitch);
         }
     }
 
@@ -250,76 +664,880 @@ class image {
     int32_t m_channels;
 };
 
+// Frame buffers handed back once encoded or shown, reused by later frames
+// of the same size instead of reallocated. Keeps at most capacity idle
+// images. Thread safe.
+class image_pool {
+   public:
+    struct stats {
+        uint64_t reused = 0;
+        uint64_t allocated = 0;
+
+        std::string json() const {
+            std::stringstream ss;
+            ss << "{";
+            ss << "\"reused\":" << reused << ",";
+            ss << "\"allocated\":" << allocated;
+            ss << "}";
+            return ss.str();
+        }
+    };
+
+    image_pool(size_t capacity = 16) : m_capacity(capacity) {
+        m_idle.reserve(capacity);
+    }
+    image_pool(image_pool const&) = delete;
+    image_pool& operator=(image_pool const&) = delete;
+
+   public:
+    // A cleared image of the given size. A reused one is cleared after
+    // the lock is let go, so other threads do not wait for the memset.
+    image acquire(int32_t width, int32_t height, int32_t channels = 3) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+            if (it->get_width() != width || it->get_height() != height ||
+                it->get_channels() != channels)
+                continue;
+            image out = std::move(*it);
+            m_idle.erase(it);
+            m_stats.reused++;
+            lock.unlock();
+            std::fill(out.data(), out.data() + out.size(), 0);
+            return out;
+        }
+        m_stats.allocated++;
+        lock.unlock();
+        return image(width, height, channels);
+    }
+
+    void release(image&& frame) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_capacity == 0) return;
+        if (m_idle.size() >= m_capacity) m_idle.erase(m_idle.begin());
+        m_idle.push_back(std::move(frame));
+    }
+
+    stats get_stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+   private:
+    size_t m_capacity;
+    mutable std::mutex m_mutex;
+    std::vector<image> m_idle;
+    stats m_stats;
+};
+
+namespace detail {
+
+// Copies every pixel of src to dst at map(x, y), 32x32 pixels at a time
+// so that both the rows read and the columns written stay in cache.
+template <pixel_format F, typename Map>
+void remap_tiled(image_view<F> const& src, image_view<F> const& dst,
+                 Map const& map) {
+    constexpr int32_t tile = 32;
+    constexpr auto channels = pixel_traits<F>::channels;
+    for (int32_t ty = 0; ty < src.get_height(); ty += tile) {
+        const auto y1 = std::min(ty + tile, src.get_height());
+        for (int32_t tx = 0; tx < src.get_width(); tx += tile) {
+            const auto x1 = std::min(tx + tile, src.get_width());
+            for (int32_t y = ty; y < y1; y++) {
+                uint8_t const* from = src.pixel(tx, y);
+                for (int32_t x = tx; x < x1; x++, from += channels) {
+                    const auto to = map(x, y);
+                    std::memcpy(dst.pixel(to.x, to.y), from, channels);
+                }
+            }
+        }
+    }
+}
+
+template <typename Map>
+bool remap(image const& src, image& dst, int32_t width, int32_t height,
+           Map const& map) {
+    if (dst.get_width() != width || dst.get_height() != height ||
+        dst.get_channels() != src.get_channels())
+        return false;
+    auto* pixels = const_cast<uint8_t*>(src.data());
+    dst.visit([&](auto to) {
+        using view = decltype(to);
+        remap_tiled(view(pixels, src.get_width(), src.get_height()), to, map);
+    });
+    return true;
+}
+
+}  // namespace detail
+
+// Mirrors src over its main diagonal into dst, which must be
+// src.height x src.width with the same channels; false otherwise.
+inline bool transpose(image const& src, image& dst) {
+    return detail::remap(src, dst, src.get_height(), src.get_width(),
+                         [](int32_t x, int32_t y) {
+                             return vec2<int32_t>{y, x};
+                         });
+}
+
+// Turns src by quarter turns clockwise, as seen with row 0 on top, into
+// dst, which must be sized for the result with the same channels.
+inline bool rotate(image const& src, image& dst, int32_t turns) {
+    const auto w = src.get_width(), h = src.get_height();
+    switch (((turns % 4) + 4) % 4) {
+        case 1:
+            return detail::remap(src, dst, h, w, [h](int32_t x, int32_t y) {
+                return vec2<int32_t>{h - 1 - y, x};
+            });
+        case 2:
+            return detail::remap(src, dst, w, h, [w, h](int32_t x, int32_t y) {
+                return vec2<int32_t>{w - 1 - x, h - 1 - y};
+            });
+        case 3:
+            return detail::remap(src, dst, h, w, [w](int32_t x, int32_t y) {
+                return vec2<int32_t>{y, w - 1 - x};
+            });
+        default:
+            return detail::remap(src, dst, w, h, [](int32_t x, int32_t y) {
+                return vec2<int32_t>{x, y};
+            });
+    }
+}
+
+enum class depth_format { f32, u16, u24 };
+
+// Depth values are in [0, 1] with 0 nearest; the integer formats store
+// them scaled to their full range. u24 sits in the low bits of a uint32_t.
+template <depth_format F>
+struct depth_traits;
+
+template <>
+struct depth_traits<depth_format::f32> {
+    using type = float;
+    static type encode(float z) { return z; }
+    static float decode(type v) { return v; }
+};
+
+template <>
+struct depth_traits<depth_format::u16> {
+    using type = uint16_t;
+    static constexpr float scale = 65535.f;
+    static type encode(float z) {
+        return type(std::min(std::max(z, 0.f), 1.f) * scale + .5f);
+    }
+    static float decode(type v) { return v / scale; }
+};
+
+template <>
+struct depth_traits<depth_format::u24> {
+    using type = uint32_t;
+    static constexpr float scale = 16777215.f;
+    static type encode(float z) {
+        return type(std::min(std::max(z, 0.f), 1.f) * scale + .5f);
+    }
+    static float decode(type v) { return v / scale; }
+};
+
+// Per-pixel depth next to an image of the same size, plus a min/max
+// pyramid over it. Level 0 holds the range of every 8x8 pixel tile and
+// each further level the range of 2x2 tiles below it, up to 64x64 pixels,
+// so no pyramid tile crosses a 64 pixel aligned screen tile and tile
+// workers never share one. The maxima are what early-Z rejects against,
+// the minima let a block skip the per-pixel test when it is surely in
+// front of everything.
+class depth_buffer {
+   public:
+    static constexpr int32_t tile   = 8;
+    static constexpr int32_t levels = 4;
+
+    depth_buffer(int32_t width, int32_t height,
+                 depth_format format = depth_format::f32,
+                 bool hierarchical = true)
+        : m_width(width), m_height(height), m_format(format),
+          m_hierarchical(hierarchical) {
+        const auto size = size_t(width) * height;
+        switch (format) {
+            case depth_format::f32: m_f32.resize(size); break;
+            case depth_format::u16: m_u16.resize(size); break;
+            case depth_format::u24: m_u24.resize(size); break;
+        }
+        for (int32_t level = 0; level < levels; level++) {
+            const auto extent = tile << level;
+            m_pyramid[level].columns = (width + extent - 1) / extent;
+            m_pyramid[level].rows    = (height + extent - 1) / extent;
+            const auto tiles = size_t(m_pyramid[level].columns) *
+                               m_pyramid[level].rows;
+            m_pyramid[level].min.resize(tiles);
+            m_pyramid[level].max.resize(tiles);
+        }
+        m_pending.resize(m_pyramid[0].min.size());
+        clear();
+    }
+
+   public:
+    void clear(float depth = 1.f) {
+        std::fill(m_f32.begin(), m_f32.end(), depth);
+        std::fill(m_u16.begin(), m_u16.end(),
+                  depth_traits<depth_format::u16>::encode(depth));
+        std::fill(m_u24.begin(), m_u24.end(),
+                  depth_traits<depth_format::u24>::encode(depth));
+        const auto stored = get_depth_stored(depth);
+        for (auto& level : m_pyramid) {
+            std::fill(level.min.begin(), level.min.end(), stored);
+            std::fill(level.max.begin(), level.max.end(), stored);
+        }
+        std::fill(m_pending.begin(), m_pending.end(), 0);
+    }
+
+    int32_t get_width()  const { return m_width;  }
+    int32_t get_height() const { return m_height; }
+    depth_format get_format() const { return m_format; }
+    bool is_hierarchical() const { return m_hierarchical; }
+
+    float get_depth(int32_t x, int32_t y) const {
+        if (!(x > -1 && x < m_width && y > -1 && y < m_height)) return 1.f;
+        const auto index = size_t(y) * m_width + x;
+        switch (m_format) {
+            case depth_format::u16:
+                return depth_traits<depth_format::u16>::decode(m_u16[index]);
+            case depth_format::u24:
+                return depth_traits<depth_format::u24>::decode(m_u24[index]);
+            default:
+                return m_f32[index];
+        }
+    }
+
+    // Unchecked row access in the storage type of format F.
+    template <depth_format F>
+    typename depth_traits<F>::type* row(int32_t y) {
+        return storage<F>() + size_t(y) * m_width;
+    }
+
+    float tile_min(int32_t level, int32_t tx, int32_t ty) const {
+        auto const& l = m_pyramid[level];
+        return l.min[ty * l.columns + tx];
+    }
+    float tile_max(int32_t level, int32_t tx, int32_t ty) const {
+        auto const& l = m_pyramid[level];
+        return l.max[ty * l.columns + tx];
+    }
+
+    // True when every pixel under the inclusive rectangle [x0, x1] x
+    // [y0, y1] is already nearer than depth. Looks at the smallest pyramid
+    // level whose tiles are at least as large as the rectangle, which is
+    // at most 2x2 tiles.
+    bool occluded(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                  float depth) const {
+        if (!m_hierarchical) return false;
+        const auto extent = std::max(x1 - x0, y1 - y0) + 1;
+        int32_t level = 0;
+        while (level < levels - 1 && (tile << level) < extent) level++;
+        const auto shift = 3 + level;
+        for (int32_t ty = y0 >> shift; ty <= y1 >> shift; ty++)
+            for (int32_t tx = x0 >> shift; tx <= x1 >> shift; tx++)
+                if (depth < tile_max(level, tx, ty)) return false;
+        return true;
+    }
+
+    // Records that written pixels of the level 0 tile (tx, ty) changed,
+    // none of them to a depth below nearest. The minima follow right away,
+    // as early accepts rely on them being exact or low. A stale maximum
+    // only makes rejection less eager, so the tile is rescanned (and the
+    // maxima carried up) once it has seen a tile's worth of writes.
+    void update_tile(int32_t tx, int32_t ty, int32_t written, float nearest) {
+        if (!m_hierarchical) return;
+        for (int32_t level = 0; level < levels; level++) {
+            auto& l = m_pyramid[level];
+            auto& lo = l.min[(ty >> level) * l.columns + (tx >> level)];
+            lo = std::min(lo, nearest);
+        }
+        auto& pending = m_pending[ty * m_pyramid[0].columns + tx];
+        pending += written;
+        if (pending < tile * tile) return;
+        pending = 0;
+        switch (m_format) {
+            case depth_format::f32: rescan<depth_format::f32>(tx, ty); break;
+            case depth_format::u16: rescan<depth_format::u16>(tx, ty); break;
+            case depth_format::u24: rescan<depth_format::u24>(tx, ty); break;
+        }
+        for (int32_t level = 1; level < levels; level++) {
+            tx >>= 1;
+            ty >>= 1;
+            auto const& below = m_pyramid[level - 1];
+            auto& l = m_pyramid[level];
+            float hi = 0.f;
+            for (int32_t y = ty * 2; y < std::min(ty * 2 + 2, below.rows); y++)
+                for (int32_t x = tx * 2;
+                     x < std::min(tx * 2 + 2, below.columns); x++)
+                    hi = std::max(hi, below.max[y * below.columns + x]);
+            l.max[ty * l.columns + tx] = hi;
+        }
+    }
+
+   public:
+    std::string json() const {
+        static char const* names[] = {"f32", "u16", "u24"};
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":"
+           << "\"tiny::depth_buffer\",";
+        ss << "\"width\":"  << m_width  << ",";
+        ss << "\"height\":" << m_height << ",";
+        ss << "\"format\":\"" << names[int32_t(m_format)] << "\",";
+        ss << "\"hierarchical\":" << (m_hierarchical ? "true" : "false");
+        ss << "}";
+        return ss.str();
+    }
+    friend std::ostream& operator<<(std::ostream& os,
+                                    depth_buffer const& depth) {
+        return os << depth.json();
+    }
+
+   private:
+    struct level {
+        int32_t columns;
+        int32_t rows;
+        std::vector<float> min;
+        std::vector<float> max;
+    };
+
+    template <depth_format F>
+    typename depth_traits<F>::type* storage() {
+        if constexpr (F == depth_format::f32)
+            return m_f32.data();
+        else if constexpr (F == depth_format::u16)
+            return m_u16.data();
+        else
+            return m_u24.data();
+    }
+
+    // Depth as it reads back after a round trip through the format.
+    float get_depth_stored(float depth) const {
+        switch (m_format) {
+            case depth_format::u16:
+                return depth_traits<depth_format::u16>::decode(
+                    depth_traits<depth_format::u16>::encode(depth));
+            case depth_format::u24:
+                return depth_traits<depth_format::u24>::decode(
+                    depth_traits<depth_format::u24>::encode(depth));
+            default:
+                return depth;
+        }
+    }
+
+    template <depth_format F>
+    void rescan(int32_t tx, int32_t ty) {
+        using traits = depth_traits<F>;
+        const auto x0 = tx * tile, x1 = std::min(x0 + tile, m_width);
+        const auto y0 = ty * tile, y1 = std::min(y0 + tile, m_height);
+        auto lo = row<F>(y0)[x0], hi = lo;
+        for (int32_t y = y0; y < y1; y++) {
+            auto const* values = row<F>(y);
+            for (int32_t x = x0; x < x1; x++) {
+                lo = std::min(lo, values[x]);
+                hi = std::max(hi, values[x]);
+            }
+        }
+        auto& l = m_pyramid[0];
+        l.min[ty * l.columns + tx] = traits::decode(lo);
+        l.max[ty * l.columns + tx] = traits::decode(hi);
+    }
+
+   private:
+    int32_t m_width;
+    int32_t m_height;
+    depth_format m_format;
+    bool m_hierarchical;
+
+    std::vector<float>    m_f32;
+    std::vector<uint16_t> m_u16;
+    std::vector<uint32_t> m_u24;
+
+    level m_pyramid[levels];
+    std::vector<int32_t> m_pending;
+};
+
+namespace detail {
+
+// Position, texture and normal indices of a face corner, zero based.
+struct obj_corner {
+    int32_t index[3];
+};
+
+// Marks an attribute a corner does not have.
+constexpr int32_t obj_missing = INT32_MIN;
+
+// Attribute pools and polygons of a run of OBJ lines. offsets holds where
+// each polygon starts in corners, plus the final end. Negative (relative)
+// file indices resolve against the chunk's own pools; relative lists
+// them as corner * 3 + attribute, to be rebased onto the pools of the
+// chunks before when merging.
+struct obj_chunk {
+    std::vector<vec3<float>> positions;
+    std::vector<vec2<float>> uvs;
+    std::vector<vec3<float>> normals;
+    std::vector<obj_corner> corners;
+    std::vector<uint32_t> offsets{0};
+    std::vector<uint32_t> relative;
+};
+
+// Welded vertex streams and the triangle index buffer into them. uvs and
+// normals are empty when the file has none, otherwise one per vertex.
+struct mesh_streams {
+    std::vector<vec3<float>> positions;
+    std::vector<vec2<float>> uvs;
+    std::vector<vec3<float>> normals;
+    std::vector<uint32_t> indices;
+};
+
+inline char const* skip_blanks(char const* p, char const* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// Parses a float at p, returning the first character after it, or
+// nullptr if there is none. Correctly rounded through std::from_chars
+// where the standard library has it, a plain decimal parser otherwise.
+inline char const* parse_float(char const* p, char const* end, float& value) {
+    if (p < end && *p == '+') p++;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    const auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+#else
+    const bool negative = p < end && *p == '-';
+    if (negative) p++;
+    char const* start = p;
+    double mantissa = 0;
+    int32_t exponent = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        mantissa = mantissa * 10 + (*p - '0');
+    if (p < end && *p == '.')
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, exponent--)
+            mantissa = mantissa * 10 + (*p - '0');
+    if (p == start) return nullptr;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        char const* q = p + 1;
+        int32_t sign = 1, power = 0;
+        if (q < end && (*q == '-' || *q == '+')) sign = *q++ == '-' ? -1 : 1;
+        if (q < end && *q >= '0' && *q <= '9') {
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+                power = power * 10 + (*q - '0');
+            exponent += sign * power;
+            p = q;
+        }
+    }
+    value = float((negative ? -mantissa : mantissa) * std::pow(10., exponent));
+    return p;
+#endif
+}
+
+inline char const* parse_int(char const* p, char const* end, int32_t& value) {
+    const auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Reads up to n floats of a line into values, leaving missing ones alone.
+inline void parse_floats(char const* p, char const* end, float* values,
+                         int32_t n) {
+    for (int32_t i = 0; i < n && p; i++)
+        p = parse_float(skip_blanks(p, end), end, values[i]);
+}
+
+// Parses one "v", "v/vt", "v//vn" or "v/vt/vn" corner at p.
+inline char const* parse_corner(char const* p, char const* end,
+                                obj_chunk& out) {
+    obj_corner corner{{obj_missing, obj_missing, obj_missing}};
+    const uint32_t counts[3] = {uint32_t(out.positions.size()),
+                                uint32_t(out.uvs.size()),
+                                uint32_t(out.normals.size())};
+    for (int32_t k = 0; k < 3; k++) {
+        if (k > 0) {
+            if (p >= end || *p != '/') break;
+            p++;
+        }
+        int32_t idx;
+        char const* next = parse_int(p, end, idx);
+        if (!next) {
+            if (k == 0) return nullptr;
+            continue;
+        }
+        p = next;
+        if (idx > 0) {
+            corner.index[k] = idx - 1;
+        } else if (idx < 0) {
+            corner.index[k] = int32_t(counts[k]) + idx;
+            out.relative.push_back(uint32_t(out.corners.size() * 3 + k));
+        }
+    }
+    out.corners.push_back(corner);
+    return p;
+}
+
+// Parses the "v", "vt", "vn" and "f" lines of [begin, end), which starts
+// at a line start.
+inline void parse_obj(char const* begin, char const* end, obj_chunk& out) {
+    while (begin < end) {
+        auto eol = static_cast<char const*>(std::memchr(begin, '\n', end - begin));
+        if (!eol) eol = end;
+        const auto length = eol - begin;
+        if (length > 2 && begin[0] == 'v' && begin[1] == ' ') {
+            vec3<float> position{0.f, 0.f, 0.f};
+            parse_floats(begin + 2, eol, position.raw, 3);
+            out.positions.push_back(position);
+        } else if (length > 3 && begin[0] == 'v' && begin[1] == 't' &&
+                   begin[2] == ' ') {
+            vec2<float> uv{0.f, 0.f};
+            parse_floats(begin + 3, eol, uv.raw, 2);
+            out.uvs.push_back(uv);
+        } else if (length > 3 && begin[0] == 'v' && begin[1] == 'n' &&
+                   begin[2] == ' ') {
+            vec3<float> normal{0.f, 0.f, 0.f};
+            parse_floats(begin + 3, eol, normal.raw, 3);
+            out.normals.push_back(normal);
+        } else if (length > 2 && begin[0] == 'f' && begin[1] == ' ') {
+            char const* p = skip_blanks(begin + 2, eol);
+            while (p < eol && (p = parse_corner(p, eol, out))) {
+                while (p < eol && *p != ' ' && *p != '\t' && *p != '\r') p++;
+                p = skip_blanks(p, eol);
+            }
+            out.offsets.push_back(uint32_t(out.corners.size()));
+        }
+        begin = eol + 1;
+    }
+}
+
+// Triangulates polygons and merges corners with equal position, texture
+// and normal indices into one vertex, through an open addressing table
+// sized for the worst case of every corner being unique.
+class obj_welder {
+   public:
+    obj_welder(size_t corners, bool uvs, bool normals, mesh_streams& out)
+        : m_uvs(uvs), m_normals(normals), m_out(out) {
+        size_t size = 16;
+        while (size < corners * 2) size <<= 1;
+        m_table.assign(size, 0);
+        m_keys.reserve(corners);
+    }
+
+    // Fans the polygon out from its first corner, which triangulates the
+    // convex polygons exporters write. Corners with an attribute index out
+    // of range lose that attribute; a bad position drops the polygon.
+    void polygon(obj_corner const* corners, uint32_t count,
+                 std::vector<vec3<float>> const& positions,
+                 std::vector<vec2<float>> const& uvs,
+                 std::vector<vec3<float>> const& normals) {
+        if (count < 3) return;
+        m_polygon.clear();
+        for (uint32_t i = 0; i < count; i++) {
+            auto corner = corners[i];
+            if (uint32_t(corner.index[0]) >= positions.size()) return;
+            if (uint32_t(corner.index[1]) >= uvs.size())
+                corner.index[1] = obj_missing;
+            if (uint32_t(corner.index[2]) >= normals.size())
+                corner.index[2] = obj_missing;
+            m_polygon.push_back(vertex(corner, positions, uvs, normals));
+        }
+        for (uint32_t i = 1; i + 1 < count; i++) {
+            m_out.indices.push_back(m_polygon[0]);
+            m_out.indices.push_back(m_polygon[i]);
+            m_out.indices.push_back(m_polygon[i + 1]);
+        }
+    }
+
+   private:
+    uint32_t vertex(obj_corner const& corner,
+                    std::vector<vec3<float>> const& positions,
+                    std::vector<vec2<float>> const& uvs,
+                    std::vector<vec3<float>> const& normals) {
+        uint64_t hash = uint32_t(corner.index[0]) * 0x9E3779B97F4A7C15ull;
+        hash ^= uint32_t(corner.index[1]) * 0xC2B2AE3D27D4EB4Full + (hash >> 29);
+        hash ^= uint32_t(corner.index[2]) * 0x165667B19E3779F9ull + (hash >> 32);
+        const size_t mask = m_table.size() - 1;
+        for (size_t slot = size_t(hash >> 17) & mask;; slot = (slot + 1) & mask) {
+            const uint32_t entry = m_table[slot];
+            if (entry == 0) {
+                const auto id = uint32_t(m_keys.size());
+                m_table[slot] = id + 1;
+                m_keys.push_back(corner);
+                m_out.positions.push_back(positions[corner.index[0]]);
+                if (m_uvs)
+                    m_out.uvs.push_back(corner.index[1] == obj_missing
+                                            ? vec2<float>{0.f, 0.f}
+                                            : uvs[corner.index[1]]);
+                if (m_normals)
+                    m_out.normals.push_back(corner.index[2] == obj_missing
+                                                ? vec3<float>{0.f, 0.f, 0.f}
+                                                : normals[corner.index[2]]);
+                return id;
+            }
+            auto const& key = m_keys[entry - 1];
+            if (key.index[0] == corner.index[0] &&
+                key.index[1] == corner.index[1] &&
+                key.index[2] == corner.index[2])
+                return entry - 1;
+        }
+    }
+
+   private:
+    bool m_uvs;
+    bool m_normals;
+    mesh_streams& m_out;
+    std::vector<uint32_t> m_table;
+    std::vector<obj_corner> m_keys;
+    std::vector<uint32_t> m_polygon;
+};
+
+}  // namespace detail
+
+// Triangle mesh as separate position, UV and normal streams of unique
+// vertices plus one index buffer, three indices per face. Loading
+// triangulates polygons and welds corners sharing all of their OBJ
+// indices, so there are as many vertices to transform as distinct corners.
+// Accessors hand out views into the streams, so walking the faces never
+// allocates; vert() and face() are kept for the lessons.
+//
+// With cache on, the first load writes a binary sidecar next to the OBJ
+// (see tiny/mesh_cache.hpp) and later loads map it and point the views
+// straight into it, skipping the parse.
+//
+// A parse runs on the calling thread unless a scheduler is passed in, so
+// models loaded from the workers of a pool do not each start threads of
+// their own. The scheduler must not be running anything else meanwhile.
 class model {
    public:
-    model() : m_filename(""), m_loaded(false) {}
-    model(std::string const& filename) : m_filename(filename), m_loaded(false) {
-        load();
+    model() : m_filename(""), m_loaded(false), m_cache(true), m_cached(false) {}
+    model(std::string const& filename, bool cache = true,
+          scheduler* pool = nullptr)
+        : m_filename(filename), m_loaded(false), m_cache(cache), m_cached(false) {
+        load(pool);
     }
     ~model() {}
 
-    void load(std::string const& filename) {
+    model(model const&) = delete;
+    model& operator=(model const&) = delete;
+    model(model&&) = default;
+    model& operator=(model&&) = default;
+
+    void load(std::string const& filename, bool cache = true,
+              scheduler* pool = nullptr) {
         m_filename = filename;
-        load();
+        m_cache = cache;
+        load(pool);
     }
 
     bool is_load() const { return m_loaded; }
+    // Whether the streams are mapped from the sidecar rather than parsed.
+    bool is_cached() const { return m_cached; }
+
+    int32_t nverts() const { return m_positions.size(); }
+    int32_t nfaces() const { return m_indices.size() / 3; }
 
-    int32_t nverts() const { return m_verts.size(); }
-    int32_t nfaces() const { return m_faces.size(); }
+    span<vec3<float> const> positions() const { return m_positions; }
+    span<vec2<float> const> uvs()       const { return m_uvs;       }
+    span<vec3<float> const> normals()   const { return m_normals;   }
+    span<uint32_t const>    indices()   const { return m_indices;   }
 
-    vec3<float> vert(int32_t i) { return m_verts[i]; }
-    std::vector<int32_t> face(int32_t i) { return m_faces[i]; }
+    // Corners of the axis aligned box around every position.
+    vec3<float> bounds_min() const { return m_min; }
+    vec3<float> bounds_max() const { return m_max; }
+
+    // Vertex indices of face i.
+    span<uint32_t const> face_indices(int32_t i) const {
+        return m_indices.subspan(size_t(i) * 3, 3);
+    }
+
+    vec3<float> vert(int32_t i) { return m_positions[i]; }
+    std::vector<int32_t> face(int32_t i) {
+        const auto f = face_indices(i);
+        return std::vector<int32_t>(f.begin(), f.end());
+    }
+
+    // Reorders the faces for the post-transform vertex cache and then the
+    // vertices in the order the faces first use them. A mesh mapped from
+    // its sidecar is copied out first; the sidecar keeps the file order.
+    // Draw order changes, so equal depths may resolve differently.
+    mesh::optimize_stats optimize() {
+        mesh::optimize_stats stats;
+        if (!m_loaded) return stats;
+        if (m_cached) {
+            m_mesh.positions.assign(m_positions.begin(), m_positions.end());
+            m_mesh.uvs.assign(m_uvs.begin(), m_uvs.end());
+            m_mesh.normals.assign(m_normals.begin(), m_normals.end());
+            m_mesh.indices.assign(m_indices.begin(), m_indices.end());
+            m_blob.close();
+            m_cached = false;
+        }
+        const auto count = uint32_t(nverts());
+        stats.vertices = count;
+        stats.triangles = uint32_t(nfaces());
+        stats.acmr_before = mesh::acmr(m_mesh.indices, count);
+        mesh::optimize_vertex_cache(m_mesh.indices, count);
+        const auto remap = mesh::optimize_vertex_fetch(m_mesh.indices, count);
+        mesh::remap_stream(m_mesh.positions, remap);
+        mesh::remap_stream(m_mesh.uvs, remap);
+        mesh::remap_stream(m_mesh.normals, remap);
+        stats.acmr_after = mesh::acmr(m_mesh.indices, count);
+        bind();
+        return stats;
+    }
 
    private:
-    void load() {
+    void bind() {
+        m_positions = m_mesh.positions;
+        m_uvs       = m_mesh.uvs;
+        m_normals   = m_mesh.normals;
+        m_indices   = m_mesh.indices;
+    }
+
+    void load(scheduler* pool) {
         if (m_loaded) return;
-        std::ifstream file(m_filename, std::ios::in);
-        if (file.fail() && !file.is_open()) return;
-
-        std::string line;
-        while (!file.eof()) {
-            std::getline(file, line);
-            std::istringstream iss(line.c_str());
-            char trash;
-            if (!line.compare(0, 2, "v ")) {
-                iss >> trash;
-                vec3<float> vertex;
-                iss >> vertex.x;
-                iss >> vertex.y;
-                iss >> vertex.z;
-                m_verts.push_back(vertex);
-            } else if (!line.compare(0, 2, "f ")) {
-                std::vector<int32_t> face;
-                int32_t itrash, idx;
-                iss >> trash;
-                while (iss >> idx >> trash >> itrash >> trash >> itrash) {
-                    face.push_back(--idx);
-                }
-                m_faces.push_back(face);
-            }
+        mesh_cache::stamp key;
+        if (!mesh_cache::file_stamp(m_filename, key)) return;
+        if (m_cache && load_cache(key)) return;
+        if (!parse(pool)) return;
+        if (m_cache) save_cache(key);
+    }
+
+    // Maps the file and parses it in chunks split at line breaks, in
+    // parallel on pool for files large enough to pay for it. The chunks'
+    // polygons are then triangulated and welded in file order.
+    bool parse(scheduler* pool) {
+        mapped_file file(m_filename);
+        if (!file.is_open()) return false;
+
+        char const* begin = file.data();
+        char const* end   = begin + file.size();
+        size_t count = 1;
+        if (pool && pool->size() > 1)
+            count = std::max<size_t>(
+                1, std::min<size_t>(pool->size() * 4, file.size() / (256 << 10)));
+        std::vector<char const*> bounds{begin};
+        for (size_t i = 1; i < count; i++) {
+            auto split = std::max(bounds.back(), begin + file.size() * i / count);
+            while (split < end && *split++ != '\n') {}
+            bounds.push_back(split);
+        }
+        bounds.push_back(end);
+
+        std::vector<detail::obj_chunk> chunks(count);
+        auto parse = [&](uint32_t i, uint32_t) {
+            detail::parse_obj(bounds[i], bounds[i + 1], chunks[i]);
+        };
+        if (count == 1)
+            parse(0, 0);
+        else
+            pool->parallel_for(uint32_t(count), parse);
+
+        // Rebase relative indices onto the pools of the chunks before,
+        // then move every chunk's pool behind theirs.
+        size_t corners = 0;
+        uint32_t base[3] = {0, 0, 0};
+        for (auto& chunk : chunks) {
+            for (auto const entry : chunk.relative)
+                chunk.corners[entry / 3].index[entry % 3] += base[entry % 3];
+            base[0] += uint32_t(chunk.positions.size());
+            base[1] += uint32_t(chunk.uvs.size());
+            base[2] += uint32_t(chunk.normals.size());
+            corners += chunk.corners.size();
+        }
+        auto& pools = chunks[0];
+        for (size_t i = 1; i < count; i++) {
+            pools.positions.insert(pools.positions.end(),
+                                   chunks[i].positions.begin(),
+                                   chunks[i].positions.end());
+            pools.uvs.insert(pools.uvs.end(), chunks[i].uvs.begin(),
+                             chunks[i].uvs.end());
+            pools.normals.insert(pools.normals.end(), chunks[i].normals.begin(),
+                                 chunks[i].normals.end());
         }
 
-        file.close();
+        auto& mesh = m_mesh;
+        mesh.positions.reserve(std::min(corners, pools.positions.size() * 2));
+        mesh.indices.reserve(corners);
+        detail::obj_welder welder(corners, !pools.uvs.empty(),
+                                  !pools.normals.empty(), mesh);
+        for (auto const& chunk : chunks)
+            for (size_t i = 0; i + 1 < chunk.offsets.size(); i++)
+                welder.polygon(chunk.corners.data() + chunk.offsets[i],
+                               chunk.offsets[i + 1] - chunk.offsets[i],
+                               pools.positions, pools.uvs, pools.normals);
+
+        bind();
+        m_min = m_max = m_positions.empty() ? vec3<float>{0.f, 0.f, 0.f}
+                                            : m_positions[0];
+        for (auto const& p : m_positions) {
+            for (int32_t k = 0; k < 3; k++) {
+                m_min.raw[k] = std::min(m_min.raw[k], p.raw[k]);
+                m_max.raw[k] = std::max(m_max.raw[k], p.raw[k]);
+            }
+        }
         m_loaded = true;
+        return true;
+    }
+
+    static constexpr uint64_t strides[mesh_cache::nstreams] = {
+        sizeof(vec3<float>), sizeof(vec2<float>), sizeof(vec3<float>),
+        sizeof(uint32_t)};
+
+    bool load_cache(mesh_cache::stamp const& key) {
+        auto h = mesh_cache::open(mesh_cache::path(m_filename), key, strides,
+                                  m_blob);
+        if (!h) return false;
+        view(h, mesh_cache::positions, m_positions);
+        view(h, mesh_cache::uvs,       m_uvs);
+        view(h, mesh_cache::normals,   m_normals);
+        view(h, mesh_cache::indices,   m_indices);
+        m_min = {h->bounds_min[0], h->bounds_min[1], h->bounds_min[2]};
+        m_max = {h->bounds_max[0], h->bounds_max[1], h->bounds_max[2]};
+        m_loaded = m_cached = true;
+        return true;
+    }
+
+    template <typename T>
+    void view(mesh_cache::header const* h, mesh_cache::stream i,
+              span<T const>& out) {
+        out = span<T const>(
+            reinterpret_cast<T const*>(m_blob.data() + h->offset[i]),
+            size_t(h->count[i]));
+    }
+
+    void save_cache(mesh_cache::stamp const& key) const {
+        const mesh_cache::source_stream streams[mesh_cache::nstreams] = {
+            {m_positions.data(), m_positions.size(), strides[0]},
+            {m_uvs.data(),       m_uvs.size(),       strides[1]},
+            {m_normals.data(),   m_normals.size(),   strides[2]},
+            {m_indices.data(),   m_indices.size(),   strides[3]},
+        };
+        mesh_cache::write(mesh_cache::path(m_filename), key, streams,
+                          m_min.raw, m_max.raw);
     }
 
    public:
     friend std::ostream& operator<<(std::ostream& os, model const& model) {
         os << "tiny::model {";
         os << " loaded: " << (model.m_loaded ? "true" : "false") << ",";
+        os << " cached: " << (model.m_cached ? "true" : "false") << ",";
         os << " filename: " << model.m_filename << ",";
-        os << " vertices: " << model.m_verts.size() << ",";
-        os << " faces: " << model.m_faces.size() << " }";
+        os << " vertices: " << model.nverts() << ",";
+        os << " faces: " << model.nfaces() << " }";
         return os;
     }
 
    private:
     std::string m_filename;
     bool m_loaded;
+    bool m_cache;
+    bool m_cached;
+
+    // Backing storage of the views: either the parsed streams or the
+    // mapped sidecar.
+    detail::mesh_streams m_mesh;
+    mapped_file m_blob;
 
-    std::vector<vec3<float>> m_verts;
-    std::vector<std::vector<int32_t>> m_faces;
+    span<vec3<float> const> m_positions;
+    span<vec2<float> const> m_uvs;
+    span<vec3<float> const> m_normals;
+    span<uint32_t const> m_indices;
+    vec3<float> m_min{0.f, 0.f, 0.f};
+    vec3<float> m_max{0.f, 0.f, 0.f};
 };
 
 }  // namespace tiny
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "tiny.hpp"
+#include "tiny/memory.hpp"
+
+namespace tiny {
+
+// Linear allocator for data that lives for one frame: transformed
+// vertices, triangle setup records, tile bins. Allocation bumps an offset;
+// reset() rewinds it in O(1) without running destructors, so it only
+// hands out trivially destructible types. When a frame outgrows the
+// current block a new one is chained on; blocks in use cannot move, so
+// the chain is only replaced by a single block of the total size when
+// nothing is: by reserve(), or else by the next reset(), which then
+// allocates. A frame loop that calls reserve(peak()) between frames
+// stops allocating inside them after the first. Not thread safe:
+// allocate on one thread, then share the spans.
+class arena {
+   public:
+    arena(size_t capacity = 1 << 20) : m_used(0), m_peak(0) { grow(capacity); }
+    ~arena() {
+        for (auto const& b : m_blocks) memory::release(b.data);
+    }
+    arena(arena const&) = delete;
+    arena& operator=(arena const&) = delete;
+
+   public:
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        auto* b = &m_blocks.back();
+        auto offset = (b->used + align - 1) / align * align;
+        if (offset + bytes > b->size) {
+            grow(std::max(bytes + align, b->size * 2));
+            b = &m_blocks.back();
+            offset = 0;
+        }
+        b->used = offset + bytes;
+        m_used += bytes;
+        m_peak = std::max(m_peak, m_used);
+        return b->data + offset;
+    }
+
+    // count default initialised elements of T: plain data is left as is.
+    template <typename T>
+    span<T> allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena never runs destructors");
+        auto* p = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; i++) new (p + i) T;
+        return span<T>(p, count);
+    }
+
+    // Rewinds to one block of at least bytes, merging a chain into one
+    // block of its total size. Nothing handed out may be in use.
+    void reserve(size_t bytes) {
+        const auto total = capacity();
+        if (m_blocks.size() > 1 || total < bytes) {
+            for (auto const& b : m_blocks) memory::release(b.data);
+            m_blocks.clear();
+            grow(std::max(total, bytes));
+        }
+        m_blocks.back().used = 0;
+        m_used = 0;
+    }
+
+    void reset() { reserve(0); }
+
+    // Bytes handed out since the last reset, and the most ever.
+    size_t used() const { return m_used; }
+    size_t peak() const { return m_peak; }
+    size_t capacity() const {
+        size_t total = 0;
+        for (auto const& b : m_blocks) total += b.size;
+        return total;
+    }
+
+   public:
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":"
+           << "\"tiny::arena\",";
+        ss << "\"capacity\":" << capacity() << ",";
+        ss << "\"blocks\":" << m_blocks.size() << ",";
+        ss << "\"used\":" << m_used << ",";
+        ss << "\"peak\":" << m_peak;
+        ss << "}";
+        return ss.str();
+    }
+
+   private:
+    struct block {
+        uint8_t* data;
+        size_t size;
+        size_t used;
+    };
+
+    void grow(size_t size) {
+        size = (size + memory::alignment - 1) / memory::alignment *
+               memory::alignment;
+        m_blocks.push_back(
+            {static_cast<uint8_t*>(memory::allocate(size)), size, 0});
+    }
+
+   private:
+    std::vector<block> m_blocks;
+    size_t m_used;
+    size_t m_peak;
+};
+
+}  // namespace tiny
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tiny.hpp"
+
+namespace tiny {
+
+// Shared state of a process rendering many jobs: loaded models outlive the
+// job that first needed them. Frame buffers go through tiny::image_pool.
+namespace batch {
+
+// The most recently used models, up to a capacity, shared between
+// threads. A model is loaded once however many jobs ask for it at the
+// same time, and parsed on the thread that missed, with no threads of
+// its own; evicting it only drops the cache's reference, so jobs still
+// drawing it are unaffected.
+class model_cache {
+   public:
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+
+        std::string json() const {
+            std::stringstream ss;
+            ss << "{";
+            ss << "\"hits\":" << hits << ",";
+            ss << "\"misses\":" << misses << ",";
+            ss << "\"evictions\":" << evictions;
+            ss << "}";
+            return ss.str();
+        }
+    };
+
+    model_cache(size_t capacity = 8)
+        : m_capacity(capacity > 0 ? capacity : 1) {}
+    model_cache(model_cache const&) = delete;
+    model_cache& operator=(model_cache const&) = delete;
+
+   public:
+    // The model of filename, loading it on a miss. hit tells which it was.
+    // Returns null when the file does not load; failures are not cached.
+    std::shared_ptr<model const> get(std::string const& filename,
+                                     bool* hit = nullptr) {
+        std::shared_future<std::shared_ptr<model const>> pending;
+        std::promise<std::shared_ptr<model const>> loading;
+        uint64_t load = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_entries.find(filename);
+            if (found != m_entries.end()) {
+                m_order.splice(m_order.begin(), m_order, found->second.order);
+                m_stats.hits++;
+                pending = found->second.value;
+            } else {
+                m_stats.misses++;
+                m_order.push_front(filename);
+                load = ++m_loads;
+                m_entries[filename] = {loading.get_future().share(),
+                                       m_order.begin(), load};
+                evict();
+            }
+        }
+        if (hit) *hit = pending.valid();
+        if (pending.valid()) return pending.get();
+
+        auto loaded = std::make_shared<model>(filename);
+        if (!loaded->is_load()) {
+            loaded.reset();
+            // The entry may have been evicted meanwhile and filename asked
+            // for again: only this load's own entry is dropped.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_entries.find(filename);
+            if (found != m_entries.end() && found->second.load == load) {
+                m_order.erase(found->second.order);
+                m_entries.erase(found);
+            }
+        }
+        loading.set_value(loaded);
+        return loaded;
+    }
+
+    stats get_stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+   private:
+    struct entry {
+        std::shared_future<std::shared_ptr<model const>> value;
+        std::list<std::string>::iterator order;
+        uint64_t load;  // which miss made it
+    };
+
+    void evict() {
+        while (m_entries.size() > m_capacity) {
+            m_entries.erase(m_order.back());
+            m_order.pop_back();
+            m_stats.evictions++;
+        }
+    }
+
+   private:
+    size_t m_capacity;
+    mutable std::mutex m_mutex;
+    std::list<std::string> m_order;
+    std::unordered_map<std::string, entry> m_entries;
+    uint64_t m_loads = 0;
+    stats m_stats;
+};
+
+}  // namespace batch
+
+}  // namespace tiny
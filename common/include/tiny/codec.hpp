@@ -0,0 +1,509 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tiny.hpp"
+#include "tiny/deflate.hpp"
+#include "tiny/scheduler.hpp"
+
+namespace tiny {
+
+// Image file encoders that run off the render thread: PNG deflated in
+// strips over a scheduler, and the formats that need no compression at
+// all for pipelines that only pass frames on (PPM/PAM, QOI, TGA).
+// Every encoder takes flip like image::write_png(): rows go out bottom
+// first without touching the buffer.
+//
+// Images of 1 to 4 channels are written: grey, grey and alpha, RGB and
+// RGBA. PNG and PAM store grey as it is; PPM, QOI and TGA have no grey and
+// repeat it over RGB. Any other count encodes to nothing, and write()
+// fails.
+namespace codec {
+
+enum class format { png, ppm, pam, qoi, tga };
+
+inline char const* name(format f) {
+    switch (f) {
+        case format::png: return "png";
+        case format::ppm: return "ppm";
+        case format::pam: return "pam";
+        case format::qoi: return "qoi";
+        case format::tga: return "tga";
+    }
+    return "";
+}
+
+// The format named by the extension of filename, png when it names none.
+inline format format_of(std::string const& filename) {
+    const auto dot = filename.find_last_of('.');
+    if (dot == std::string::npos) return format::png;
+    auto ext = filename.substr(dot + 1);
+    for (auto& c : ext) c = char(std::tolower(static_cast<unsigned char>(c)));
+    for (auto f : {format::ppm, format::pam, format::qoi, format::tga})
+        if (ext == name(f)) return f;
+    return format::png;
+}
+
+namespace detail {
+
+inline bool supported(image const& image) {
+    return image.get_channels() >= 1 && image.get_channels() <= 4;
+}
+
+// The pixel at src as RGBA, grey repeated over RGB and alpha 255 where
+// there is none.
+inline void rgba(uint8_t const* src, int32_t channels, uint8_t* out) {
+    const bool grey = channels < 3;
+    out[0] = src[0];
+    out[1] = grey ? src[0] : src[1];
+    out[2] = grey ? src[0] : src[2];
+    out[3] = channels == 2 ? src[1] : channels == 4 ? src[3] : 255;
+}
+
+inline uint8_t const* source_row(image const& image, int32_t y, bool flip) {
+    return image.row(flip ? image.get_height() - 1 - y : y);
+}
+
+inline void put_be32(std::vector<uint8_t>& out, uint32_t v) {
+    const uint8_t bytes[4] = {uint8_t(v >> 24), uint8_t(v >> 16),
+                              uint8_t(v >> 8), uint8_t(v)};
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+inline void put_text(std::vector<uint8_t>& out, std::string const& text) {
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+inline uint8_t paeth(int32_t a, int32_t b, int32_t c) {
+    const int32_t p = a + b - c;
+    const int32_t pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return uint8_t(a);
+    if (pb <= pc) return uint8_t(b);
+    return uint8_t(c);
+}
+
+// Writes the filter byte and the filtered row to out, picking the filter
+// whose output has the smallest sum of magnitudes as stb does. prev is
+// null for the first row; scratch holds a row.
+inline void filter_row(uint8_t const* row, uint8_t const* prev, size_t pitch,
+                       int32_t channels, uint8_t* out, uint8_t* scratch) {
+    const auto n = size_t(channels);
+    uint64_t best_cost = ~uint64_t(0);
+    for (uint8_t type = 0; type < 5; type++) {
+        // Without a row above, up is none and average and paeth are sub.
+        if (!prev && (type == 2 || type == 4)) continue;
+        uint8_t* dst = best_cost == ~uint64_t(0) ? out + 1 : scratch;
+        switch (type) {
+            case 0: std::memcpy(dst, row, pitch); break;
+            case 1:
+                std::memcpy(dst, row, n);
+                for (size_t i = n; i < pitch; i++) dst[i] = uint8_t(row[i] - row[i - n]);
+                break;
+            case 2:
+                for (size_t i = 0; i < pitch; i++) dst[i] = uint8_t(row[i] - prev[i]);
+                break;
+            case 3:
+                if (!prev) {
+                    std::memcpy(dst, row, n);
+                    for (size_t i = n; i < pitch; i++)
+                        dst[i] = uint8_t(row[i] - (row[i - n] >> 1));
+                    break;
+                }
+                for (size_t i = 0; i < n; i++) dst[i] = uint8_t(row[i] - (prev[i] >> 1));
+                for (size_t i = n; i < pitch; i++)
+                    dst[i] = uint8_t(row[i] - ((row[i - n] + prev[i]) >> 1));
+                break;
+            case 4:
+                for (size_t i = 0; i < n; i++) dst[i] = uint8_t(row[i] - prev[i]);
+                for (size_t i = n; i < pitch; i++)
+                    dst[i] = uint8_t(row[i] - paeth(row[i - n], prev[i], prev[i - n]));
+                break;
+        }
+        uint64_t cost = 0;
+        for (size_t i = 0; i < pitch; i++)
+            cost += uint64_t(std::abs(int32_t(int8_t(dst[i]))));
+        if (cost < best_cost) {
+            best_cost = cost;
+            out[0] = type;
+            if (dst != out + 1) std::memcpy(out + 1, dst, pitch);
+        }
+    }
+}
+
+inline void put_chunk(std::vector<uint8_t>& out, char const (&type)[5],
+                      uint8_t const* data, size_t size) {
+    put_be32(out, uint32_t(size));
+    const auto start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    put_be32(out, deflate::crc32(out.data() + start, size + 4));
+}
+
+}  // namespace detail
+
+// The image split into strips of rows, each filtered, deflated and
+// wrapped in an IDAT chunk of its own on the pool's threads; the chunks
+// are then joined in order. Strips end on a sync flush, so the IDATs
+// carry one zlib stream whose checksum is combined from the strips'.
+// Matches do not reach across strips, which costs a little size.
+inline std::vector<uint8_t> encode_png(image const& image, bool flip = false,
+                                       scheduler* pool = nullptr) {
+    if (!detail::supported(image)) return {};
+    const auto width = image.get_width(), height = image.get_height();
+    const auto channels = image.get_channels();
+    const auto pitch = size_t(width) * channels;
+    const int32_t rows = std::max<int32_t>(1, int32_t((256 << 10) / (pitch + 1)));
+    const auto strips = uint32_t(std::max(1, (height + rows - 1) / rows));
+
+    struct strip {
+        std::vector<uint8_t> chunk;
+        uint32_t adler = 1;
+        size_t size = 0;
+    };
+    std::vector<strip> out(strips);
+    auto encode = [&](uint32_t s, uint32_t) {
+        const auto y0 = int32_t(s) * rows;
+        const auto y1 = std::min(height, y0 + rows);
+        std::vector<uint8_t> filtered(size_t(y1 - y0) * (pitch + 1));
+        std::vector<uint8_t> scratch(pitch);
+        for (int32_t y = y0; y < y1; y++)
+            detail::filter_row(detail::source_row(image, y, flip),
+                               y > 0 ? detail::source_row(image, y - 1, flip)
+                                     : nullptr,
+                               pitch, channels,
+                               filtered.data() + size_t(y - y0) * (pitch + 1),
+                               scratch.data());
+        auto& o = out[s];
+        o.size = filtered.size();
+        o.adler = deflate::adler32(filtered.data(), filtered.size());
+        std::vector<uint8_t> data;
+        // The zlib header: deflate with a 32K window, no dictionary.
+        if (s == 0) data = {0x78, 0x01};
+        deflate::compress(filtered.data(), filtered.size(), s + 1 == strips,
+                          data);
+        // The last strip's chunk gets the checksum after the join.
+        if (s + 1 < strips)
+            detail::put_chunk(o.chunk, "IDAT", data.data(), data.size());
+        else
+            o.chunk.swap(data);
+    };
+    if (pool)
+        pool->parallel_for(strips, encode);
+    else
+        for (uint32_t s = 0; s < strips; s++) encode(s, 0);
+
+    uint32_t adler = out[0].adler;
+    for (uint32_t s = 1; s < strips; s++)
+        adler = deflate::adler32_combine(adler, out[s].adler, out[s].size);
+    auto& last = out.back().chunk;
+    detail::put_be32(last, adler);
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    size_t total = png.size() + last.size() + 64;
+    for (auto const& o : out) total += o.chunk.size();
+    png.reserve(total);
+    std::vector<uint8_t> header;
+    detail::put_be32(header, uint32_t(width));
+    detail::put_be32(header, uint32_t(height));
+    const uint8_t colour_types[] = {0, 0, 4, 2, 6};
+    const uint8_t rest[] = {8, colour_types[channels], 0, 0, 0};
+    header.insert(header.end(), rest, rest + 5);
+    detail::put_chunk(png, "IHDR", header.data(), header.size());
+    for (uint32_t s = 0; s + 1 < strips; s++)
+        png.insert(png.end(), out[s].chunk.begin(), out[s].chunk.end());
+    detail::put_chunk(png, "IDAT", last.data(), last.size());
+    detail::put_chunk(png, "IEND", nullptr, 0);
+    return png;
+}
+
+// Binary PPM (P6). Alpha, if any, is dropped.
+inline std::vector<uint8_t> encode_ppm(image const& image, bool flip = false) {
+    if (!detail::supported(image)) return {};
+    const auto width = image.get_width(), height = image.get_height();
+    const auto channels = image.get_channels();
+    std::vector<uint8_t> out;
+    detail::put_text(out, "P6\n" + std::to_string(width) + " " +
+                              std::to_string(height) + "\n255\n");
+    const auto start = out.size();
+    out.resize(start + size_t(width) * height * 3);
+    auto* dst = out.data() + start;
+    for (int32_t y = 0; y < height; y++) {
+        auto const* src = detail::source_row(image, y, flip);
+        if (channels == 3) {
+            std::memcpy(dst, src, size_t(width) * 3);
+            dst += size_t(width) * 3;
+            continue;
+        }
+        uint8_t px[4];
+        for (int32_t x = 0; x < width; x++, src += channels, dst += 3) {
+            detail::rgba(src, channels, px);
+            std::memcpy(dst, px, 3);
+        }
+    }
+    return out;
+}
+
+// PAM (P7), the rows exactly as they are in memory, alpha included.
+inline std::vector<uint8_t> encode_pam(image const& image, bool flip = false) {
+    if (!detail::supported(image)) return {};
+    const auto width = image.get_width(), height = image.get_height();
+    const auto channels = image.get_channels();
+    const auto pitch = size_t(width) * channels;
+    char const* tuple_types[] = {"GRAYSCALE", "GRAYSCALE_ALPHA", "RGB",
+                                 "RGB_ALPHA"};
+    std::vector<uint8_t> out;
+    detail::put_text(out, "P7\nWIDTH " + std::to_string(width) + "\nHEIGHT " +
+                              std::to_string(height) + "\nDEPTH " +
+                              std::to_string(channels) + "\nMAXVAL 255\n" +
+                              "TUPLTYPE " + tuple_types[channels - 1] +
+                              "\nENDHDR\n");
+    const auto start = out.size();
+    out.resize(start + pitch * height);
+    for (int32_t y = 0; y < height; y++)
+        std::memcpy(out.data() + start + pitch * y,
+                    detail::source_row(image, y, flip), pitch);
+    return out;
+}
+
+// QOI, "The Quite OK Image Format": runs, a 64 entry colour cache and
+// small deltas, a single pass at several hundred megabytes a second.
+inline std::vector<uint8_t> encode_qoi(image const& image, bool flip = false) {
+    if (!detail::supported(image)) return {};
+    const auto width = image.get_width(), height = image.get_height();
+    const auto channels = image.get_channels();
+    std::vector<uint8_t> out;
+    const bool alpha = channels == 2 || channels == 4;
+    out.reserve(14 + size_t(width) * height * (alpha ? 5 : 4) + 8);
+    detail::put_text(out, "qoif");
+    detail::put_be32(out, uint32_t(width));
+    detail::put_be32(out, uint32_t(height));
+    out.push_back(uint8_t(alpha ? 4 : 3));
+    out.push_back(0);
+
+    uint32_t index[64] = {};
+    uint8_t pr = 0, pg = 0, pb = 0, pa = 255;
+    uint32_t previous = 0xff000000u;
+    uint32_t run = 0;
+    for (int32_t y = 0; y < height; y++) {
+        auto const* src = detail::source_row(image, y, flip);
+        for (int32_t x = 0; x < width; x++, src += channels) {
+            uint8_t px4[4];
+            detail::rgba(src, channels, px4);
+            const uint8_t r = px4[0], g = px4[1], b = px4[2], a = px4[3];
+            const uint32_t px = r | g << 8 | b << 16 | uint32_t(a) << 24;
+            if (px == previous) {
+                if (++run == 62) {
+                    out.push_back(uint8_t(0xc0 | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back(uint8_t(0xc0 | (run - 1)));
+                run = 0;
+            }
+            const auto slot = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+            if (index[slot] == px) {
+                out.push_back(uint8_t(slot));
+            } else {
+                index[slot] = px;
+                if (a == pa) {
+                    const auto dr = int8_t(r - pr), dg = int8_t(g - pg),
+                               db = int8_t(b - pb);
+                    const auto dr_dg = int8_t(dr - dg), db_dg = int8_t(db - dg);
+                    if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 &&
+                        db < 2) {
+                        out.push_back(uint8_t(0x40 | (dr + 2) << 4 |
+                                              (dg + 2) << 2 | (db + 2)));
+                    } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 &&
+                               db_dg > -9 && db_dg < 8) {
+                        out.push_back(uint8_t(0x80 | (dg + 32)));
+                        out.push_back(uint8_t((dr_dg + 8) << 4 | (db_dg + 8)));
+                    } else {
+                        const uint8_t op[4] = {0xfe, r, g, b};
+                        out.insert(out.end(), op, op + 4);
+                    }
+                } else {
+                    const uint8_t op[5] = {0xff, r, g, b, a};
+                    out.insert(out.end(), op, op + 5);
+                }
+            }
+            pr = r, pg = g, pb = b, pa = a;
+            previous = px;
+        }
+    }
+    if (run > 0) out.push_back(uint8_t(0xc0 | (run - 1)));
+    const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.insert(out.end(), end, end + 8);
+    return out;
+}
+
+// Uncompressed true colour TGA. TGA stores rows bottom first by default,
+// so flip only changes the origin flag in the header.
+inline std::vector<uint8_t> encode_tga(image const& image, bool flip = false) {
+    if (!detail::supported(image)) return {};
+    const auto width = image.get_width(), height = image.get_height();
+    const auto channels = image.get_channels();
+    const int32_t depth = channels == 2 || channels == 4 ? 4 : 3;
+    const auto pitch = size_t(width) * depth;
+    std::vector<uint8_t> out(18 + pitch * height);
+    auto* h = out.data();
+    h[2] = 2;
+    h[12] = uint8_t(width), h[13] = uint8_t(width >> 8);
+    h[14] = uint8_t(height), h[15] = uint8_t(height >> 8);
+    h[16] = uint8_t(depth * 8);
+    h[17] = uint8_t((depth == 4 ? 8 : 0) | (flip ? 0 : 0x20));
+    auto* dst = out.data() + 18;
+    for (int32_t y = 0; y < height; y++) {
+        auto const* src = image.row(y);
+        if (channels == depth) {
+            std::memcpy(dst, src, pitch);
+            for (size_t i = 0; i < pitch; i += depth)
+                std::swap(dst[i], dst[i + 2]);
+        } else {
+            uint8_t px[4];
+            for (int32_t x = 0; x < width; x++, src += channels) {
+                detail::rgba(src, channels, px);
+                std::swap(px[0], px[2]);
+                std::memcpy(dst + size_t(x) * depth, px, size_t(depth));
+            }
+        }
+        dst += pitch;
+    }
+    return out;
+}
+
+inline std::vector<uint8_t> encode(image const& image, format f,
+                                   bool flip = false,
+                                   scheduler* pool = nullptr) {
+    switch (f) {
+        case format::ppm: return encode_ppm(image, flip);
+        case format::pam: return encode_pam(image, flip);
+        case format::qoi: return encode_qoi(image, flip);
+        case format::tga: return encode_tga(image, flip);
+        default: return encode_png(image, flip, pool);
+    }
+}
+
+// Nothing to write, as encode() gives for an image it cannot store, fails.
+inline bool save(std::string const& filename, std::vector<uint8_t> const& bytes) {
+    if (bytes.empty()) return false;
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) return false;
+    const bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// Encodes image in the format of filename's extension and writes it.
+inline bool write(image const& image, std::string const& filename,
+                  bool flip = false, scheduler* pool = nullptr) {
+    return save(filename, encode(image, format_of(filename), flip, pool));
+}
+
+// Encodes and writes finished frames on a thread of its own, so the render
+// loop can go on to the next frame. Frames are encoded one at a time in
+// the order queued, each PNG deflated over a pool of threads. At most
+// capacity frames wait; write() blocks beyond that, so a loop that renders
+// faster than it encodes is held back instead of piling up frames.
+class async_writer {
+   public:
+    async_writer(uint32_t threads = std::thread::hardware_concurrency(),
+                 size_t capacity = 2)
+        : m_pool(threads), m_capacity(std::max<size_t>(1, capacity)),
+          m_busy(false), m_stop(false), m_written(0), m_failed(0) {
+        m_thread = std::thread([this] { run(); });
+    }
+    ~async_writer() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    }
+    async_writer(async_writer const&) = delete;
+    async_writer& operator=(async_writer const&) = delete;
+
+   public:
+    // Takes the frame's buffer; the caller renders the next one into
+    // another image.
+    void write(image&& frame, std::string filename, bool flip = false) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space.wait(lock, [this] { return m_queue.size() < m_capacity; });
+        m_queue.push_back({std::move(frame), std::move(filename), flip});
+        m_wake.notify_all();
+    }
+
+    // Copies the frame, for callers that keep drawing into one image.
+    void write(image const& frame, std::string filename, bool flip = false) {
+        write(frame.clone(), std::move(filename), flip);
+    }
+
+    // Blocks until every queued frame is on disk.
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+    }
+
+    uint64_t written() const { return m_written.load(); }
+    uint64_t failed() const { return m_failed.load(); }
+
+   private:
+    struct job {
+        image frame;
+        std::string filename;
+        bool flip;
+    };
+
+    void run() {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty()) return;
+            auto next = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy = true;
+            lock.unlock();
+            m_space.notify_all();
+
+            const bool ok =
+                codec::write(next.frame, next.filename, next.flip, &m_pool);
+            (ok ? m_written : m_failed)++;
+
+            lock.lock();
+            m_busy = false;
+            lock.unlock();
+            m_space.notify_all();
+        }
+    }
+
+   private:
+    scheduler m_pool;
+    size_t m_capacity;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_space;
+    std::deque<job> m_queue;
+    bool m_busy;
+    bool m_stop;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_failed;
+    std::thread m_thread;
+};
+
+}  // namespace codec
+
+}  // namespace tiny
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "tiny.hpp"
+#include "tiny/matrix.hpp"
+#include "tiny/raster.hpp"
+#include "tiny/vertex.hpp"
+
+namespace tiny {
+
+// Work dropped before rasterization: whole meshes whose bounding sphere
+// misses the view volume, then per screen space triangle the ones reaching
+// behind the eye, the backfaces, the degenerate ones and the ones
+// trivially outside the viewport, with the rest clipped to the guard band
+// when they reach past it.
+//
+// There is no near plane clipping in clip space. A triangle with a vertex
+// at or behind the eye (see vertex::near_w) is dropped whole, however much
+// of it is in front; one in front of the eye but crossing the near plane
+// is drawn unclipped, its nearer part with depth below 0.
+namespace cull {
+
+// What each test removed. triangles counts everything submitted,
+// including the faces of culled meshes; pieces what was handed on, which
+// clipping can make more than the triangles that survived.
+struct stats {
+    uint64_t meshes        = 0;
+    uint64_t meshes_culled = 0;
+    uint64_t triangles     = 0;
+    uint64_t mesh          = 0;
+    uint64_t near_plane    = 0;
+    uint64_t backface      = 0;
+    uint64_t degenerate    = 0;
+    uint64_t frustum       = 0;
+    uint64_t clipped       = 0;
+    uint64_t pieces        = 0;
+
+    stats& operator+=(stats const& rhs) {
+        meshes        += rhs.meshes;
+        meshes_culled += rhs.meshes_culled;
+        triangles     += rhs.triangles;
+        mesh          += rhs.mesh;
+        near_plane    += rhs.near_plane;
+        backface      += rhs.backface;
+        degenerate    += rhs.degenerate;
+        frustum       += rhs.frustum;
+        clipped       += rhs.clipped;
+        pieces        += rhs.pieces;
+        return *this;
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::cull::stats\",";
+        ss << "\"meshes\":"        << meshes        << ",";
+        ss << "\"meshes_culled\":" << meshes_culled << ",";
+        ss << "\"triangles\":"     << triangles     << ",";
+        ss << "\"mesh\":"          << mesh          << ",";
+        ss << "\"near_plane\":"    << near_plane    << ",";
+        ss << "\"backface\":"      << backface      << ",";
+        ss << "\"degenerate\":"    << degenerate    << ",";
+        ss << "\"frustum\":"       << frustum       << ",";
+        ss << "\"clipped\":"       << clipped       << ",";
+        ss << "\"pieces\":"        << pieces;
+        ss << "}";
+        return ss.str();
+    }
+};
+
+struct sphere {
+    vec3<float> center;
+    float radius;
+};
+
+// Sphere around the bounding box of a model, in model space.
+inline sphere bounding_sphere(model const& m) {
+    const auto center = (m.bounds_min() + m.bounds_max()) * .5f;
+    return sphere{center, math::magnitude(m.bounds_max() - center)};
+}
+
+// The six planes of the view volume of a projection * view * model
+// matrix, pulled from its rows, each as (n, d) with n . p + d >= 0
+// inside.
+template <typename T>
+struct frustum {
+    vec4<T> planes[6];
+
+    explicit frustum(mat4<T> const& clip) {
+        auto row = [&clip](int32_t r) {
+            return vec4<T>{clip.m[r][0], clip.m[r][1], clip.m[r][2],
+                           clip.m[r][3]};
+        };
+        for (int32_t axis = 0; axis < 3; axis++) {
+            planes[axis * 2] = row(3) + row(axis);
+            planes[axis * 2 + 1] = row(3) - row(axis);
+        }
+    }
+
+    bool intersects(sphere const& s) const {
+        for (auto const& p : planes) {
+            const T distance = p.x * s.center.x + p.y * s.center.y +
+                               p.z * s.center.z + p.w;
+            const T length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            if (distance < -T(s.radius) * length) return false;
+        }
+        return true;
+    }
+};
+
+// Whether a mesh of faces triangles, bounded by s, can be seen through f.
+template <typename T>
+inline bool mesh(frustum<T> const& f, sphere const& s, int32_t faces,
+                 stats* counters = nullptr) {
+    const bool visible = f.intersects(s);
+    if (counters) {
+        counters->meshes++;
+        if (!visible) {
+            counters->meshes_culled++;
+            counters->triangles += uint64_t(faces);
+            counters->mesh += uint64_t(faces);
+        }
+    }
+    return visible;
+}
+
+// Half the side of the square around the origin inside which the
+// rasterizer's 32 bit edge functions cannot overflow. Triangles within it
+// go through whole and are clipped to the viewport by the rasterizer's
+// scissor; only those reaching past it are clipped here.
+constexpr int32_t guard_band = 8192;
+
+// Clipping a triangle to the four sides of the band gives a polygon of up
+// to 7 vertices, a fan of up to 5 triangles.
+constexpr int32_t max_pieces = 5;
+
+struct piece {
+    std::array<vec2<int32_t>, 3> pts;
+    std::array<float, 3> depth;
+};
+
+namespace detail {
+
+struct clip_vertex {
+    double x, y, z;
+};
+
+// One Sutherland-Hodgman pass: keeps the part of polygon in where
+// axis * sign <= guard_band. Returns the new vertex count.
+inline int32_t clip_side(clip_vertex const* in, int32_t count,
+                         clip_vertex* out, int32_t axis, double sign) {
+    auto distance = [&](clip_vertex const& v) {
+        return double(guard_band) - sign * (axis == 0 ? v.x : v.y);
+    };
+    int32_t n = 0;
+    for (int32_t i = 0; i < count; i++) {
+        auto const& a = in[i];
+        auto const& b = in[(i + 1) % count];
+        const double da = distance(a), db = distance(b);
+        if (da >= 0) out[n++] = a;
+        if ((da >= 0) != (db >= 0)) {
+            const double t = da / (da - db);
+            out[n++] = {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+                        a.z + (b.z - a.z) * t};
+        }
+    }
+    return n;
+}
+
+}  // namespace detail
+
+// Culls one screen space triangle with y up against viewport and writes
+// what is left of it to out: nothing for a triangle with a vertex behind
+// the eye (depth vertex::behind), a backface (clockwise), a
+// degenerate triangle or one wholly outside the viewport or the depth
+// range [0, 1], the triangle itself when it fits in the guard band, and
+// its clipped fan otherwise. Returns the number of pieces. The backface
+// test is the sign of twice the area, with no normal and no square root.
+inline int32_t triangle(std::array<vec2<int32_t>, 3> const& pts,
+                        std::array<float, 3> const& depth,
+                        rect const& viewport,
+                        std::array<piece, max_pieces>& out,
+                        stats* counters = nullptr) {
+    stats ignored;
+    auto& s = counters ? *counters : ignored;
+    s.triangles++;
+
+    // Behind the eye the divide by w mirrors the vertex, and neither the
+    // area's sign nor the outcodes mean anything.
+    if (depth[0] == vertex::behind || depth[1] == vertex::behind ||
+        depth[2] == vertex::behind) {
+        s.near_plane++;
+        return 0;
+    }
+
+    // Doubles hold the products exactly for anything inside the guard
+    // band and keep the sign right well past it.
+    const double x0 = pts[0].x, y0 = pts[0].y;
+    const double area = (pts[1].x - x0) * (pts[2].y - y0) -
+                        (pts[1].y - y0) * (pts[2].x - x0);
+    if (area == 0) {
+        s.degenerate++;
+        return 0;
+    }
+    if (area < 0) {
+        s.backface++;
+        return 0;
+    }
+
+    // Outcodes against the viewport, the depth range and the guard band:
+    // a side all three vertices are out of rejects the triangle.
+    uint32_t all = ~0u, any = 0;
+    for (int32_t i = 0; i < 3; i++) {
+        auto const& p = pts[i];
+        const uint32_t code =
+            (p.x < viewport.x0) << 0 | (p.x >= viewport.x1) << 1 |
+            (p.y < viewport.y0) << 2 | (p.y >= viewport.y1) << 3 |
+            (depth[i] < 0.f) << 4 | (depth[i] > 1.f) << 5 |
+            (p.x < -guard_band || p.x > guard_band ||
+             p.y < -guard_band || p.y > guard_band) << 6;
+        all &= code;
+        any |= code;
+    }
+    if (all & 0x3F) {
+        s.frustum++;
+        return 0;
+    }
+    if (!(any & 0x40)) {
+        out[0] = {pts, depth};
+        s.pieces++;
+        return 1;
+    }
+
+    detail::clip_vertex a[3 + 4], b[3 + 4];
+    for (int32_t i = 0; i < 3; i++)
+        a[i] = {double(pts[i].x), double(pts[i].y), double(depth[i])};
+    int32_t count = 3;
+    count = detail::clip_side(a, count, b, 0, 1);
+    count = detail::clip_side(b, count, a, 0, -1);
+    count = detail::clip_side(a, count, b, 1, 1);
+    count = detail::clip_side(b, count, a, 1, -1);
+    s.clipped++;
+    if (count < 3) return 0;
+
+    auto vertex = [&a](int32_t i) {
+        return vec2<int32_t>{int32_t(std::lround(a[i].x)),
+                             int32_t(std::lround(a[i].y))};
+    };
+    int32_t pieces = 0;
+    for (int32_t i = 1; i + 1 < count; i++)
+        out[pieces++] = {{vertex(0), vertex(i), vertex(i + 1)},
+                         {float(a[0].z), float(a[i].z), float(a[i + 1].z)}};
+    s.pieces += uint64_t(pieces);
+    return pieces;
+}
+
+}  // namespace cull
+
+}  // namespace tiny
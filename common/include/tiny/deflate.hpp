@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace tiny {
+
+// A small deflate (RFC 1951) encoder for the image writers: LZ77 over a
+// hash chain, coded with the fixed Huffman tables. It compresses about as
+// well as stb's encoder, which uses the same tables, but a call can end on
+// a sync flush instead of a final block, so independently compressed
+// pieces of one buffer concatenate into a single valid stream. That is
+// what lets the PNG writer deflate strips of rows in parallel.
+namespace deflate {
+
+constexpr uint32_t window = 32768;
+constexpr uint32_t min_match = 3;
+constexpr uint32_t max_match = 258;
+
+inline uint32_t adler32(uint8_t const* data, size_t size, uint32_t adler = 1) {
+    constexpr uint32_t base = 65521;
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+        // 5552 bytes is the most that cannot overflow b before the modulo.
+        const size_t n = size < 5552 ? size : 5552;
+        for (size_t i = 0; i < n; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= base;
+        b %= base;
+        data += n;
+        size -= n;
+    }
+    return a | (b << 16);
+}
+
+// Checksum of the concatenation of two buffers from the checksums of each
+// and the size of the second, as zlib's adler32_combine.
+inline uint32_t adler32_combine(uint32_t first, uint32_t second,
+                                size_t second_size) {
+    constexpr uint32_t base = 65521;
+    const auto rem = uint32_t(second_size % base);
+    uint32_t a = first & 0xffff;
+    uint32_t b = uint32_t((uint64_t(rem) * a) % base);
+    a += (second & 0xffff) + base - 1;
+    b += (first >> 16) + (second >> 16) + base - rem;
+    if (a >= base) a -= base;
+    if (a >= base) a -= base;
+    if (b >= base * 2) b -= base * 2;
+    if (b >= base) b -= base;
+    return a | (b << 16);
+}
+
+inline uint32_t crc32(uint8_t const* data, size_t size, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int32_t k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+namespace detail {
+
+// Least significant bit first, as deflate packs everything but the
+// Huffman codes themselves.
+class bit_writer {
+   public:
+    bit_writer(std::vector<uint8_t>& out) : m_out(out), m_bits(0), m_count(0) {}
+
+   public:
+    void put(uint32_t value, uint32_t count) {
+        m_bits |= uint64_t(value) << m_count;
+        m_count += count;
+        if (m_count >= 32) {
+            const auto word = uint32_t(m_bits);
+            const uint8_t bytes[4] = {uint8_t(word), uint8_t(word >> 8),
+                                      uint8_t(word >> 16), uint8_t(word >> 24)};
+            m_out.insert(m_out.end(), bytes, bytes + 4);
+            m_bits >>= 32;
+            m_count -= 32;
+        }
+    }
+
+    // Pads with zero bits up to the next byte and flushes everything.
+    void align() {
+        for (; m_count > 0; m_count = m_count > 8 ? m_count - 8 : 0) {
+            m_out.push_back(uint8_t(m_bits));
+            m_bits >>= 8;
+        }
+        m_bits = 0;
+    }
+
+   private:
+    std::vector<uint8_t>& m_out;
+    uint64_t m_bits;
+    uint32_t m_count;
+};
+
+inline uint32_t reverse_bits(uint32_t code, uint32_t length) {
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < length; i++, code >>= 1) out = (out << 1) | (code & 1);
+    return out;
+}
+
+// The fixed Huffman codes, pre-reversed for the bit writer, and the length
+// and distance symbols of every match.
+struct fixed_tables {
+    uint16_t literal_code[288];
+    uint8_t literal_bits[288];
+    uint16_t length_symbol[max_match + 1];
+    uint16_t length_base[29];
+    uint8_t length_extra[29];
+    uint8_t distance_symbol[512];
+    uint16_t distance_code[30];
+    uint16_t distance_base[30];
+    uint8_t distance_extra[30];
+
+    fixed_tables() {
+        for (uint32_t s = 0; s < 288; s++) {
+            uint32_t code, bits;
+            if (s < 144) code = 0x30 + s, bits = 8;
+            else if (s < 256) code = 0x190 + s - 144, bits = 9;
+            else if (s < 280) code = s - 256, bits = 7;
+            else code = 0xc0 + s - 280, bits = 8;
+            literal_code[s] = uint16_t(reverse_bits(code, bits));
+            literal_bits[s] = uint8_t(bits);
+        }
+        uint32_t base = 3;
+        for (uint32_t i = 0; i < 28; i++) {
+            length_extra[i] = uint8_t(i < 8 ? 0 : (i - 4) / 4);
+            length_base[i] = uint16_t(base);
+            for (uint32_t n = 0; n < (1u << length_extra[i]); n++)
+                length_symbol[base + n] = uint16_t(i);
+            base += 1u << length_extra[i];
+        }
+        // 258 has a symbol of its own rather than 227 + 31.
+        length_base[28] = max_match;
+        length_extra[28] = 0;
+        length_symbol[max_match] = 28;
+
+        base = 1;
+        for (uint32_t i = 0; i < 30; i++) {
+            distance_extra[i] = uint8_t(i < 4 ? 0 : (i - 2) / 2);
+            distance_base[i] = uint16_t(base);
+            distance_code[i] = uint16_t(reverse_bits(i, 5));
+            base += 1u << distance_extra[i];
+        }
+        // Distances up to 256 index directly, longer ones by 128 steps.
+        for (uint32_t i = 0, d = 0; d < 256; d++) {
+            while (i + 1 < 30 && distance_base[i + 1] <= d + 1) i++;
+            distance_symbol[d] = uint8_t(i);
+        }
+        for (uint32_t i = 0, d = 256; d < window; d += 128) {
+            while (i + 1 < 30 && distance_base[i + 1] <= d + 1) i++;
+            distance_symbol[256 + (d >> 7)] = uint8_t(i);
+        }
+    }
+
+    uint32_t distance(uint32_t d) const {
+        return d <= 256 ? distance_symbol[d - 1]
+                        : distance_symbol[256 + ((d - 1) >> 7)];
+    }
+};
+
+inline fixed_tables const& tables() {
+    static const fixed_tables t;
+    return t;
+}
+
+inline void stored(uint8_t const* data, size_t size, bool last,
+                   std::vector<uint8_t>& out) {
+    bit_writer bits(out);
+    do {
+        const auto n = uint32_t(size < 65535 ? size : 65535);
+        bits.put(last && n == size ? 1 : 0, 1);
+        bits.put(0, 2);
+        bits.align();
+        const uint8_t lengths[4] = {uint8_t(n), uint8_t(n >> 8), uint8_t(~n),
+                                    uint8_t(~n >> 8)};
+        out.insert(out.end(), lengths, lengths + 4);
+        out.insert(out.end(), data, data + n);
+        data += n;
+        size -= n;
+    } while (size > 0);
+}
+
+}  // namespace detail
+
+// Appends data to out as raw deflate. chain bounds the match candidates
+// tried per position. When last is false the output ends on a byte
+// aligned sync flush and the next call continues the same stream; matches
+// never reach back into earlier calls. Data that does not compress goes
+// out as stored blocks.
+inline void compress(uint8_t const* data, size_t size, bool last,
+                     std::vector<uint8_t>& out, uint32_t chain = 16) {
+    constexpr uint32_t hash_bits = 15;
+    auto const& t = detail::tables();
+    const auto start = out.size();
+    out.reserve(start + size + size / 8 + 64);
+
+    std::vector<int32_t> head(size_t(1) << hash_bits, -1);
+    std::vector<int32_t> prev(window);
+    const auto hash = [&](size_t i) {
+        const uint32_t v = uint32_t(data[i]) | uint32_t(data[i + 1]) << 8 |
+                           uint32_t(data[i + 2]) << 16;
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+    const auto insert = [&](size_t i) {
+        const auto h = hash(i);
+        prev[i & (window - 1)] = head[h];
+        head[h] = int32_t(i);
+    };
+
+    detail::bit_writer bits(out);
+    bits.put(last ? 1 : 0, 1);
+    bits.put(1, 2);
+    size_t i = 0;
+    while (i < size) {
+        uint32_t best = 0, distance = 0;
+        if (i + min_match <= size) {
+            const auto limit = uint32_t(size - i < max_match ? size - i : max_match);
+            int32_t candidate = head[hash(i)];
+            for (uint32_t tries = 0; candidate >= 0 && tries < chain; tries++) {
+                const auto d = uint32_t(i - size_t(candidate));
+                if (d > window - 1) break;
+                uint8_t const* a = data + i;
+                uint8_t const* b = data + candidate;
+                if (b[best] == a[best]) {
+                    uint32_t n = 0;
+                    while (n < limit && a[n] == b[n]) n++;
+                    if (n > best) {
+                        best = n;
+                        distance = d;
+                        if (n == limit) break;
+                    }
+                }
+                const auto next = prev[size_t(candidate) & (window - 1)];
+                if (next >= candidate) break;
+                candidate = next;
+            }
+            insert(i);
+        }
+        if (best >= min_match) {
+            const auto ls = t.length_symbol[best];
+            bits.put(t.literal_code[257 + ls], t.literal_bits[257 + ls]);
+            bits.put(best - t.length_base[ls], t.length_extra[ls]);
+            const auto ds = t.distance(distance);
+            bits.put(t.distance_code[ds], 5);
+            bits.put(distance - t.distance_base[ds], t.distance_extra[ds]);
+            const auto end = i + best;
+            for (i++; i < end; i++)
+                if (i + min_match <= size) insert(i);
+        } else {
+            bits.put(t.literal_code[data[i]], t.literal_bits[data[i]]);
+            i++;
+        }
+    }
+    bits.put(t.literal_code[256], t.literal_bits[256]);
+    if (!last) {
+        // Sync flush: an empty stored block puts the end on a byte.
+        bits.put(0, 3);
+        bits.align();
+        const uint8_t empty[4] = {0x00, 0x00, 0xff, 0xff};
+        out.insert(out.end(), empty, empty + 4);
+    } else {
+        bits.align();
+    }
+
+    if (out.size() - start > size + size / 65535 * 5 + 5) {
+        out.resize(start);
+        detail::stored(data, size, last, out);
+    }
+}
+
+}  // namespace deflate
+
+}  // namespace tiny
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tiny.hpp"
+#include "tiny/raster.hpp"
+
+namespace tiny {
+
+// Wireframes: the edges of a mesh, each drawn once, as lines clipped to a
+// rectangle before any pixel is stepped. The aliased line is lesson1's
+// Bresenham, pixel for pixel, clipped or not; the anti-aliased one is
+// Wu's, blending two pixels per column into what is already there.
+namespace lines {
+
+enum class mode { aliased, antialiased };
+
+// A mesh edge between two vertex indices, a < b.
+struct edge {
+    uint32_t a, b;
+};
+
+struct stats {
+    uint64_t lines    = 0;
+    uint64_t rejected = 0;
+    uint64_t clipped  = 0;
+    uint64_t pixels   = 0;
+
+    stats& operator+=(stats const& rhs) {
+        lines    += rhs.lines;
+        rejected += rhs.rejected;
+        clipped  += rhs.clipped;
+        pixels   += rhs.pixels;
+        return *this;
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::lines::stats\",";
+        ss << "\"lines\":"    << lines    << ",";
+        ss << "\"rejected\":" << rejected << ",";
+        ss << "\"clipped\":"  << clipped  << ",";
+        ss << "\"pixels\":"   << pixels;
+        ss << "}";
+        return ss.str();
+    }
+};
+
+// Every edge of the triangles of indices once, however many faces share
+// it, sorted by vertex. A closed mesh has about 1.5 edges per face
+// against the 3 lines per face of drawing each triangle's outline.
+inline std::vector<edge> unique_edges(span<uint32_t const> indices) {
+    std::vector<uint64_t> keys;
+    keys.reserve(indices.size());
+    for (size_t i = 0; i + 3 <= indices.size(); i += 3)
+        for (int32_t k = 0; k < 3; k++) {
+            const uint64_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+            if (a != b) keys.push_back(a < b ? a << 32 | b : b << 32 | a);
+        }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<edge> out(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        out[i] = {uint32_t(keys[i] >> 32), uint32_t(keys[i])};
+    return out;
+}
+
+namespace detail {
+
+inline int64_t ceil_div(int64_t n, int64_t d) {
+    return -raster::detail::floor_div(-n, d);
+}
+
+// Blends c over the pixel with weight w in [0, 256].
+template <pixel_format P>
+TINY_INLINE void blend(uint8_t* pixel, uint8_t const* c, int32_t w) {
+    for (int32_t i = 0; i < pixel_traits<P>::channels; i++)
+        pixel[i] = uint8_t((pixel[i] * (256 - w) + c[i] * w + 128) >> 8);
+}
+
+}  // namespace detail
+
+// Draws the line from a to b, both ends included, into the pixels of clip,
+// which lies within view. Returns the number of pixels written.
+//
+// The Bresenham walk makes the minor coordinate of step i of the major
+// axis y0 + ceil((2 dy i - dx) / (2 dx)), so both clips are solved in
+// integers: the major range directly, the minor range by inverting that
+// step. The walk then starts inside the rectangle with its error term
+// where the unclipped walk would have it, and writes exactly the pixels of
+// the unclipped line that fall in clip, with no test per pixel. Steep and
+// shallow lines share the loop with their strides swapped.
+template <pixel_format P>
+int64_t line(vec2<int32_t> a, vec2<int32_t> b, rect const& clip,
+             image_view<P> const& view, color const& c,
+             stats* counters = nullptr) {
+    stats ignored;
+    auto& s = counters ? *counters : ignored;
+    s.lines++;
+    // Cohen-Sutherland outcodes: both ends beyond one side rejects.
+    auto outcode = [&clip](vec2<int32_t> p) {
+        return (p.x < clip.x0) << 0 | (p.x >= clip.x1) << 1 |
+               (p.y < clip.y0) << 2 | (p.y >= clip.y1) << 3;
+    };
+    const auto code_a = outcode(a), code_b = outcode(b);
+    if (code_a & code_b || clip.empty()) {
+        s.rejected++;
+        return 0;
+    }
+
+    int32_t lo = clip.x0, hi = clip.x1 - 1;
+    int32_t minor_lo = clip.y0, minor_hi = clip.y1 - 1;
+    const bool steep = std::abs(a.x - b.x) < std::abs(a.y - b.y);
+    if (steep) {
+        std::swap(a.x, a.y);
+        std::swap(b.x, b.y);
+        std::swap(lo, minor_lo);
+        std::swap(hi, minor_hi);
+    }
+    if (a.x > b.x) std::swap(a, b);
+    const int64_t dx = int64_t(b.x) - a.x;
+    const int64_t dy = std::abs(int64_t(b.y) - a.y);
+    const int32_t sy = b.y > a.y ? 1 : -1;
+
+    int64_t i0 = std::max<int64_t>(0, int64_t(lo) - a.x);
+    int64_t i1 = std::min<int64_t>(dx, int64_t(hi) - a.x);
+    if (dy == 0) {
+        if (a.y < minor_lo || a.y > minor_hi) i1 = -1;
+    } else {
+        // The steps k taken along the minor axis that stay inside.
+        const int64_t k_lo = sy > 0 ? int64_t(minor_lo) - a.y
+                                    : int64_t(a.y) - minor_hi;
+        const int64_t k_hi = sy > 0 ? int64_t(minor_hi) - a.y
+                                    : int64_t(a.y) - minor_lo;
+        if (k_lo > 0)
+            i0 = std::max(i0, raster::detail::floor_div(
+                                  2 * dx * (k_lo - 1) + dx, 2 * dy) + 1);
+        i1 = std::min(i1, k_hi < 0 ? -1
+                                   : raster::detail::floor_div(
+                                         2 * dx * k_hi + dx, 2 * dy));
+    }
+    if (i0 > i1) {
+        s.rejected++;
+        return 0;
+    }
+    if (code_a | code_b) s.clipped++;
+
+    const int64_t k = i0 == 0 ? 0 : detail::ceil_div(2 * dy * i0 - dx, 2 * dx);
+    int64_t error2 = 2 * dy * i0 - 2 * dx * k;
+    const auto x = int32_t(a.x + i0), y = int32_t(a.y + sy * k);
+    uint8_t* pixel = steep ? view.pixel(y, x) : view.pixel(x, y);
+    const auto channels = ptrdiff_t(pixel_traits<P>::channels);
+    const auto pitch = ptrdiff_t(view.get_pitch());
+    const ptrdiff_t major = steep ? pitch : channels;
+    const ptrdiff_t minor = (steep ? channels : pitch) * sy;
+    for (int64_t i = i0; i <= i1; i++) {
+        pixel_traits<P>::store(pixel, c);
+        pixel += major;
+        error2 += 2 * dy;
+        if (error2 > dx) {
+            pixel += minor;
+            error2 -= 2 * dx;
+        }
+    }
+    s.pixels += uint64_t(i1 - i0 + 1);
+    return i1 - i0 + 1;
+}
+
+// Wu's anti-aliased line from a to b, clipped to the pixel centres of clip
+// by Liang-Barsky. Each step of the major axis splits full coverage
+// between the two pixels the line passes between, by its distance to
+// them, and blends c into them. Returns the number of columns stepped.
+template <pixel_format P>
+int64_t line_aa(vec2<float> a, vec2<float> b, rect const& clip,
+                image_view<P> const& view, color const& c,
+                stats* counters = nullptr) {
+    stats ignored;
+    auto& s = counters ? *counters : ignored;
+    s.lines++;
+    const float lo[2] = {float(clip.x0), float(clip.y0)};
+    const float hi[2] = {float(clip.x1 - 1), float(clip.y1 - 1)};
+    const float from[2] = {a.x, a.y}, delta[2] = {b.x - a.x, b.y - a.y};
+    float t0 = 0.f, t1 = 1.f;
+    for (int32_t axis = 0; axis < 2 && t0 <= t1; axis++) {
+        if (delta[axis] == 0.f) {
+            if (from[axis] < lo[axis] || from[axis] > hi[axis]) t0 = 2.f;
+            continue;
+        }
+        float enter = (lo[axis] - from[axis]) / delta[axis];
+        float leave = (hi[axis] - from[axis]) / delta[axis];
+        if (enter > leave) std::swap(enter, leave);
+        t0 = std::max(t0, enter);
+        t1 = std::min(t1, leave);
+    }
+    if (clip.empty() || t0 > t1) {
+        s.rejected++;
+        return 0;
+    }
+    if (t0 > 0.f || t1 < 1.f) s.clipped++;
+    b = {a.x + delta[0] * t1, a.y + delta[1] * t1};
+    a = {a.x + delta[0] * t0, a.y + delta[1] * t0};
+
+    int32_t minor_lo = clip.y0, minor_hi = clip.y1 - 1;
+    const bool steep = std::abs(b.y - a.y) > std::abs(b.x - a.x);
+    if (steep) {
+        std::swap(a.x, a.y);
+        std::swap(b.x, b.y);
+        minor_lo = clip.x0;
+        minor_hi = clip.x1 - 1;
+    }
+    if (a.x > b.x) std::swap(a, b);
+    const float gradient = b.x > a.x ? (b.y - a.y) / (b.x - a.x) : 0.f;
+    const uint8_t bytes[4] = {c.get_red(), c.get_green(), c.get_blue(),
+                              c.get_alpha()};
+    const auto x0 = int32_t(std::lround(a.x)), x1 = int32_t(std::lround(b.x));
+    auto plot = [&](int32_t major, int32_t minor, int32_t w) {
+        if (minor < minor_lo || minor > minor_hi) return;
+        detail::blend<P>(steep ? view.pixel(minor, major)
+                               : view.pixel(major, minor),
+                         bytes, w);
+    };
+    for (int32_t x = x0; x <= x1; x++) {
+        const float y = a.y + gradient * (float(x) - a.x);
+        const float floor = std::floor(y);
+        const auto w = int32_t((y - floor) * 256.f);
+        plot(x, int32_t(floor), 256 - w);
+        if (w > 0) plot(x, int32_t(floor) + 1, w);
+    }
+    const int64_t columns = x1 >= x0 ? x1 - x0 + 1 : 0;
+    s.pixels += uint64_t(columns);
+    return columns;
+}
+
+// Draws every edge between the screen positions pts it indexes, clipped to
+// clip, which lies within view. A batch of edges goes through one view and
+// one pixel format dispatch.
+template <pixel_format P>
+void draw(span<edge const> edges, span<vec2<int32_t> const> pts,
+          rect const& clip, image_view<P> const& view, color const& c,
+          mode m = mode::aliased, stats* counters = nullptr) {
+    if (m == mode::aliased) {
+        for (auto const& e : edges) line(pts[e.a], pts[e.b], clip, view, c,
+                                         counters);
+        return;
+    }
+    for (auto const& e : edges) {
+        auto const& a = pts[e.a];
+        auto const& b = pts[e.b];
+        line_aa(vec2<float>{float(a.x), float(a.y)},
+                vec2<float>{float(b.x), float(b.y)}, clip, view, c,
+                counters);
+    }
+}
+
+inline void draw(span<edge const> edges, span<vec2<int32_t> const> pts,
+                 rect clip, image& image, color const& c,
+                 mode m = mode::aliased, stats* counters = nullptr) {
+    clip.x0 = std::max(clip.x0, 0);
+    clip.y0 = std::max(clip.y0, 0);
+    clip.x1 = std::min(clip.x1, image.get_width());
+    clip.y1 = std::min(clip.y1, image.get_height());
+    image.visit([&](auto view) {
+        draw(edges, pts, clip, view, c, m, counters);
+    });
+}
+
+}  // namespace lines
+
+}  // namespace tiny
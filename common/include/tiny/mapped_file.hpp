@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tiny {
+
+// Read-only memory mapping of a whole file. is_open() is false when the
+// file cannot be opened or mapped; an empty file opens with size() 0.
+class mapped_file {
+   public:
+    mapped_file() : m_data(nullptr), m_size(0), m_open(false) {}
+    mapped_file(std::string const& filename) : mapped_file() {
+        open(filename);
+    }
+    ~mapped_file() { close(); }
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+    mapped_file(mapped_file&& other) noexcept : mapped_file() {
+        swap(other);
+    }
+    mapped_file& operator=(mapped_file&& other) noexcept {
+        if (this != &other) {
+            close();
+            swap(other);
+        }
+        return *this;
+    }
+
+   public:
+    bool open(std::string const& filename) {
+        close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ,
+                                  FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            return false;
+        }
+        m_size = size_t(size.QuadPart);
+        if (m_size > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY,
+                                                0, 0, nullptr);
+            if (mapping) {
+                m_data = static_cast<char const*>(
+                    MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        m_size = size_t(info.st_size);
+        if (m_size > 0) {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, m_size, MADV_SEQUENTIAL);
+                m_data = static_cast<char const*>(data);
+            }
+        }
+        ::close(fd);
+#endif
+        if (m_size > 0 && !m_data) {
+            m_size = 0;
+            return false;
+        }
+        m_open = true;
+        return true;
+    }
+
+    void close() {
+        if (m_data) {
+#if defined(_WIN32)
+            UnmapViewOfFile(m_data);
+#else
+            munmap(const_cast<char*>(m_data), m_size);
+#endif
+        }
+        m_data = nullptr;
+        m_size = 0;
+        m_open = false;
+    }
+
+    bool is_open() const { return m_open; }
+    char const* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+   private:
+    void swap(mapped_file& other) {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_open, other.m_open);
+    }
+
+   private:
+    char const* m_data;
+    size_t m_size;
+    bool m_open;
+};
+
+}  // namespace tiny
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "tiny.hpp"
+
+namespace tiny {
+
+// Square row-major matrix acting on column vectors: m * v transforms v,
+// and a * b applies b first. T is float or double. Everything but the
+// rotations and look_at, which need sin, cos and sqrt, is constexpr.
+template <typename T, int32_t N>
+struct mat {
+    T m[N][N];
+
+    static constexpr mat identity() {
+        mat out{};
+        for (int32_t i = 0; i < N; i++) out.m[i][i] = T(1);
+        return out;
+    }
+
+    constexpr T* operator[](int32_t row) { return m[row]; }
+    constexpr T const* operator[](int32_t row) const { return m[row]; }
+
+    template <typename U>
+    constexpr mat<U, N> cast() const {
+        mat<U, N> out{};
+        for (int32_t r = 0; r < N; r++)
+            for (int32_t c = 0; c < N; c++) out.m[r][c] = U(m[r][c]);
+        return out;
+    }
+
+    constexpr mat operator*(mat const& rhs) const {
+        mat out{};
+        for (int32_t r = 0; r < N; r++)
+            for (int32_t c = 0; c < N; c++)
+                for (int32_t k = 0; k < N; k++)
+                    out.m[r][c] += m[r][k] * rhs.m[k][c];
+        return out;
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "[";
+        for (int32_t r = 0; r < N; r++) {
+            ss << (r ? ",[" : "[");
+            for (int32_t c = 0; c < N; c++) ss << (c ? "," : "") << m[r][c];
+            ss << "]";
+        }
+        ss << "]";
+        return ss.str();
+    }
+};
+
+template <typename T>
+using mat3 = mat<T, 3>;
+template <typename T>
+using mat4 = mat<T, 4>;
+
+template <typename T>
+constexpr vec3<T> operator*(mat3<T> const& a, vec3<T> const& v) {
+    return vec3<T>{
+        a.m[0][0] * v.x + a.m[0][1] * v.y + a.m[0][2] * v.z,
+        a.m[1][0] * v.x + a.m[1][1] * v.y + a.m[1][2] * v.z,
+        a.m[2][0] * v.x + a.m[2][1] * v.y + a.m[2][2] * v.z,
+    };
+}
+
+template <typename T>
+constexpr vec4<T> operator*(mat4<T> const& a, vec4<T> const& v) {
+    auto row = [&](int32_t r) {
+        return a.m[r][0] * v.x + a.m[r][1] * v.y + a.m[r][2] * v.z +
+               a.m[r][3] * v.w;
+    };
+    return vec4<T>{row(0), row(1), row(2), row(3)};
+}
+
+namespace math {
+
+template <typename T, int32_t N>
+constexpr mat<T, N> transpose(mat<T, N> const& a) {
+    mat<T, N> out{};
+    for (int32_t r = 0; r < N; r++)
+        for (int32_t c = 0; c < N; c++) out.m[r][c] = a.m[c][r];
+    return out;
+}
+
+// The upper left 3x3 of a, its rotation and scale.
+template <typename T>
+constexpr mat3<T> linear(mat4<T> const& a) {
+    mat3<T> out{};
+    for (int32_t r = 0; r < 3; r++)
+        for (int32_t c = 0; c < 3; c++) out.m[r][c] = a.m[r][c];
+    return out;
+}
+
+// Inverse by the adjugate; a singular matrix gives the zero matrix.
+template <typename T>
+constexpr mat3<T> inverse(mat3<T> const& a) {
+    auto const& m = a.m;
+    mat3<T> out{};
+    out.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    out.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    out.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    out.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    out.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    out.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    out.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    out.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    out.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    const T det = m[0][0] * out.m[0][0] + m[0][1] * out.m[1][0] +
+                  m[0][2] * out.m[2][0];
+    const T scale = det != T(0) ? T(1) / det : T(0);
+    for (auto& row : out.m)
+        for (auto& v : row) v *= scale;
+    return out;
+}
+
+// Transforms normals of a model whose model-view matrix is a.
+template <typename T>
+constexpr mat3<T> normal_matrix(mat4<T> const& a) {
+    return transpose(inverse(linear(a)));
+}
+
+template <typename T>
+constexpr mat4<T> translate(vec3<T> const& t) {
+    auto out = mat4<T>::identity();
+    out.m[0][3] = t.x;
+    out.m[1][3] = t.y;
+    out.m[2][3] = t.z;
+    return out;
+}
+
+template <typename T>
+constexpr mat4<T> scale(vec3<T> const& s) {
+    auto out = mat4<T>::identity();
+    out.m[0][0] = s.x;
+    out.m[1][1] = s.y;
+    out.m[2][2] = s.z;
+    return out;
+}
+
+// Counter-clockwise by radians about the unit vector axis.
+template <typename T>
+mat4<T> rotate(vec3<T> const& axis, T radians) {
+    const T c = std::cos(radians), s = std::sin(radians), t = T(1) - c;
+    const T x = axis.x, y = axis.y, z = axis.z;
+    auto out = mat4<T>::identity();
+    out.m[0][0] = t * x * x + c;
+    out.m[0][1] = t * x * y - s * z;
+    out.m[0][2] = t * x * z + s * y;
+    out.m[1][0] = t * x * y + s * z;
+    out.m[1][1] = t * y * y + c;
+    out.m[1][2] = t * y * z - s * x;
+    out.m[2][0] = t * x * z - s * y;
+    out.m[2][1] = t * y * z + s * x;
+    out.m[2][2] = t * z * z + c;
+    return out;
+}
+
+// View matrix of a camera at eye looking at center, the OpenGL way: the
+// camera looks down its -z with y up.
+template <typename T>
+mat4<T> look_at(vec3<T> const& eye, vec3<T> const& center,
+                vec3<T> const& up) {
+    const auto z = normalise(eye - center);
+    const auto x = normalise(cross(up, z));
+    const auto y = cross(z, x);
+    auto out = mat4<T>::identity();
+    for (int32_t c = 0; c < 3; c++) {
+        out.m[0][c] = x.raw[c];
+        out.m[1][c] = y.raw[c];
+        out.m[2][c] = z.raw[c];
+    }
+    out.m[0][3] = -dot(x, eye);
+    out.m[1][3] = -dot(y, eye);
+    out.m[2][3] = -dot(z, eye);
+    return out;
+}
+
+// Maps the box [left, right] x [bottom, top] x [-z_near, -z_far] of view space
+// to the [-1, 1] cube, z_near to -1.
+template <typename T>
+constexpr mat4<T> orthographic(T left, T right, T bottom, T top, T z_near, T z_far) {
+    auto out = mat4<T>::identity();
+    out.m[0][0] = T(2) / (right - left);
+    out.m[1][1] = T(2) / (top - bottom);
+    out.m[2][2] = -T(2) / (z_far - z_near);
+    out.m[0][3] = -(right + left) / (right - left);
+    out.m[1][3] = -(top + bottom) / (top - bottom);
+    out.m[2][3] = -(z_far + z_near) / (z_far - z_near);
+    return out;
+}
+
+// Perspective projection with a vertical field of view of fovy radians;
+// z_near maps to -1 and z_far to 1 after the divide by w.
+template <typename T>
+mat4<T> perspective(T fovy, T aspect, T z_near, T z_far) {
+    const T f = T(1) / std::tan(fovy / T(2));
+    mat4<T> out{};
+    out.m[0][0] = f / aspect;
+    out.m[1][1] = f;
+    out.m[2][2] = (z_far + z_near) / (z_near - z_far);
+    out.m[2][3] = T(2) * z_far * z_near / (z_near - z_far);
+    out.m[3][2] = T(-1);
+    return out;
+}
+
+// Maps the [-1, 1] cube to the pixels [x, x + width) x [y, y + height) and
+// depth [0, 1], near at 0 as the depth buffer wants it.
+template <typename T>
+constexpr mat4<T> viewport(T x, T y, T width, T height) {
+    auto out = mat4<T>::identity();
+    out.m[0][0] = width / T(2);
+    out.m[1][1] = height / T(2);
+    out.m[2][2] = T(.5);
+    out.m[0][3] = x + width / T(2);
+    out.m[1][3] = y + height / T(2);
+    out.m[2][3] = T(.5);
+    return out;
+}
+
+}  // namespace math
+
+}  // namespace tiny
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace tiny {
+
+// Aligned heap blocks for frame buffers and arenas, and a process wide
+// count of heap allocations so a frame loop can check it stays at zero.
+//
+// The count always covers tiny's own blocks. Define TINY_MEMORY_COUNT_NEW
+// in exactly one translation unit, before including this header, to
+// replace the global operator new as well, so that every std::vector and
+// std::function allocation is counted too, nothrow new included. The
+// aligned forms of new (C++17 align_val_t) are left to the library and
+// not counted.
+namespace memory {
+
+constexpr size_t alignment = 64;
+
+namespace detail {
+
+inline std::atomic<uint64_t>& allocations() {
+    static std::atomic<uint64_t> count(0);
+    return count;
+}
+
+}  // namespace detail
+
+// Heap allocations since the start of the process. Take the difference
+// around a frame for its count.
+inline uint64_t allocation_count() {
+    return detail::allocations().load(std::memory_order_relaxed);
+}
+
+inline void count_allocation() {
+    detail::allocations().fetch_add(1, std::memory_order_relaxed);
+}
+
+// bytes rounded up to the alignment, which aligned_alloc requires.
+inline void* allocate(size_t bytes, size_t align = alignment) {
+    count_allocation();
+    bytes = (bytes + align - 1) / align * align;
+    if (bytes == 0) bytes = align;
+#if defined(_WIN32)
+    void* p = _aligned_malloc(bytes, align);
+#else
+    void* p = std::aligned_alloc(align, bytes);
+#endif
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+inline void release(void* p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+// The most memory the process has had resident at once, in bytes: what
+// it needed of the machine's RAM, mapped files included, as opposed to
+// what it allocated. 0 where the system does not say.
+inline uint64_t peak_resident_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                                 sizeof(counters)))
+        return 0;
+    return uint64_t(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return uint64_t(usage.ru_maxrss);
+#else
+    return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+}  // namespace memory
+
+}  // namespace tiny
+
+#if defined(TINY_MEMORY_COUNT_NEW)
+namespace tiny {
+namespace memory {
+namespace detail {
+
+// The replacements below go through these rather than straight to malloc
+// and free: GCC sees a free() of what operator new returned otherwise and
+// warns of a mismatched pair (-Wmismatched-new-delete) at every delete.
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#elif defined(_MSC_VER)
+__declspec(noinline)
+#endif
+inline void* counted_malloc(std::size_t size) noexcept {
+    count_allocation();
+    return std::malloc(size ? size : 1);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#elif defined(_MSC_VER)
+__declspec(noinline)
+#endif
+inline void counted_free(void* p) noexcept {
+    std::free(p);
+}
+
+}  // namespace detail
+}  // namespace memory
+}  // namespace tiny
+
+void* operator new(std::size_t size) {
+    if (void* p = tiny::memory::detail::counted_malloc(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+    if (void* p = tiny::memory::detail::counted_malloc(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+    return tiny::memory::detail::counted_malloc(size);
+}
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept {
+    return tiny::memory::detail::counted_malloc(size);
+}
+void operator delete(void* p) noexcept {
+    tiny::memory::detail::counted_free(p);
+}
+void operator delete[](void* p) noexcept {
+    tiny::memory::detail::counted_free(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+    tiny::memory::detail::counted_free(p);
+}
+void operator delete[](void* p, std::size_t) noexcept {
+    tiny::memory::detail::counted_free(p);
+}
+void operator delete(void* p, std::nothrow_t const&) noexcept {
+    tiny::memory::detail::counted_free(p);
+}
+void operator delete[](void* p, std::nothrow_t const&) noexcept {
+    tiny::memory::detail::counted_free(p);
+}
+#endif
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "tiny/mapped_file.hpp"
+
+namespace tiny {
+
+// Binary sidecar of a parsed model, written next to the source as
+// <source>.tmesh and mapped straight back in on later loads.
+//
+// Layout: a header, then one stream per entry of the header's table, each
+// starting on a 64 byte boundary. The header records the source size and
+// modification time; a sidecar whose stamp, magic, version or byte order
+// does not match is ignored and rewritten.
+namespace mesh_cache {
+
+constexpr char magic[8] = {'t', 'i', 'n', 'y', 'm', 'e', 's', 'h'};
+constexpr uint32_t version = 2;
+constexpr uint32_t byte_order = 0x01020304;
+constexpr uint64_t alignment = 64;
+
+inline std::string path(std::string const& source) { return source + ".tmesh"; }
+
+// Size and modification time of a file, the key of its sidecar.
+struct stamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    bool operator==(stamp const& rhs) const {
+        return size == rhs.size && mtime == rhs.mtime;
+    }
+};
+
+inline bool file_stamp(std::string const& filename, stamp& out) {
+#if defined(_WIN32)
+    struct _stat64 info;
+    if (_stat64(filename.c_str(), &info) != 0) return false;
+    out.mtime = int64_t(info.st_mtime) * 1000000000;
+#else
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) return false;
+#if defined(__APPLE__)
+    out.mtime = int64_t(info.st_mtimespec.tv_sec) * 1000000000 +
+                info.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    out.mtime = int64_t(info.st_mtim.tv_sec) * 1000000000 +
+                info.st_mtim.tv_nsec;
+#else
+    out.mtime = int64_t(info.st_mtime) * 1000000000;
+#endif
+#endif
+    out.size = uint64_t(info.st_size);
+    return true;
+}
+
+enum stream : uint32_t { positions, uvs, normals, indices, nstreams };
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t source_size;
+    int64_t source_mtime;
+    float bounds_min[3];
+    float bounds_max[3];
+    // Element count, element size and byte offset of every stream.
+    uint64_t count[nstreams];
+    uint64_t stride[nstreams];
+    uint64_t offset[nstreams];
+};
+
+// Where a stream's elements come from when writing.
+struct source_stream {
+    void const* data;
+    uint64_t count;
+    uint64_t stride;
+};
+
+inline uint64_t align(uint64_t offset) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Writes the sidecar through a temporary file renamed over the old one,
+// so concurrent loaders never map a half written blob. Returns false when
+// the directory is not writable, which only costs the next load a parse.
+inline bool write(std::string const& filename, stamp const& key,
+                  source_stream const (&streams)[nstreams],
+                  float const (&bounds_min)[3], float const (&bounds_max)[3]) {
+    header h{};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.byte_order = byte_order;
+    h.source_size = key.size;
+    h.source_mtime = key.mtime;
+    std::memcpy(h.bounds_min, bounds_min, sizeof(h.bounds_min));
+    std::memcpy(h.bounds_max, bounds_max, sizeof(h.bounds_max));
+    uint64_t offset = align(sizeof(header));
+    for (uint32_t i = 0; i < nstreams; i++) {
+        h.count[i] = streams[i].count;
+        h.stride[i] = streams[i].stride;
+        h.offset[i] = offset;
+        offset = align(offset + h.count[i] * h.stride[i]);
+    }
+
+#if defined(_WIN32)
+    const auto process = uint64_t(GetCurrentProcessId());
+#else
+    const auto process = uint64_t(getpid());
+#endif
+    const auto thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+    const auto temporary = filename + "." + std::to_string(process) + "." +
+                           std::to_string(thread) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        const char padding[alignment] = {};
+        uint64_t written = sizeof(header);
+        out.write(reinterpret_cast<char const*>(&h), sizeof(header));
+        for (uint32_t i = 0; i < nstreams; i++) {
+            out.write(padding, std::streamsize(h.offset[i] - written));
+            const auto bytes = h.count[i] * h.stride[i];
+            out.write(static_cast<char const*>(streams[i].data),
+                      std::streamsize(bytes));
+            written = h.offset[i] + bytes;
+        }
+        out.write(padding, std::streamsize(offset - written));
+        if (!out) {
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+#if defined(_WIN32)
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Maps a sidecar and checks it against the source stamp and the element
+// sizes the caller expects. Leaves file closed when it cannot be used.
+inline header const* open(std::string const& filename, stamp const& key,
+                          uint64_t const (&strides)[nstreams],
+                          mapped_file& file) {
+    if (!file.open(filename) || file.size() < sizeof(header)) {
+        file.close();
+        return nullptr;
+    }
+    auto h = reinterpret_cast<header const*>(file.data());
+    bool valid = std::memcmp(h->magic, magic, sizeof(magic)) == 0 &&
+                 h->version == version && h->byte_order == byte_order &&
+                 h->source_size == key.size && h->source_mtime == key.mtime;
+    for (uint32_t i = 0; valid && i < nstreams; i++)
+        valid = h->stride[i] == strides[i] && h->offset[i] % alignment == 0 &&
+                h->offset[i] <= file.size() &&
+                h->count[i] <= (file.size() - h->offset[i]) / strides[i];
+    if (!valid) {
+        file.close();
+        return nullptr;
+    }
+    return h;
+}
+
+}  // namespace mesh_cache
+
+}  // namespace tiny
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tiny {
+
+// Index buffer reordering for triangle lists: Forsyth's linear-speed
+// vertex cache optimisation, first-use vertex fetch ordering and the
+// average cache miss ratio (ACMR) to judge them by.
+namespace mesh {
+
+// Vertices transformed per triangle through a FIFO post-transform cache
+// of cache_size entries; 3 is no reuse at all, 0.5 the limit for large
+// regular meshes.
+inline double acmr(std::vector<uint32_t> const& indices, uint32_t nverts,
+                   uint32_t cache_size = 16) {
+    if (indices.size() < 3) return 0;
+    // Time each vertex entered the cache; it is still there while fewer
+    // than cache_size misses happened since.
+    std::vector<uint64_t> entered(nverts, 0);
+    uint64_t misses = 0;
+    for (auto const v : indices) {
+        if (entered[v] == 0 || misses - entered[v] >= cache_size) {
+            misses++;
+            entered[v] = misses;
+        }
+    }
+    return double(misses) / double(indices.size() / 3);
+}
+
+struct optimize_stats {
+    uint32_t vertices = 0;
+    uint32_t triangles = 0;
+    double acmr_before = 0;
+    double acmr_after = 0;
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"vertices\":" << vertices << ",";
+        ss << "\"triangles\":" << triangles << ",";
+        ss << "\"acmr_before\":" << acmr_before << ",";
+        ss << "\"acmr_after\":" << acmr_after;
+        ss << "}";
+        return ss.str();
+    }
+};
+
+namespace detail {
+
+constexpr int32_t forsyth_cache = 32;
+
+// Score of a vertex from its LRU cache position (-1 when not cached) and
+// the number of triangles still to be emitted that use it.
+inline float forsyth_score(int32_t position, uint32_t remaining) {
+    if (remaining == 0) return -1.f;
+    float score = 0.f;
+    if (position >= 0) {
+        if (position < 3) {
+            // Just used by the last triangle: deliberately not the best,
+            // so strips do not run back over themselves.
+            score = .75f;
+        } else {
+            const float scale = 1.f / (forsyth_cache - 3);
+            score = std::pow(1.f - (position - 3) * scale, 1.5f);
+        }
+    }
+    // Favour vertices with few triangles left so they retire early.
+    return score + 2.f * std::pow(float(remaining), -.5f);
+}
+
+}  // namespace detail
+
+// Reorders the triangles of indices so consecutive ones share vertices
+// through an LRU cache, following Tom Forsyth's "Linear-Speed Vertex Cache
+// Optimisation". Triangles keep their corner order.
+inline void optimize_vertex_cache(std::vector<uint32_t>& indices,
+                                  uint32_t nverts) {
+    const auto ntriangles = uint32_t(indices.size() / 3);
+    if (ntriangles == 0) return;
+    using detail::forsyth_cache;
+
+    // Triangles around every vertex, as offsets into one array. remaining
+    // is the live length of each vertex's list.
+    std::vector<uint32_t> remaining(nverts, 0);
+    for (auto const v : indices) remaining[v]++;
+    std::vector<uint32_t> offsets(nverts + 1, 0);
+    for (uint32_t v = 0; v < nverts; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (uint32_t t = 0; t < ntriangles; t++)
+            for (uint32_t k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+
+    std::vector<float> vertex_score(nverts);
+    for (uint32_t v = 0; v < nverts; v++)
+        vertex_score[v] = detail::forsyth_score(-1, remaining[v]);
+    std::vector<bool> emitted(ntriangles, false);
+
+    std::vector<uint32_t> cache, next_cache;
+    cache.reserve(forsyth_cache + 3);
+    next_cache.reserve(forsyth_cache + 3);
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    // Open with the triangle whose vertices have the fewest neighbours.
+    uint32_t best = 0;
+    float best_score = -1.f;
+    for (uint32_t t = 0; t < ntriangles; t++) {
+        const float score = vertex_score[indices[t * 3]] +
+                            vertex_score[indices[t * 3 + 1]] +
+                            vertex_score[indices[t * 3 + 2]];
+        if (score > best_score) {
+            best_score = score;
+            best = t;
+        }
+    }
+    uint32_t scan = 0;
+    for (uint32_t emitted_count = 0; emitted_count < ntriangles;
+         emitted_count++) {
+        if (best == ntriangles) {
+            // Nothing in the cache touches an open triangle: restart from
+            // the next one in the input order.
+            while (emitted[scan]) scan++;
+            best = scan;
+        }
+        const uint32_t* corners = &indices[best * 3];
+        emitted[best] = true;
+        output.insert(output.end(), corners, corners + 3);
+
+        // Retire the triangle from its vertices' lists and move them to the
+        // front of the cache.
+        next_cache.assign(corners, corners + 3);
+        for (uint32_t k = 0; k < 3; k++) {
+            const auto v = corners[k];
+            auto* list = &adjacency[offsets[v]];
+            auto* last = list + remaining[v] - 1;
+            *std::find(list, last, best) = *last;
+            remaining[v]--;
+        }
+        for (auto const v : cache)
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+                next_cache.push_back(v);
+        for (size_t i = forsyth_cache; i < next_cache.size(); i++) {
+            const auto v = next_cache[i];
+            vertex_score[v] = detail::forsyth_score(-1, remaining[v]);
+        }
+        next_cache.resize(std::min<size_t>(next_cache.size(), forsyth_cache));
+        cache.swap(next_cache);
+
+        // Rescore what the cache holds, and with it every open triangle
+        // that could be next.
+        for (uint32_t i = 0; i < cache.size(); i++)
+            vertex_score[cache[i]] =
+                detail::forsyth_score(int32_t(i), remaining[cache[i]]);
+        best = ntriangles;
+        best_score = -1.f;
+        for (auto const v : cache) {
+            for (uint32_t i = 0; i < remaining[v]; i++) {
+                const auto t = adjacency[offsets[v] + i];
+                const float score = vertex_score[indices[t * 3]] +
+                                    vertex_score[indices[t * 3 + 1]] +
+                                    vertex_score[indices[t * 3 + 2]];
+                if (score > best_score) {
+                    best_score = score;
+                    best = t;
+                }
+            }
+        }
+    }
+    indices.swap(output);
+}
+
+// Renumbers vertices in the order indices first reference them, so the
+// vertex stage reads its inputs front to back. Returns remap, the new
+// index of every old vertex; unreferenced vertices go last.
+inline std::vector<uint32_t> optimize_vertex_fetch(
+    std::vector<uint32_t>& indices, uint32_t nverts) {
+    constexpr uint32_t unset = ~0u;
+    std::vector<uint32_t> remap(nverts, unset);
+    uint32_t next = 0;
+    for (auto& v : indices) {
+        if (remap[v] == unset) remap[v] = next++;
+        v = remap[v];
+    }
+    for (auto& r : remap)
+        if (r == unset) r = next++;
+    return remap;
+}
+
+// Moves the elements of a vertex stream to their remapped place.
+template <typename T>
+void remap_stream(std::vector<T>& stream, std::vector<uint32_t> const& remap) {
+    if (stream.empty()) return;
+    std::vector<T> out(stream.size());
+    for (size_t i = 0; i < stream.size(); i++) out[remap[i]] = stream[i];
+    stream.swap(out);
+}
+
+}  // namespace mesh
+
+}  // namespace tiny
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tiny.hpp"
+#include "tiny/raster.hpp"
+#include "tiny/scheduler.hpp"
+
+namespace tiny {
+
+namespace msaa {
+
+// Sample positions of a pixel in 1/16 pixel from its centre, the standard
+// D3D patterns: rotated grids that put every sample on a row and a column
+// of its own, so near-horizontal and near-vertical edges get as many
+// steps of coverage as there are samples.
+struct pattern {
+    int32_t count;
+    int32_t x[8], y[8];
+};
+
+inline pattern const& samples(int32_t count) {
+    static const pattern four = {4, {-2, 6, -6, 2}, {-6, -2, 2, 6}};
+    static const pattern eight = {
+        8, {1, -1, 5, -3, -5, -7, 3, 7}, {-3, 3, 1, -5, 5, -1, 7, -7}};
+    return count == 8 ? eight : four;
+}
+
+}  // namespace msaa
+
+// Color and depth of 4 or 8 samples per pixel, for edges that resolve to
+// the fraction of the pixel a triangle covers. Depth is kept per sample.
+// Color is kept per pixel as long as all of its samples agree, which they
+// do everywhere but along edges, and only a pixel that a triangle covers
+// in part expands into a block of one color per sample, taken from a pool
+// shared by the frame. A pixel that goes back to one color keeps its
+// block for the next time it expands.
+//
+// The pool holds a block per eighth of the pixels to start with. A frame
+// that runs out keeps a partly covered pixel at the color of the majority
+// of its samples, counts it, and the next clear() doubles the pool, so a
+// steady run of frames allocates nothing once the pool fits.
+class msaa_buffer {
+   public:
+    static constexpr uint32_t expanded = 1u << 31;
+    static constexpr uint32_t none = expanded - 1;
+
+    msaa_buffer(int32_t width, int32_t height, int32_t samples = 4)
+        : m_width(width), m_height(height),
+          m_pattern(msaa::samples(samples)),
+          m_all((1u << m_pattern.count) - 1),
+          m_colors(size_t(width) * height),
+          m_state(size_t(width) * height),
+          m_depth(size_t(width) * height * m_pattern.count),
+          m_pool(std::max<size_t>(m_colors.size() / 8, 1) * m_pattern.count),
+          m_used(0), m_overflowed(0) {
+        clear();
+    }
+    msaa_buffer(msaa_buffer const&) = delete;
+    msaa_buffer& operator=(msaa_buffer const&) = delete;
+
+   public:
+    void clear(color const& background = color(), float depth = 1.f) {
+        if (m_overflowed.load() > 0) m_pool.resize(m_pool.size() * 2);
+        m_overflowed = 0;
+        m_used = 0;
+        const auto word = pack(background);
+        std::fill(m_colors.begin(), m_colors.end(), word);
+        std::fill(m_state.begin(), m_state.end(), none);
+        std::fill(m_depth.begin(), m_depth.end(), depth);
+    }
+
+    int32_t get_width()   const { return m_width;  }
+    int32_t get_height()  const { return m_height; }
+    int32_t get_samples() const { return m_pattern.count; }
+    msaa::pattern const& get_pattern() const { return m_pattern; }
+    uint32_t all_samples() const { return m_all; }
+
+    size_t index(int32_t x, int32_t y) const {
+        return size_t(y) * m_width + x;
+    }
+
+    // The bytes of a u32 pixel, which every format stores a prefix of.
+    static uint32_t pack(color const& c) {
+        return pixel_traits<pixel_format::u32>::make(c).word;
+    }
+
+    // The depth of the samples of pixel (x, y), one after the other.
+    float* depth(int32_t x, int32_t y) {
+        return m_depth.data() + index(x, y) * m_pattern.count;
+    }
+
+    // Bytes held for the frame, the pool at its current size included.
+    size_t bytes() const {
+        return (m_colors.size() + m_state.size() + m_depth.size() +
+                m_pool.size()) * sizeof(uint32_t);
+    }
+
+    // Pixels whose samples differ right now.
+    size_t expanded_pixels() const {
+        return size_t(std::count_if(m_state.begin(), m_state.end(),
+                                    [](uint32_t s) { return s & expanded; }));
+    }
+
+    // Sets the samples of mask at pixel (x, y) to c. Pixels of distinct
+    // tiles can be written from distinct threads.
+    void write(int32_t x, int32_t y, uint32_t mask, color const& c) {
+        if (m_pattern.count == 8)
+            write<8>(index(x, y), mask, pack(c));
+        else
+            write<4>(index(x, y), mask, pack(c));
+    }
+
+    // The same for N samples, with pixel i and the color as a u32 word.
+    template <int32_t N>
+    TINY_INLINE void write(size_t i, uint32_t mask, uint32_t word) {
+        auto& state = m_state[i];
+        if (mask == (1u << N) - 1) {
+            m_colors[i] = word;
+            state &= ~expanded;
+            return;
+        }
+        constexpr auto n = N;
+        if (!(state & expanded)) {
+            if (state == none) {
+                const auto block = m_used.fetch_add(1, std::memory_order_relaxed);
+                if (size_t(block + 1) * n > m_pool.size()) {
+                    m_overflowed.fetch_add(1, std::memory_order_relaxed);
+                    if (2 * count(mask) >= uint32_t(n)) m_colors[i] = word;
+                    return;
+                }
+                state = block;
+            }
+            std::fill_n(&m_pool[size_t(state) * n], n, m_colors[i]);
+            state |= expanded;
+        }
+        auto* samples = &m_pool[size_t(state & ~expanded) * n];
+        bool uniform = true;
+        for (int32_t s = 0; s < n; s++) {
+            if (mask >> s & 1) samples[s] = word;
+            uniform &= samples[s] == samples[0];
+        }
+        if (uniform) {
+            m_colors[i] = samples[0];
+            state &= ~expanded;
+        }
+    }
+
+    // Averages the samples of every pixel into image, which is the size
+    // of the buffer. A pixel of one color is copied as it is, so the cost
+    // of the averages is only paid along edges. Rows are split over pool
+    // when one is given.
+    void resolve(image& image, scheduler* pool = nullptr) const {
+        image.visit([&](auto view) {
+            auto rows = [&](int32_t y0, int32_t y1) {
+                for (int32_t y = y0; y < y1; y++) resolve_row(view, y);
+            };
+            if (!pool || pool->size() == 1) {
+                rows(0, m_height);
+                return;
+            }
+            constexpr int32_t strip = 32;
+            pool->parallel_for(uint32_t((m_height + strip - 1) / strip),
+                               [&](uint32_t i, uint32_t) {
+                                   const auto y0 = int32_t(i) * strip;
+                                   rows(y0, std::min(y0 + strip, m_height));
+                               });
+        });
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::msaa_buffer\",";
+        ss << "\"width\":"   << m_width         << ",";
+        ss << "\"height\":"  << m_height        << ",";
+        ss << "\"samples\":" << m_pattern.count << ",";
+        ss << "\"bytes\":"   << bytes()         << ",";
+        ss << "\"expanded\":" << expanded_pixels() << ",";
+        ss << "\"blocks\":"  << std::min<size_t>(m_used.load(), pool_blocks())
+           << ",";
+        ss << "\"pool_blocks\":" << pool_blocks() << ",";
+        ss << "\"overflowed\":" << m_overflowed.load();
+        ss << "}";
+        return ss.str();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, msaa_buffer const& b) {
+        return os << b.json();
+    }
+
+   private:
+    size_t pool_blocks() const { return m_pool.size() / m_pattern.count; }
+
+    static uint32_t count(uint32_t mask) {
+        uint32_t n = 0;
+        for (; mask; mask &= mask - 1) n++;
+        return n;
+    }
+
+    template <typename View>
+    void resolve_row(View const& view, int32_t y) const {
+        constexpr auto channels = size_t(View::traits::channels);
+        const auto n = m_pattern.count;
+        const auto shift = n == 8 ? 3 : 2;
+        uint8_t* dst = view.row(y);
+        auto const* colors = &m_colors[index(0, y)];
+        auto const* state = &m_state[index(0, y)];
+        for (int32_t x = 0; x < m_width; x++, dst += channels) {
+            if (!(state[x] & expanded)) {
+                std::memcpy(dst, &colors[x], channels);
+                continue;
+            }
+            auto const* samples = &m_pool[size_t(state[x] & ~expanded) * n];
+            uint32_t sum[4] = {0, 0, 0, 0};
+            for (int32_t s = 0; s < n; s++)
+                for (int32_t c = 0; c < 4; c++)
+                    sum[c] += samples[s] >> (c * 8) & 0xFF;
+            uint8_t bytes[4];
+            for (int32_t c = 0; c < 4; c++)
+                bytes[c] = uint8_t((sum[c] + (n >> 1)) >> shift);
+            std::memcpy(dst, bytes, channels);
+        }
+    }
+
+    int32_t m_width;
+    int32_t m_height;
+    msaa::pattern m_pattern;
+    uint32_t m_all;
+    std::vector<uint32_t> m_colors;
+    std::vector<uint32_t> m_state;
+    std::vector<float> m_depth;
+    std::vector<uint32_t> m_pool;
+    std::atomic<uint32_t> m_used;
+    std::atomic<uint32_t> m_overflowed;
+};
+
+namespace msaa {
+
+namespace detail {
+
+// shade() for N samples, known at compile time so that the loops over
+// the samples unroll into straight line, mostly vector code.
+template <int32_t N, typename Shader>
+inline void shade(raster::edges const& e, raster::depth_plane const& z,
+                  msaa_buffer& target, Shader& shader,
+                  raster::depth_stats* stats) {
+    auto const& p = target.get_pattern();
+    constexpr uint32_t all = (1u << N) - 1;
+    // Edge k at sample s is 16 times its value at the pixel centre plus
+    // offset[k][s]; lo and hi bound the offsets over the samples.
+    int64_t offset[3][N], lo[3], hi[3];
+    for (int32_t k = 0; k < 3; k++) {
+        for (int32_t s = 0; s < N; s++)
+            offset[k][s] =
+                int64_t(e.a[k]) * p.x[s] + int64_t(e.b[k]) * p.y[s] + e.bias[k];
+        lo[k] = *std::min_element(offset[k], offset[k] + N);
+        hi[k] = *std::max_element(offset[k], offset[k] + N);
+    }
+    float dz[N];
+    for (int32_t s = 0; s < N; s++)
+        dz[s] = float((z.dx * p.x[s] + z.dy * p.y[s]) / 16);
+    const auto dzdx = float(z.dx), dzdy = float(z.dy);
+    if (stats) stats->triangles++;
+
+    constexpr int32_t block = 8;
+    for (int32_t by = e.box.y0 & ~(block - 1); by < e.box.y1; by += block) {
+        const auto y0 = std::max(by, e.box.y0);
+        const auto y1 = std::min(by + block, e.box.y1);
+        for (int32_t bx = e.box.x0 & ~(block - 1); bx < e.box.x1;
+             bx += block) {
+            const auto x0 = std::max(bx, e.box.x0);
+            const auto x1 = std::min(bx + block, e.box.x1);
+
+            int32_t row[3];
+            bool full = true;
+            bool empty = false;
+            for (int32_t k = 0; k < 3; k++) {
+                row[k] = e.a[k] * x0 + e.b[k] * y0 + e.c[k] - e.bias[k];
+                const auto dx = e.a[k] * (x1 - 1 - x0);
+                const auto dy = e.b[k] * (y1 - 1 - y0);
+                const auto highest = row[k] + std::max(dx, 0) + std::max(dy, 0);
+                const auto lowest  = row[k] + std::min(dx, 0) + std::min(dy, 0);
+                if (int64_t(highest) * 16 + hi[k] < 0) empty = true;
+                if (int64_t(lowest) * 16 + lo[k] < 0) full = false;
+            }
+            if (empty) continue;
+
+            const auto zblock = z.at(x0, y0);
+            for (int32_t y = y0; y < y1; y++) {
+                int32_t w[3] = {row[0], row[1], row[2]};
+                const auto zrow = zblock + dzdy * float(y - y0);
+                float* depth = target.depth(x0, y);
+                auto pixel = target.index(x0, y);
+                for (int32_t x = x0; x < x1; x++, depth += N, pixel++) {
+                    uint32_t mask = all;
+                    if (!full) {
+                        const int64_t v[3] = {int64_t(w[0]) * 16,
+                                              int64_t(w[1]) * 16,
+                                              int64_t(w[2]) * 16};
+                        if (v[0] + hi[0] < 0 || v[1] + hi[1] < 0 ||
+                            v[2] + hi[2] < 0) {
+                            mask = 0;
+                        } else if (v[0] + lo[0] < 0 || v[1] + lo[1] < 0 ||
+                                   v[2] + lo[2] < 0) {
+                            mask = 0;
+                            for (int32_t s = 0; s < N; s++)
+                                mask |= uint32_t(v[0] + offset[0][s] >= 0 &&
+                                                 v[1] + offset[1][s] >= 0 &&
+                                                 v[2] + offset[2][s] >= 0)
+                                        << s;
+                        }
+                    }
+                    if (mask) {
+                        if (stats) stats->fragments_tested++;
+                        const auto zpixel = zrow + dzdx * float(x - x0);
+                        uint32_t passed = 0;
+                        for (int32_t s = 0; s < N; s++) {
+                            const auto zs = zpixel + dz[s];
+                            const bool pass = (mask >> s & 1) && zs < depth[s];
+                            depth[s] = pass ? zs : depth[s];
+                            passed |= uint32_t(pass) << s;
+                        }
+                        if (passed) {
+                            if (stats) stats->fragments_passed++;
+                            target.write<N>(pixel, passed,
+                                            msaa_buffer::pack(shader(
+                                                x, y, w[0], w[1], w[2])));
+                        }
+                    }
+                    w[0] += e.a[0];
+                    w[1] += e.a[1];
+                    w[2] += e.a[2];
+                }
+                row[0] += e.b[0];
+                row[1] += e.b[1];
+                row[2] += e.b[2];
+            }
+        }
+    }
+}
+
+}  // namespace detail
+
+// Depth tested, multisampled shading of a set up triangle: coverage and
+// depth per sample, and shader(x, y, w0, w1, w2) once per pixel where any
+// sample passes, with the unbiased edge values at the pixel centre as
+// raster::shade() gives them. The samples that pass take its color.
+//
+// The edge functions at a sample are the pixel's scaled by 16 plus the
+// sample's offset along them, in 64 bits, with the fill rule bias as for
+// pixels, so an edge shared by two triangles covers each sample once.
+// Blocks of 8x8 pixels whose samples all miss one edge are skipped, and
+// only pixels an edge runs through test their samples one by one.
+// Counts pixels covered as fragments tested and pixels shaded as passed.
+template <typename Shader>
+inline void shade(raster::edges const& e, raster::depth_plane const& z,
+                  msaa_buffer& target, Shader&& shader,
+                  raster::depth_stats* stats = nullptr) {
+    if (target.get_samples() == 8)
+        detail::shade<8>(e, z, target, shader, stats);
+    else
+        detail::shade<4>(e, z, target, shader, stats);
+}
+
+// Flat color triangle into the samples, depth tested, clipped to clip.
+inline void triangle(std::array<vec2<int32_t>, 3> const& pts,
+                     std::array<float, 3> const& z, rect const& clip,
+                     msaa_buffer& target, color const& c,
+                     raster::depth_stats* stats = nullptr) {
+    raster::edges e;
+    if (!raster::setup(pts, clip, e)) return;
+    shade(e, raster::plane(pts, z), target,
+          [&c](int32_t, int32_t, int32_t, int32_t, int32_t) { return c; },
+          stats);
+}
+
+}  // namespace msaa
+
+}  // namespace tiny
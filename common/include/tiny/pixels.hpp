@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "tiny/simd.hpp"
+
+namespace tiny {
+
+// Row kernels behind the image flips, on raw pixel bytes.
+namespace pixels {
+
+// Swaps two rows of bytes through a small stack buffer, so a flip needs
+// no row sized allocation.
+inline void swap_rows(uint8_t* a, uint8_t* b, size_t bytes) {
+    uint8_t chunk[1024];
+    for (size_t done = 0; done < bytes; done += sizeof(chunk)) {
+        const auto n = bytes - done < sizeof(chunk) ? bytes - done : sizeof(chunk);
+        std::memcpy(chunk, a + done, n);
+        std::memcpy(a + done, b + done, n);
+        std::memcpy(b + done, chunk, n);
+    }
+}
+
+// Writes the width pixels of src to dst in reverse order. dst must not
+// overlap src and must have 16 bytes of slack past the row.
+template <int32_t channels>
+inline void reverse_pixels(uint8_t const* src, uint8_t* dst, int32_t width) {
+    for (int32_t x = 0; x < width; x++)
+        std::memcpy(dst + size_t(width - 1 - x) * channels,
+                    src + size_t(x) * channels, channels);
+}
+
+inline void reverse_scalar(uint8_t const* src, uint8_t* dst, int32_t width,
+                           int32_t channels) {
+    switch (channels) {
+        case 1: return reverse_pixels<1>(src, dst, width);
+        case 2: return reverse_pixels<2>(src, dst, width);
+        case 3: return reverse_pixels<3>(src, dst, width);
+        default: return reverse_pixels<4>(src, dst, width);
+    }
+}
+
+#if defined(TINY_X86)
+// 4 pixels of 4 bytes or 5 pixels of 3 bytes per shuffle. The 3 byte
+// version loads and stores a 16th byte: it walks the row from its end so
+// that every store's spare byte is overwritten by the next store, and
+// stops where the last load would run off the row.
+TINY_TARGET("sse4.1")
+inline void reverse_sse41(uint8_t const* src, uint8_t* dst, int32_t width,
+                          int32_t channels) {
+    int32_t done = 0;
+    if (channels == 4) {
+        for (; done + 4 <= width; done += 4) {
+            const auto v = _mm_loadu_si128(
+                reinterpret_cast<__m128i const*>(src + done * 4));
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i*>(dst + (width - 4 - done) * 4),
+                _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+    } else if (channels == 3) {
+        const auto order = _mm_setr_epi8(12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4,
+                                         5, 0, 1, 2, 15);
+        // Chunks of 5 pixels whose 16 byte load stays inside the row.
+        const int32_t chunks = width >= 6 ? (width - 6) / 5 + 1 : 0;
+        for (int32_t k = chunks - 1; k >= 0; k--) {
+            const auto v = _mm_loadu_si128(
+                reinterpret_cast<__m128i const*>(src + k * 15));
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i*>(dst + (width - 5 - k * 5) * 3),
+                _mm_shuffle_epi8(v, order));
+        }
+        done = chunks * 5;
+    }
+    reverse_scalar(src + size_t(done) * channels, dst, width - done, channels);
+}
+#endif
+
+inline void reverse(uint8_t const* src, uint8_t* dst, int32_t width,
+                    int32_t channels, simd::isa isa = simd::active()) {
+#if defined(TINY_X86)
+    if (isa >= simd::isa::sse41) return reverse_sse41(src, dst, width, channels);
+#endif
+    reverse_scalar(src, dst, width, channels);
+}
+
+}  // namespace pixels
+
+}  // namespace tiny
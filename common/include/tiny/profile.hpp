@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tiny/simd.hpp"
+
+#if defined(TINY_X86) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#endif
+
+// The frame profiler is compiled in when TINY_PROFILE is 1: in every
+// build but release by default, and in release too with premake's
+// --profile. At 0 the macros below expand to nothing and no timer or
+// counter is left in the code.
+#if !defined(TINY_PROFILE)
+#if defined(_RELEASE)
+#define TINY_PROFILE 0
+#else
+#define TINY_PROFILE 1
+#endif
+#endif
+
+namespace tiny {
+
+// Where the time of a frame goes: scoped timers, which record one event
+// each into a buffer allocated up front, and counters, which every thread
+// adds to in a cache line of its own. Both are read back once per frame,
+// when no thread is adding to them, into a per-frame summary; the events
+// also make a Chrome trace (chrome://tracing, Perfetto) of every thread.
+//
+// Code is instrumented with TINY_PROFILE_SCOPE("name") and
+// TINY_PROFILE_COUNT(counter, n), which go to the current profiler, and
+// cost a load and a branch while there is none.
+namespace profile {
+
+constexpr bool compiled = TINY_PROFILE != 0;
+
+enum class counter {
+    triangles_in,
+    triangles_culled,
+    triangles_rasterized,
+    fragments_tested,
+    fragments_written,
+    bytes_written,
+    count
+};
+
+constexpr size_t ncounters = size_t(counter::count);
+
+inline char const* name(counter c) {
+    switch (c) {
+        case counter::triangles_in:         return "triangles_in";
+        case counter::triangles_culled:     return "triangles_culled";
+        case counter::triangles_rasterized: return "triangles_rasterized";
+        case counter::fragments_tested:     return "fragments_tested";
+        case counter::fragments_written:    return "fragments_written";
+        case counter::bytes_written:        return "bytes_written";
+        default:                            return "count";
+    }
+}
+
+// A timestamp in ticks: the TSC on x86, a single instruction that runs at
+// a constant rate on anything recent, and steady_clock's elsewhere.
+inline uint64_t now() {
+#if defined(TINY_X86)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// One timed scope of one thread.
+struct event {
+    char const* name;
+    uint64_t start, end;
+    uint32_t thread;
+    uint32_t frame;
+};
+
+// What a frame's events add up to: per zone name, the calls and the time
+// spent in them summed over every thread, so a zone run by several
+// workers at once can take longer than the frame.
+struct zone {
+    char const* name = nullptr;
+    uint64_t calls = 0;
+    double ms = 0;
+};
+
+struct frame {
+    static constexpr size_t max_zones = 32;
+
+    uint32_t index = 0;
+    double ms = 0;
+    uint64_t pixels = 0;
+    std::array<uint64_t, ncounters> counters{};
+    std::array<zone, max_zones> zones{};
+    uint32_t nzones = 0;
+
+    uint64_t get(counter c) const { return counters[size_t(c)]; }
+
+    // Fragments written per pixel of the frame.
+    double overdraw() const {
+        return pixels ? double(get(counter::fragments_written)) / pixels : 0;
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::profile::frame\",";
+        ss << "\"frame\":" << index << ",";
+        ss << "\"ms\":"    << ms    << ",";
+        ss << "\"counters\":{";
+        for (size_t i = 0; i < ncounters; i++)
+            ss << (i ? "," : "") << "\"" << name(counter(i))
+               << "\":" << counters[i];
+        ss << "},";
+        ss << "\"overdraw\":" << overdraw() << ",";
+        ss << "\"zones\":{";
+        for (uint32_t i = 0; i < nzones; i++)
+            ss << (i ? "," : "") << "\"" << zones[i].name << "\":{"
+               << "\"calls\":" << zones[i].calls << ","
+               << "\"ms\":"    << zones[i].ms    << "}";
+        ss << "}";
+        ss << "}";
+        return ss.str();
+    }
+};
+
+namespace detail {
+
+// Threads are numbered in the order they first record anything. A plain
+// thread_local, so taking a number allocates nothing.
+inline uint32_t thread_index() {
+    static std::atomic<uint32_t> next(0);
+    thread_local const uint32_t index =
+        next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+}  // namespace detail
+
+// Owns the event buffer, the counters of every thread and the frames
+// summed so far. Nothing is allocated after construction as long as the
+// frames stay within the count reserved for them, so a profiled frame
+// loop still runs without heap allocations. Events past capacity are
+// dropped and counted.
+class profiler {
+   public:
+    static constexpr uint32_t max_threads = 64;
+
+    explicit profiler(size_t capacity = size_t(1) << 16, size_t frames = 64)
+        : m_events(capacity), m_next(0), m_origin(now()),
+          m_origin_time(std::chrono::steady_clock::now()) {
+        m_frames.reserve(frames);
+    }
+    profiler(profiler const&) = delete;
+    profiler& operator=(profiler const&) = delete;
+
+   public:
+    // Starts a frame: zeroes the counters, which every thread has to be
+    // done adding to.
+    void begin_frame() {
+        for (auto& slot : m_slots)
+            for (auto& value : slot.values)
+                value.store(0, std::memory_order_relaxed);
+        m_frame_first = std::min(m_next.load(), m_events.size());
+        m_frame_start = now();
+    }
+
+    // Ends the frame begun last and sums it up. pixels is the frame's
+    // size, for its overdraw.
+    frame const& end_frame(uint64_t pixels = 0) {
+        const auto end = now();
+        calibrate();
+        frame f;
+        f.index  = uint32_t(m_frames.size());
+        f.ms     = ms(end - m_frame_start);
+        f.pixels = pixels;
+        for (auto const& slot : m_slots)
+            for (size_t i = 0; i < ncounters; i++)
+                f.counters[i] += slot.values[i].load(std::memory_order_relaxed);
+        const auto last = std::min(m_next.load(), m_events.size());
+        for (size_t i = m_frame_first; i < last; i++) {
+            auto const& e = m_events[i];
+            uint32_t z = 0;
+            while (z < f.nzones && std::strcmp(f.zones[z].name, e.name) != 0)
+                z++;
+            if (z == f.nzones) {
+                if (f.nzones == frame::max_zones) continue;
+                f.zones[f.nzones++].name = e.name;
+            }
+            f.zones[z].calls++;
+            f.zones[z].ms += ms(e.end - e.start);
+        }
+        m_frames.push_back(f);
+        return m_frames.back();
+    }
+
+    // Called by scope; one atomic increment claims the slot.
+    void record(char const* name, uint64_t start, uint64_t end) {
+        const auto i = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= m_events.size()) return;
+        m_events[i] = {name, start, end, detail::thread_index(),
+                       uint32_t(m_frames.size())};
+    }
+
+    // Only the calling thread writes its slot, so a load and a store add
+    // to it without a locked instruction. Threads past max_threads share
+    // the last slot and may then lose counts.
+    void add(counter c, uint64_t n) {
+        const auto thread = std::min(detail::thread_index(), max_threads - 1);
+        auto& value = m_slots[thread].values[size_t(c)];
+        value.store(value.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+    }
+
+    std::vector<frame> const& frames() const { return m_frames; }
+    size_t events() const { return std::min(m_next.load(), m_events.size()); }
+    size_t dropped() const {
+        const auto next = m_next.load();
+        return next > m_events.size() ? next - m_events.size() : 0;
+    }
+
+    // Milliseconds in n ticks, by the rate measured between construction
+    // and the last end_frame().
+    double ms(uint64_t ticks) const { return double(ticks) / m_ticks_per_ms; }
+
+    // The events as a Chrome trace: one complete event per scope, in
+    // microseconds from the profiler's construction.
+    bool write_trace(std::string const& filename) {
+        calibrate();
+        std::ofstream out(filename);
+        if (!out) return false;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        const auto count = events();
+        for (size_t i = 0; i < count; i++) {
+            auto const& e = m_events[i];
+            out << (i ? ",\n" : "\n") << "{\"name\":\"" << e.name
+                << "\",\"cat\":\"tiny\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << e.thread << ",\"ts\":"
+                << ms(e.start - m_origin) * 1e3
+                << ",\"dur\":" << ms(e.end - e.start) * 1e3
+                << ",\"args\":{\"frame\":" << e.frame << "}}";
+        }
+        out << "\n]}\n";
+        return bool(out);
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::profile::profiler\",";
+        ss << "\"compiled\":" << (compiled ? "true" : "false") << ",";
+        ss << "\"ticks_per_ms\":" << m_ticks_per_ms << ",";
+        ss << "\"events\":"  << events()  << ",";
+        ss << "\"dropped\":" << dropped() << ",";
+        ss << "\"frames\":[";
+        for (size_t i = 0; i < m_frames.size(); i++)
+            ss << (i ? "," : "") << m_frames[i].json();
+        ss << "]";
+        ss << "}";
+        return ss.str();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, profiler const& p) {
+        return os << p.json();
+    }
+
+   private:
+    // The tick rate against steady_clock, over everything since
+    // construction; a frame is long enough for the TSC to be read to well
+    // under a percent.
+    void calibrate() {
+        const auto ticks = now() - m_origin;
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - m_origin_time;
+        if (elapsed.count() > 0 && ticks > 0)
+            m_ticks_per_ms = double(ticks) / elapsed.count();
+    }
+
+    struct alignas(64) slot {
+        std::atomic<uint64_t> values[ncounters] = {};
+    };
+
+    std::vector<event> m_events;
+    std::atomic<size_t> m_next;
+    std::array<slot, max_threads> m_slots;
+    std::vector<frame> m_frames;
+    size_t m_frame_first = 0;
+    uint64_t m_frame_start = 0;
+    uint64_t m_origin;
+    std::chrono::steady_clock::time_point m_origin_time;
+    double m_ticks_per_ms = 1e6;
+};
+
+namespace detail {
+
+inline profiler*& current() {
+    static profiler* p = nullptr;
+    return p;
+}
+
+}  // namespace detail
+
+// The profiler the macros record to, or nullptr to record nothing. Set it
+// before starting the threads that record.
+inline void set_current(profiler* p) { detail::current() = p; }
+inline profiler* current() { return detail::current(); }
+
+inline void count(counter c, uint64_t n) {
+    if (auto* p = current()) p->add(c, n);
+}
+
+// Times its own lifetime as one event of the current profiler.
+class scope {
+   public:
+    explicit scope(char const* name)
+        : m_profiler(current()), m_name(name),
+          m_start(m_profiler ? now() : 0) {}
+    ~scope() {
+        if (m_profiler) m_profiler->record(m_name, m_start, now());
+    }
+    scope(scope const&) = delete;
+    scope& operator=(scope const&) = delete;
+
+   private:
+    profiler* m_profiler;
+    char const* m_name;
+    uint64_t m_start;
+};
+
+}  // namespace profile
+
+}  // namespace tiny
+
+#define TINY_PROFILE_JOIN_(a, b) a##b
+#define TINY_PROFILE_JOIN(a, b) TINY_PROFILE_JOIN_(a, b)
+
+#if TINY_PROFILE
+#define TINY_PROFILE_SCOPE(name) \
+    ::tiny::profile::scope TINY_PROFILE_JOIN(tiny_profile_scope_, __LINE__)(name)
+#define TINY_PROFILE_COUNT(c, n) \
+    ::tiny::profile::count(::tiny::profile::counter::c, uint64_t(n))
+#else
+#define TINY_PROFILE_SCOPE(name) ((void)0)
+#define TINY_PROFILE_COUNT(c, n) ((void)0)
+#endif
@@ -0,0 +1,786 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "tiny.hpp"
+#include "tiny/arena.hpp"
+#include "tiny/simd.hpp"
+
+namespace tiny {
+
+// Half-open pixel rectangle [x0, x1) x [y0, y1).
+struct rect {
+    int32_t x0, y0, x1, y1;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+// Splits the frame into square tiles and keeps, per tile, the indices of
+// the triangles whose bounds touch it. Indices are appended in submission
+// order, so drawing a bin front to back keeps the painter's order of the
+// serial loop and every tile comes out the same as the full frame would.
+class tile_bins {
+   public:
+    tile_bins(int32_t width, int32_t height, int32_t tile_size = 64)
+        : m_width(width), m_height(height), m_tile_size(tile_size) {
+        m_columns = (width + tile_size - 1) / tile_size;
+        m_rows    = (height + tile_size - 1) / tile_size;
+        m_offsets.resize(size_t(m_columns) * m_rows + 1);
+    }
+
+   public:
+    // Bins triangles [0, count), bounds(i) giving the inclusive bounds of
+    // each as raster::bounds() does. One pass counts the triangles per
+    // tile, a second writes every tile's list into one array: in scratch
+    // when given, where it lives until the arena's reset, or else in a
+    // buffer the bins keep and only ever grow.
+    template <typename Bounds>
+    void build(uint32_t count, Bounds const& bounds, arena* scratch = nullptr) {
+        std::fill(m_offsets.begin(), m_offsets.end(), 0);
+        for (uint32_t i = 0; i < count; i++)
+            visit(bounds(i), [&](size_t tile) { m_offsets[tile + 1]++; });
+        for (size_t t = 1; t < m_offsets.size(); t++)
+            m_offsets[t] += m_offsets[t - 1];
+        const auto total = m_offsets.back();
+        if (scratch) {
+            m_items = scratch->allocate<uint32_t>(total).data();
+        } else {
+            if (m_storage.size() < total) m_storage.resize(total);
+            m_items = m_storage.data();
+        }
+        // Fill through the offsets, then shift them back one tile.
+        for (uint32_t i = 0; i < count; i++)
+            visit(bounds(i), [&](size_t tile) { m_items[m_offsets[tile]++] = i; });
+        for (size_t t = m_offsets.size() - 1; t > 0; t--)
+            m_offsets[t] = m_offsets[t - 1];
+        m_offsets[0] = 0;
+    }
+
+    int32_t ntiles() const { return m_columns * m_rows; }
+
+    rect tile(int32_t i) const {
+        const auto x = (i % m_columns) * m_tile_size;
+        const auto y = (i / m_columns) * m_tile_size;
+        return rect{x, y, std::min(x + m_tile_size, m_width),
+                    std::min(y + m_tile_size, m_height)};
+    }
+
+    span<uint32_t const> items(int32_t i) const {
+        return span<uint32_t const>(m_items + m_offsets[i],
+                                    m_offsets[i + 1] - m_offsets[i]);
+    }
+
+   private:
+    template <typename Fn>
+    void visit(rect const& bounds, Fn const& fn) const {
+        if (bounds.x1 < 0 || bounds.y1 < 0) return;
+        if (bounds.x0 >= m_width || bounds.y0 >= m_height) return;
+        const auto x0 = std::max(0, bounds.x0) / m_tile_size;
+        const auto y0 = std::max(0, bounds.y0) / m_tile_size;
+        const auto x1 = std::min(m_width - 1, bounds.x1) / m_tile_size;
+        const auto y1 = std::min(m_height - 1, bounds.y1) / m_tile_size;
+        for (int32_t y = y0; y <= y1; y++)
+            for (int32_t x = x0; x <= x1; x++)
+                fn(size_t(y) * m_columns + x);
+    }
+
+   private:
+    int32_t m_width;
+    int32_t m_height;
+    int32_t m_tile_size;
+    int32_t m_columns;
+    int32_t m_rows;
+    std::vector<size_t> m_offsets;
+    std::vector<uint32_t> m_storage;
+    uint32_t* m_items = nullptr;
+};
+
+namespace raster {
+
+// Inclusive screen bounds of a triangle.
+inline rect bounds(std::array<vec2<int32_t>, 3> const& pts) {
+    return rect{
+        std::min({pts[0].x, pts[1].x, pts[2].x}),
+        std::min({pts[0].y, pts[1].y, pts[2].y}),
+        std::max({pts[0].x, pts[1].x, pts[2].x}),
+        std::max({pts[0].y, pts[1].y, pts[2].y}),
+    };
+}
+
+// Edge functions of a triangle, E(x, y) = a * x + b * y + c, set up so
+// that all three are >= 0 inside. c already carries the top-left fill rule
+// bias: pixels exactly on an edge that is neither a top nor a left edge
+// get -1 and fall outside, so an edge shared by two triangles is drawn by
+// exactly one of them. Coordinates are expected to stay within +/-16K so
+// the products fit in 32 bits.
+struct edges {
+    int32_t a[3], b[3], c[3];
+    int32_t bias[3];
+    int32_t area;
+    rect box;
+};
+
+// Returns false for degenerate triangles and ones that miss clip.
+inline bool setup(std::array<vec2<int32_t>, 3> const& pts, rect const& clip,
+                  edges& e) {
+    const auto& v = pts;
+    const auto area = (v[1].x - v[0].x) * (v[2].y - v[0].y) -
+                      (v[1].y - v[0].y) * (v[2].x - v[0].x);
+    if (area == 0) return false;
+
+    e.box = rect{
+        std::max(clip.x0, std::min({v[0].x, v[1].x, v[2].x})),
+        std::max(clip.y0, std::min({v[0].y, v[1].y, v[2].y})),
+        std::min(clip.x1, std::max({v[0].x, v[1].x, v[2].x}) + 1),
+        std::min(clip.y1, std::max({v[0].y, v[1].y, v[2].y}) + 1),
+    };
+    if (e.box.empty()) return false;
+
+    // Edge k is the one opposite vertex k, walked so that the inside is
+    // positive whatever the winding, so E_k / area is the barycentric
+    // coordinate of pts[k].
+    for (int32_t k = 0; k < 3; k++) {
+        auto from = v[(k + 1) % 3];
+        auto to   = v[(k + 2) % 3];
+        if (area < 0) std::swap(from, to);
+        const auto dx = to.x - from.x;
+        const auto dy = to.y - from.y;
+        const bool top_left = dy < 0 || (dy == 0 && dx < 0);
+        e.a[k] = -dy;
+        e.b[k] = dx;
+        e.bias[k] = top_left ? 0 : -1;
+        e.c[k] = dy * from.x - dx * from.y + e.bias[k];
+    }
+    e.area = std::abs(area);
+    return true;
+}
+
+// Walks the covered pixels of e.box in 8x8 blocks, row-major. The three
+// edge functions are evaluated at the block corners first: a block that
+// lies outside one edge is skipped, one inside all of them is filled
+// without per-pixel tests. Inside a block the edge values are stepped
+// incrementally by a per column and b per row. fragment is called as
+// fragment(x, y, w0, w1, w2) with the unbiased edge values, so wk / area
+// are the barycentric coordinates of the pixel.
+template <typename Fragment>
+inline void rasterize(edges const& e, Fragment&& fragment) {
+    constexpr int32_t block = 8;
+    for (int32_t by = e.box.y0 & ~(block - 1); by < e.box.y1; by += block) {
+        const auto y0 = std::max(by, e.box.y0);
+        const auto y1 = std::min(by + block, e.box.y1);
+        for (int32_t bx = e.box.x0 & ~(block - 1); bx < e.box.x1;
+             bx += block) {
+            const auto x0 = std::max(bx, e.box.x0);
+            const auto x1 = std::min(bx + block, e.box.x1);
+
+            // E is linear, so its extremes over the block are at the
+            // corners picked by the signs of a and b.
+            int32_t row[3];
+            bool full = true;
+            bool empty = false;
+            for (int32_t k = 0; k < 3; k++) {
+                row[k] = e.a[k] * x0 + e.b[k] * y0 + e.c[k];
+                const auto dx = e.a[k] * (x1 - 1 - x0);
+                const auto dy = e.b[k] * (y1 - 1 - y0);
+                const auto highest = row[k] + std::max(dx, 0) + std::max(dy, 0);
+                const auto lowest  = row[k] + std::min(dx, 0) + std::min(dy, 0);
+                if (highest < 0) empty = true;
+                if (lowest < 0) full = false;
+            }
+            if (empty) continue;
+
+            for (int32_t y = y0; y < y1; y++) {
+                auto w0 = row[0], w1 = row[1], w2 = row[2];
+                for (int32_t x = x0; x < x1; x++) {
+                    if (full || (w0 | w1 | w2) >= 0)
+                        fragment(x, y, w0 - e.bias[0], w1 - e.bias[1],
+                                 w2 - e.bias[2]);
+                    w0 += e.a[0];
+                    w1 += e.a[1];
+                    w2 += e.a[2];
+                }
+                row[0] += e.b[0];
+                row[1] += e.b[1];
+                row[2] += e.b[2];
+            }
+        }
+    }
+}
+
+// Flat color fill of a set up triangle, pixel by pixel as rasterize()
+// visits them. triangle() only sends it the smallest triangles: from a
+// few rows up, scanline() writes the same pixels as whole spans.
+template <pixel_format P>
+inline void fill(edges const& e, image_view<P> const& view,
+                 color const& color) {
+    using pixel = pixel_traits<P>;
+    rasterize(e, [&](int32_t x, int32_t y, int32_t, int32_t, int32_t) {
+        pixel::store(view.pixel(x, y), color);
+    });
+}
+
+inline void fill(edges const& e, image& image, color const& color) {
+    image.visit([&](auto view) { fill(e, view, color); });
+}
+
+// Depth as a plane over the screen, z(x, y) = z0 + dx * (x - x0) +
+// dy * (y - y0) through the three vertices, with the vertex range to bound
+// it. Evaluated per block origin in double and stepped in float from
+// there, the same way by every kernel.
+struct depth_plane {
+    double z0, dx, dy;
+    int32_t x0, y0;
+    float min, max;
+
+    float at(int32_t x, int32_t y) const {
+        return float(z0 + dx * (x - x0) + dy * (y - y0));
+    }
+};
+
+inline depth_plane plane(std::array<vec2<int32_t>, 3> const& pts,
+                         std::array<float, 3> const& z) {
+    const double x1 = pts[1].x - pts[0].x, y1 = pts[1].y - pts[0].y;
+    const double x2 = pts[2].x - pts[0].x, y2 = pts[2].y - pts[0].y;
+    const double z1 = z[1] - z[0], z2 = z[2] - z[0];
+    const double det = x1 * y2 - x2 * y1;
+    depth_plane p;
+    p.z0 = z[0];
+    p.dx = det != 0 ? (z1 * y2 - z2 * y1) / det : 0;
+    p.dy = det != 0 ? (z2 * x1 - z1 * x2) / det : 0;
+    p.x0 = pts[0].x;
+    p.y0 = pts[0].y;
+    p.min = std::min({z[0], z[1], z[2]});
+    p.max = std::max({z[0], z[1], z[2]});
+    return p;
+}
+
+// Perspective-correct barycentric weights of a triangle anywhere on the
+// screen. Each vertex's screen space weight times its 1 / w is a plane,
+// kept relative to the first vertex so the float evaluation stays small;
+// the weights are those planes over their sum. Pieces that culling clips
+// off a triangle interpolate through the planes of the whole triangle.
+struct perspective {
+    float a[3], b[3], c[3];
+    int32_t x0, y0;
+
+    vec3<float> at(int32_t x, int32_t y) const {
+        const auto dx = float(x - x0), dy = float(y - y0);
+        const float q0 = a[0] * dx + b[0] * dy + c[0];
+        const float q1 = a[1] * dx + b[1] * dy + c[1];
+        const float q2 = a[2] * dx + b[2] * dy + c[2];
+        const float scale = 1.f / (q0 + q1 + q2);
+        return {q0 * scale, q1 * scale, q2 * scale};
+    }
+};
+
+inline perspective perspective_weights(
+    std::array<vec2<int32_t>, 3> const& pts, std::array<float, 3> const& inv_w) {
+    perspective p;
+    p.x0 = pts[0].x;
+    p.y0 = pts[0].y;
+    const double area = double(pts[1].x - pts[0].x) * (pts[2].y - pts[0].y) -
+                        double(pts[1].y - pts[0].y) * (pts[2].x - pts[0].x);
+    for (int32_t k = 0; k < 3; k++) {
+        if (area == 0) {
+            p.a[k] = p.b[k] = 0.f;
+            p.c[k] = 1.f;
+            continue;
+        }
+        // Edge k runs between the other two vertices and is area at pts[k].
+        auto const& from = pts[(k + 1) % 3];
+        auto const& to = pts[(k + 2) % 3];
+        const double ex = to.x - from.x, ey = to.y - from.y;
+        const double scale = inv_w[k] / area;
+        p.a[k] = float(-ey * scale);
+        p.b[k] = float(ex * scale);
+        p.c[k] = float((ex * (p.y0 - from.y) - ey * (p.x0 - from.x)) * scale);
+    }
+    return p;
+}
+
+// The attribute values of three vertices blended by weights.
+template <typename T>
+inline T interpolate(vec3<float> const& weights, T const& a0, T const& a1,
+                     T const& a2) {
+    return a0 * weights.x + a1 * weights.y + a2 * weights.z;
+}
+
+// Early-Z counters. Rejected fragments are covered pixels that were
+// dropped by the pyramid before any per-pixel depth test; counting them
+// costs a coverage pass over the dropped area, so they are only gathered
+// when a depth_stats is passed in.
+struct depth_stats {
+    uint64_t triangles          = 0;
+    uint64_t triangles_rejected = 0;
+    uint64_t blocks             = 0;
+    uint64_t blocks_rejected    = 0;
+    uint64_t blocks_accepted    = 0;
+    uint64_t fragments_rejected = 0;
+    uint64_t fragments_tested   = 0;
+    uint64_t fragments_passed   = 0;
+
+    depth_stats& operator+=(depth_stats const& rhs) {
+        triangles          += rhs.triangles;
+        triangles_rejected += rhs.triangles_rejected;
+        blocks             += rhs.blocks;
+        blocks_rejected    += rhs.blocks_rejected;
+        blocks_accepted    += rhs.blocks_accepted;
+        fragments_rejected += rhs.fragments_rejected;
+        fragments_tested   += rhs.fragments_tested;
+        fragments_passed   += rhs.fragments_passed;
+        return *this;
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::raster::depth_stats\",";
+        ss << "\"triangles\":"          << triangles          << ",";
+        ss << "\"triangles_rejected\":" << triangles_rejected << ",";
+        ss << "\"blocks\":"             << blocks             << ",";
+        ss << "\"blocks_rejected\":"    << blocks_rejected    << ",";
+        ss << "\"blocks_accepted\":"    << blocks_accepted    << ",";
+        ss << "\"fragments_rejected\":" << fragments_rejected << ",";
+        ss << "\"fragments_tested\":"   << fragments_tested   << ",";
+        ss << "\"fragments_passed\":"   << fragments_passed;
+        ss << "}";
+        return ss.str();
+    }
+};
+
+// One 8x8 block for a depth tested fill kernel: edge values and depth at
+// its top-left pixel, where its pixels live, and whether the pyramid
+// already proved it in front of everything (accept).
+struct depth_block {
+    int32_t w[3];
+    int32_t a[3], b[3];
+    int32_t width, height;
+    float z, dzdx, dzdy;
+    void* depth;
+    int32_t depth_pitch;
+    uint8_t* pixels;
+    size_t pitch;
+    color paint;
+    bool accept;
+    int32_t tested, passed;
+};
+
+namespace detail {
+
+template <depth_format F, pixel_format P>
+inline void depth_block_scalar(depth_block& b) {
+    using traits = depth_traits<F>;
+    using pixel  = pixel_traits<P>;
+    auto* depth = static_cast<typename traits::type*>(b.depth);
+    uint8_t* pixels = b.pixels;
+    for (int32_t y = 0; y < b.height; y++) {
+        const auto zrow = b.z + b.dzdy * float(y);
+        for (int32_t x = 0; x < b.width; x++) {
+            const auto w0 = b.w[0] + b.a[0] * x + b.b[0] * y;
+            const auto w1 = b.w[1] + b.a[1] * x + b.b[1] * y;
+            const auto w2 = b.w[2] + b.a[2] * x + b.b[2] * y;
+            if ((w0 | w1 | w2) < 0) continue;
+            b.tested++;
+            const auto z = traits::encode(zrow + b.dzdx * float(x));
+            if (!b.accept && !(z < depth[x])) continue;
+            depth[x] = z;
+            pixel::store(pixels + x * pixel::channels, b.paint);
+            b.passed++;
+        }
+        depth += b.depth_pitch;
+        pixels += b.pitch;
+    }
+}
+
+#if defined(TINY_X86)
+// f32 depth only; the integer formats go through the scalar kernel.
+template <pixel_format P>
+TINY_TARGET("avx2")
+inline void depth_block_avx2(depth_block& b) {
+    using pixel = pixel_traits<P>;
+    const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(b.width), lanes);
+    const auto zstep =
+        _mm256_mul_ps(_mm256_set1_ps(b.dzdx), _mm256_cvtepi32_ps(lanes));
+    __m256i w[3];
+    for (int32_t k = 0; k < 3; k++) {
+        const auto step = _mm256_mullo_epi32(_mm256_set1_epi32(b.a[k]), lanes);
+        w[k] = _mm256_add_epi32(_mm256_set1_epi32(b.w[k]), step);
+    }
+    auto* depth = static_cast<float*>(b.depth);
+    uint8_t* pixels = b.pixels;
+    for (int32_t y = 0; y < b.height; y++) {
+        const auto any = _mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]);
+        const auto covered = _mm256_and_si256(
+            _mm256_cmpgt_epi32(any, _mm256_set1_epi32(-1)), valid);
+        const auto cover_mask = _mm256_movemask_ps(_mm256_castsi256_ps(covered));
+        if (cover_mask) {
+            b.tested += simd::popcount(cover_mask);
+            const auto z = _mm256_add_ps(
+                _mm256_set1_ps(b.z + b.dzdy * float(y)), zstep);
+            auto pass = _mm256_castsi256_ps(covered);
+            if (!b.accept) {
+                const auto stored = _mm256_maskload_ps(depth, covered);
+                pass = _mm256_and_ps(pass,
+                                     _mm256_cmp_ps(z, stored, _CMP_LT_OQ));
+            }
+            _mm256_maskstore_ps(depth, _mm256_castps_si256(pass), z);
+            uint32_t mask = _mm256_movemask_ps(pass);
+            b.passed += simd::popcount(mask);
+            for (; mask; mask &= mask - 1)
+                pixel::store(pixels + simd::lowest_bit(mask) * pixel::channels,
+                             b.paint);
+        }
+        for (int32_t k = 0; k < 3; k++)
+            w[k] = _mm256_add_epi32(w[k], _mm256_set1_epi32(b.b[k]));
+        depth += b.depth_pitch;
+        pixels += b.pitch;
+    }
+}
+#endif
+
+template <depth_format F, pixel_format P>
+inline void (*depth_block_kernel(simd::isa isa))(depth_block&) {
+#if defined(TINY_X86)
+    if (F == depth_format::f32 && isa == simd::isa::avx2)
+        return depth_block_avx2<P>;
+#endif
+    return depth_block_scalar<F, P>;
+}
+
+inline int32_t covered(edges const& e, rect const& r) {
+    int32_t count = 0;
+    for (int32_t y = r.y0; y < r.y1; y++)
+        for (int32_t x = r.x0; x < r.x1; x++) {
+            const auto w0 = e.a[0] * x + e.b[0] * y + e.c[0];
+            const auto w1 = e.a[1] * x + e.b[1] * y + e.c[1];
+            const auto w2 = e.a[2] * x + e.b[2] * y + e.c[2];
+            count += (w0 | w1 | w2) >= 0;
+        }
+    return count;
+}
+
+// Walks the 8x8 blocks of a depth tested triangle: the pyramid of depth
+// first gets a chance to drop the whole triangle, then every block that
+// overlaps it. Each block that survives is handed to kernel(b, x0, y0)
+// with its edge values, depth and depth row set, and accept when it is
+// surely in front; the kernel writes the pixels and counts what it tested
+// and passed.
+template <depth_format F, typename Kernel>
+inline void depth_blocks(edges const& e, depth_plane const& z,
+                         depth_buffer& depth, depth_stats* stats,
+                         Kernel&& kernel) {
+    using traits = depth_traits<F>;
+    // Slack for the float rounding between the bounds worked out here and
+    // the per-pixel depth of the kernels.
+    constexpr float slack = 1e-5f;
+    constexpr int32_t size = depth_buffer::tile;
+    const bool hierarchical = depth.is_hierarchical();
+
+    if (stats) stats->triangles++;
+    if (depth.occluded(e.box.x0, e.box.y0, e.box.x1 - 1, e.box.y1 - 1,
+                       z.min - slack)) {
+        if (stats) {
+            stats->triangles_rejected++;
+            stats->fragments_rejected += covered(e, e.box);
+        }
+        return;
+    }
+
+    for (int32_t by = e.box.y0 & ~(size - 1); by < e.box.y1; by += size) {
+        const auto y0 = std::max(by, e.box.y0);
+        const auto y1 = std::min(by + size, e.box.y1);
+        for (int32_t bx = e.box.x0 & ~(size - 1); bx < e.box.x1;
+             bx += size) {
+            const auto x0 = std::max(bx, e.box.x0);
+            const auto x1 = std::min(bx + size, e.box.x1);
+
+            depth_block b;
+            bool empty = false;
+            for (int32_t k = 0; k < 3; k++) {
+                b.w[k] = e.a[k] * x0 + e.b[k] * y0 + e.c[k];
+                b.a[k] = e.a[k];
+                b.b[k] = e.b[k];
+                const auto highest = b.w[k] +
+                                     std::max(e.a[k] * (x1 - 1 - x0), 0) +
+                                     std::max(e.b[k] * (y1 - 1 - y0), 0);
+                if (highest < 0) empty = true;
+            }
+            if (empty) continue;
+            if (stats) stats->blocks++;
+
+            b.z    = z.at(x0, y0);
+            b.dzdx = float(z.dx);
+            b.dzdy = float(z.dy);
+            b.accept = false;
+            const auto tx = bx / size, ty = by / size;
+            float lo = 0.f;
+            if (hierarchical) {
+                const auto c1 = z.at(x1 - 1, y0), c2 = z.at(x0, y1 - 1);
+                const auto c3 = z.at(x1 - 1, y1 - 1);
+                const auto hi = std::min(z.max, std::max({b.z, c1, c2, c3}));
+                lo = std::max(z.min, std::min({b.z, c1, c2, c3})) - slack;
+                if (lo >= depth.tile_max(0, tx, ty)) {
+                    if (stats) {
+                        stats->blocks_rejected++;
+                        stats->fragments_rejected +=
+                            covered(e, rect{x0, y0, x1, y1});
+                    }
+                    continue;
+                }
+                b.accept = traits::encode(hi + slack) <
+                           traits::encode(depth.tile_min(0, tx, ty));
+                if (stats && b.accept) stats->blocks_accepted++;
+            }
+
+            b.width       = x1 - x0;
+            b.height      = y1 - y0;
+            b.depth       = depth.row<F>(y0) + x0;
+            b.depth_pitch = depth.get_width();
+            b.tested = b.passed = 0;
+            kernel(b, x0, y0);
+            if (stats) {
+                stats->fragments_tested += b.tested;
+                stats->fragments_passed += b.passed;
+            }
+            if (b.passed) depth.update_tile(tx, ty, b.passed, lo);
+        }
+    }
+}
+
+template <depth_format F, pixel_format P>
+inline void fill(edges const& e, depth_plane const& z,
+                 image_view<P> const& view, depth_buffer& depth,
+                 color const& color, depth_stats* stats, simd::isa isa) {
+    const auto kernel = depth_block_kernel<F, P>(isa);
+    depth_blocks<F>(e, z, depth, stats,
+                    [&](depth_block& b, int32_t x0, int32_t y0) {
+                        b.pixels = view.pixel(x0, y0);
+                        b.pitch  = view.get_pitch();
+                        b.paint  = color;
+                        kernel(b);
+                    });
+}
+
+// The depth test of depth_block_scalar() with a color from
+// shader(x, y, w0, w1, w2) per pixel that passes, the w being the
+// unbiased edge values as rasterize() gives them.
+template <depth_format F, pixel_format P, typename Shader>
+inline void shade_block(depth_block& b, int32_t x0, int32_t y0,
+                        edges const& e, image_view<P> const& view,
+                        Shader& shader) {
+    using traits = depth_traits<F>;
+    using pixel  = pixel_traits<P>;
+    auto* depth = static_cast<typename traits::type*>(b.depth);
+    uint8_t* pixels = view.pixel(x0, y0);
+    for (int32_t y = 0; y < b.height; y++) {
+        const auto zrow = b.z + b.dzdy * float(y);
+        for (int32_t x = 0; x < b.width; x++) {
+            const auto w0 = b.w[0] + b.a[0] * x + b.b[0] * y;
+            const auto w1 = b.w[1] + b.a[1] * x + b.b[1] * y;
+            const auto w2 = b.w[2] + b.a[2] * x + b.b[2] * y;
+            if ((w0 | w1 | w2) < 0) continue;
+            b.tested++;
+            const auto z = traits::encode(zrow + b.dzdx * float(x));
+            if (!b.accept && !(z < depth[x])) continue;
+            depth[x] = z;
+            pixel::store(pixels + x * pixel::channels,
+                         shader(x0 + x, y0 + y, w0 - e.bias[0],
+                                w1 - e.bias[1], w2 - e.bias[2]));
+            b.passed++;
+        }
+        depth += b.depth_pitch;
+        pixels += view.get_pitch();
+    }
+}
+
+}  // namespace detail
+
+// Depth tested flat color fill. The pyramid of depth first gets a chance
+// to drop the whole triangle, then every 8x8 block that overlaps it; a
+// block that is surely in front skips the depth reads. Blocks that
+// survive go through the per-pixel kernel for isa, AVX2 for f32 depth and
+// scalar otherwise.
+inline void fill(edges const& e, depth_plane const& z, image& image,
+                 depth_buffer& depth, color const& color,
+                 depth_stats* stats = nullptr,
+                 simd::isa isa = simd::active()) {
+    image.visit([&](auto view) {
+        constexpr auto P = decltype(view)::format;
+        switch (depth.get_format()) {
+            case depth_format::f32:
+                detail::fill<depth_format::f32, P>(e, z, view, depth, color,
+                                                   stats, isa);
+                break;
+            case depth_format::u16:
+                detail::fill<depth_format::u16, P>(e, z, view, depth, color,
+                                                   stats, isa);
+                break;
+            case depth_format::u24:
+                detail::fill<depth_format::u24, P>(e, z, view, depth, color,
+                                                   stats, isa);
+                break;
+        }
+    });
+}
+
+// Depth tested fill with a color per pixel from a fragment shader,
+// shader(x, y, w0, w1, w2), called only for the pixels that pass the
+// test, so hidden fragments are never shaded. Blocks go through the same
+// early-Z as the flat fill; the per-pixel test is scalar, as the shader
+// costs far more than the test.
+template <typename Shader>
+inline void shade(edges const& e, depth_plane const& z, image& image,
+                  depth_buffer& depth, Shader&& shader,
+                  depth_stats* stats = nullptr) {
+    image.visit([&](auto view) {
+        constexpr auto P = decltype(view)::format;
+        auto blocks = [&](auto format) {
+            constexpr auto F = decltype(format)::value;
+            detail::depth_blocks<F>(
+                e, z, depth, stats,
+                [&](depth_block& b, int32_t x0, int32_t y0) {
+                    detail::shade_block<F, P>(b, x0, y0, e, view, shader);
+                });
+        };
+        switch (depth.get_format()) {
+            case depth_format::f32:
+                blocks(std::integral_constant<depth_format,
+                                              depth_format::f32>());
+                break;
+            case depth_format::u16:
+                blocks(std::integral_constant<depth_format,
+                                              depth_format::u16>());
+                break;
+            case depth_format::u24:
+                blocks(std::integral_constant<depth_format,
+                                              depth_format::u24>());
+                break;
+        }
+    });
+}
+
+// Same with a depth test against depth, z being the vertex depths.
+inline void triangle(std::array<vec2<int32_t>, 3> const& pts,
+                     std::array<float, 3> const& z, rect const& clip,
+                     image& image, depth_buffer& depth, color const& color,
+                     depth_stats* stats = nullptr) {
+    edges e;
+    if (!setup(pts, clip, e)) return;
+    fill(e, plane(pts, z), image, depth, color, stats);
+}
+
+namespace detail {
+
+inline int64_t floor_div(int64_t n, int64_t d) {
+    const auto q = n / d;
+    return q - ((n % d != 0) && ((n < 0) != (d < 0)));
+}
+
+// The x bound one edge puts on a row, a * x + b * y + c >= 0 solved for
+// x: x >= ceil(v / den) for a > 0 (lower) and x <= floor(v / den) for
+// a < 0, kept as the quotient q and remainder 0 <= r < den of v and
+// stepped by the same split of v's change per row.
+struct edge_walk {
+    int64_t q, r, step_q, step_r, den;
+    bool lower;
+
+    edge_walk() = default;
+    edge_walk(int32_t a, int32_t b, int32_t c, int32_t y) {
+        lower = a > 0;
+        den = lower ? a : -a;
+        const int64_t v = lower ? -(int64_t(b) * y + c) : int64_t(b) * y + c;
+        const int64_t step = lower ? -int64_t(b) : int64_t(b);
+        q = floor_div(v, den);
+        r = v - q * den;
+        step_q = floor_div(step, den);
+        step_r = step - step_q * den;
+    }
+
+    int32_t bound() const { return int32_t(q + (lower && r > 0)); }
+
+    void next() {
+        q += step_q;
+        r += step_r;
+        if (r >= den) {
+            q++;
+            r -= den;
+        }
+    }
+};
+
+}  // namespace detail
+
+// Scanline fill of a set up triangle. Each edge's bound on x is solved
+// once for the top row as an exact quotient and then stepped DDA style,
+// quotient plus remainder, with no division per row; a horizontal edge
+// only trims the rows. The bounds agree with the edge functions, fill
+// rule included, so it writes exactly the pixels fill() does and an edge
+// shared by two triangles is drawn once. Each row is one fill_span().
+template <pixel_format P>
+inline void scanline(edges const& e, image_view<P> const& view,
+                     color const& color) {
+    const auto pattern = pixel_traits<P>::make(color);
+    int32_t y0 = e.box.y0, y1 = e.box.y1;
+    for (int32_t k = 0; k < 3; k++) {
+        if (e.a[k] != 0) continue;
+        // b * y + c >= 0 with b != 0, as the triangle is not degenerate.
+        if (e.b[k] > 0)
+            y0 = std::max(y0, int32_t(-detail::floor_div(e.c[k], e.b[k])));
+        else
+            y1 = std::min(y1,
+                          int32_t(detail::floor_div(e.c[k], -e.b[k]) + 1));
+    }
+    detail::edge_walk walks[3];
+    int32_t count = 0;
+    for (int32_t k = 0; k < 3; k++)
+        if (e.a[k] != 0)
+            walks[count++] = detail::edge_walk(e.a[k], e.b[k], e.c[k], y0);
+    for (int32_t y = y0; y < y1; y++) {
+        int32_t first = e.box.x0, last = e.box.x1 - 1;
+        for (int32_t k = 0; k < count; k++) {
+            auto& w = walks[k];
+            if (w.lower)
+                first = std::max(first, w.bound());
+            else
+                last = std::min(last, w.bound());
+            w.next();
+        }
+        if (first <= last) view.fill_span(first, last + 1, y, pattern);
+    }
+}
+
+inline void scanline(edges const& e, image& image, color const& color) {
+    image.visit([&](auto view) { scanline(e, view, color); });
+}
+
+// Box area in pixels from which a flat triangle goes through scanline()
+// rather than fill(). Below it the per-row bound setup costs more than
+// testing the handful of pixels, above it one exact span per row beats
+// scanning the blocks for coverage at every size measured.
+constexpr int32_t scanline_area = 32;
+
+// Flat-color triangle, the default path: scanline() for all but the
+// smallest triangles, the edge function fill() for those. Both write the
+// same pixels, so the choice never shows.
+inline void triangle(std::array<vec2<int32_t>, 3> const& pts,
+                     rect const& clip, image& image, color const& color) {
+    edges e;
+    if (!setup(pts, clip, e)) return;
+    const auto area = (e.box.x1 - e.box.x0) * (e.box.y1 - e.box.y0);
+    if (area >= scanline_area)
+        scanline(e, image, color);
+    else
+        fill(e, image, color);
+}
+
+}  // namespace raster
+
+}  // namespace tiny
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tiny {
+
+// Fixed pool of worker threads with one deque per worker. parallel_for
+// spreads the items round-robin over the deques; a worker pops from the
+// back of its own deque and steals from the front of the others once it
+// runs dry, so uneven items (busy tiles) balance themselves out.
+// The calling thread takes part as worker 0.
+class scheduler {
+   public:
+    scheduler(uint32_t threads = std::thread::hardware_concurrency())
+        : m_generation(0), m_stop(false), m_job(nullptr), m_call(nullptr),
+          m_pending(0) {
+        if (threads == 0) threads = 1;
+        for (uint32_t i = 0; i < threads; i++)
+            m_queues.push_back(std::make_unique<queue>());
+        for (uint32_t i = 1; i < threads; i++)
+            m_threads.emplace_back([this, i] { worker(i); });
+    }
+    ~scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& thread : m_threads) thread.join();
+    }
+    scheduler(scheduler const&) = delete;
+    scheduler& operator=(scheduler const&) = delete;
+
+   public:
+    uint32_t size() const { return uint32_t(m_queues.size()); }
+
+    // Calls fn(index, worker) for every index in [0, count) and blocks
+    // until all of them returned. worker is in [0, size()). fn is called
+    // through a plain pointer rather than copied into a std::function, so
+    // a steady stream of calls allocates nothing.
+    template <typename Fn>
+    void parallel_for(uint32_t count, Fn const& fn) {
+        if (count == 0) return;
+        if (m_threads.empty()) {
+            for (uint32_t i = 0; i < count; i++) fn(i, 0);
+            return;
+        }
+
+        m_job = &fn;
+        m_call = [](void const* job, uint32_t index, uint32_t worker) {
+            (*static_cast<Fn const*>(job))(index, worker);
+        };
+        m_pending.store(count);
+        for (uint32_t i = 0; i < count; i++) {
+            auto& q = *m_queues[i % m_queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.push(i);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        drain(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_pending.load() == 0; });
+        m_job = nullptr;
+    }
+
+   private:
+    // Items [head, tail) of a vector that is only rewound once empty, so
+    // it keeps its capacity from one parallel_for to the next.
+    struct queue {
+        std::mutex mutex;
+        std::vector<uint32_t> items;
+        size_t head = 0;
+
+        bool empty() const { return head == items.size(); }
+        void push(uint32_t item) {
+            if (empty()) {
+                items.clear();
+                head = 0;
+            }
+            items.push_back(item);
+        }
+        uint32_t pop_back() {
+            const auto item = items.back();
+            items.pop_back();
+            return item;
+        }
+        uint32_t pop_front() { return items[head++]; }
+    };
+
+    bool pop(uint32_t self, uint32_t& item) {
+        auto& own = *m_queues[self];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.empty()) {
+                item = own.pop_back();
+                return true;
+            }
+        }
+        for (uint32_t i = 1; i < m_queues.size(); i++) {
+            auto& victim = *m_queues[(self + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.empty()) {
+                item = victim.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(uint32_t self) {
+        uint32_t item;
+        while (pop(self, item)) {
+            m_call(m_job, item, self);
+            if (m_pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.notify_all();
+            }
+        }
+    }
+
+    void worker(uint32_t self) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock,
+                            [&] { return m_stop || m_generation != seen; });
+                if (m_stop) return;
+                seen = m_generation;
+            }
+            drain(self);
+        }
+    }
+
+   private:
+    std::vector<std::unique_ptr<queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_generation;
+    bool m_stop;
+
+    void const* m_job;
+    void (*m_call)(void const*, uint32_t, uint32_t);
+    std::atomic<uint32_t> m_pending;
+};
+
+}  // namespace tiny
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "tiny.hpp"
+#include "tiny/msaa.hpp"
+#include "tiny/raster.hpp"
+#include "tiny/texture.hpp"
+
+namespace tiny {
+
+// Programmable shading, resolved at compile time. A shader is any type
+// with
+//
+//   struct primitive;  // per-triangle constants, from setup()
+//   struct varying;    // per-vertex outputs, interpolated per fragment
+//   static constexpr bool flat_color;
+//   primitive setup(int32_t face) const;
+//   varying vertex(primitive const&, int32_t face, int32_t corner) const;
+//   color fragment(primitive const&, varying const&) const;
+//
+// and draw() takes it as a template parameter, so fragment() is inlined
+// into the rasterizer's pixel loop rather than called through a pointer.
+// A varying is plain floats (float, vec2<float>, vec3<float> members),
+// which interpolate() blends as one array. With flat_color, fragment() is
+// called once per triangle and the triangle goes through the SIMD flat
+// fill.
+namespace shaders {
+
+// Perspective-correct blend of the varyings of three vertices.
+template <typename V>
+TINY_INLINE V interpolate(vec3<float> const& weights, V const& a, V const& b,
+                          V const& c) {
+    static_assert(std::is_trivially_copyable<V>::value &&
+                      sizeof(V) % sizeof(float) == 0,
+                  "a varying is made of floats");
+    constexpr size_t n = sizeof(V) / sizeof(float);
+    float fa[n], fb[n], fc[n];
+    std::memcpy(fa, &a, sizeof(V));
+    std::memcpy(fb, &b, sizeof(V));
+    std::memcpy(fc, &c, sizeof(V));
+    for (size_t i = 0; i < n; i++)
+        fa[i] = fa[i] * weights.x + fb[i] * weights.y + fc[i] * weights.z;
+    V out;
+    std::memcpy(&out, fa, sizeof(V));
+    return out;
+}
+
+// Draws a piece of face, pts and depth on the screen, depth tested.
+// corners and inv_w are the whole face's screen vertices and 1 / w, which
+// the varyings are interpolated across, so the pieces clipping cuts off a
+// face shade as the face does.
+template <typename Shader>
+void draw(Shader const& shader, int32_t face,
+          std::array<vec2<int32_t>, 3> const& pts,
+          std::array<float, 3> const& depth,
+          std::array<vec2<int32_t>, 3> const& corners,
+          std::array<float, 3> const& inv_w, rect const& clip, image& image,
+          depth_buffer& zbuffer, raster::depth_stats* stats = nullptr) {
+    raster::edges e;
+    if (!raster::setup(pts, clip, e)) return;
+    const auto primitive = shader.setup(face);
+    const typename Shader::varying v[3] = {shader.vertex(primitive, face, 0),
+                                           shader.vertex(primitive, face, 1),
+                                           shader.vertex(primitive, face, 2)};
+    const auto z = raster::plane(pts, depth);
+    if constexpr (Shader::flat_color) {
+        raster::fill(e, z, image, zbuffer, shader.fragment(primitive, v[0]),
+                     stats);
+    } else {
+        const auto weights = raster::perspective_weights(corners, inv_w);
+        raster::shade(
+            e, z, image, zbuffer,
+            [&](int32_t x, int32_t y, int32_t, int32_t, int32_t) {
+                return shader.fragment(
+                    primitive, interpolate(weights.at(x, y), v[0], v[1], v[2]));
+            },
+            stats);
+    }
+}
+
+// Same into the samples of target: the shader still runs once per pixel,
+// flat_color ones once per triangle.
+template <typename Shader>
+void draw(Shader const& shader, int32_t face,
+          std::array<vec2<int32_t>, 3> const& pts,
+          std::array<float, 3> const& depth,
+          std::array<vec2<int32_t>, 3> const& corners,
+          std::array<float, 3> const& inv_w, rect const& clip,
+          msaa_buffer& target, raster::depth_stats* stats = nullptr) {
+    raster::edges e;
+    if (!raster::setup(pts, clip, e)) return;
+    const auto primitive = shader.setup(face);
+    const typename Shader::varying v[3] = {shader.vertex(primitive, face, 0),
+                                           shader.vertex(primitive, face, 1),
+                                           shader.vertex(primitive, face, 2)};
+    const auto z = raster::plane(pts, depth);
+    if constexpr (Shader::flat_color) {
+        const auto c = shader.fragment(primitive, v[0]);
+        msaa::shade(
+            e, z, target,
+            [&c](int32_t, int32_t, int32_t, int32_t, int32_t) { return c; },
+            stats);
+    } else {
+        const auto weights = raster::perspective_weights(corners, inv_w);
+        msaa::shade(
+            e, z, target,
+            [&](int32_t x, int32_t y, int32_t, int32_t, int32_t) {
+                return shader.fragment(
+                    primitive, interpolate(weights.at(x, y), v[0], v[1], v[2]));
+            },
+            stats);
+    }
+}
+
+// What the shipped shaders read: the model's vertex streams, the screen
+// vertices of the frame, the light and the diffuse map. Normals point
+// out of the surface and the light travels along light_dir, so a surface
+// facing the light has -dot(n, light_dir) = 1.
+struct scene {
+    model const* mesh = nullptr;
+    span<vec2<int32_t> const> pts;
+    vec3<float> light_dir{0, 0, -1};
+    texture const* diffuse = nullptr;
+    texture_filter filter = texture_filter::bilinear;
+};
+
+namespace detail {
+
+TINY_INLINE float lit(vec3<float> const& n, vec3<float> const& light_dir) {
+    return std::min(1.f, std::max(0.f, -math::dot(n, light_dir)));
+}
+
+TINY_INLINE color grey(float intensity) {
+    const auto c = uint8_t(intensity * 255.f);
+    return color(c, c, c);
+}
+
+}  // namespace detail
+
+// lesson2's shading: one light per face from its geometric normal.
+struct flat {
+    struct primitive {
+        color paint;
+    };
+    struct varying {
+        float unused;
+    };
+    static constexpr bool flat_color = true;
+
+    scene const& s;
+
+    primitive setup(int32_t face) const {
+        const auto positions = s.mesh->positions();
+        const auto f = s.mesh->face_indices(face);
+        auto const& a = positions[f[0]];
+        const auto n = math::normalise(
+            math::cross(positions[f[2]] - a, positions[f[1]] - a));
+        const auto c = uint8_t(std::max(0.f, math::dot(n, s.light_dir)) * 255.);
+        return {color(c, c, c)};
+    }
+    varying vertex(primitive const&, int32_t, int32_t) const { return {0.f}; }
+    color fragment(primitive const& p, varying const&) const { return p.paint; }
+};
+
+// Light per vertex from the file's normals, blended across the face.
+struct gouraud {
+    struct primitive {};
+    struct varying {
+        float light;
+    };
+    static constexpr bool flat_color = false;
+
+    scene const& s;
+
+    primitive setup(int32_t) const { return {}; }
+    varying vertex(primitive const&, int32_t face, int32_t corner) const {
+        const auto v = s.mesh->face_indices(face)[corner];
+        return {detail::lit(s.mesh->normals()[v], s.light_dir)};
+    }
+    color fragment(primitive const&, varying const& v) const {
+        return detail::grey(std::min(1.f, std::max(0.f, v.light)));
+    }
+};
+
+// The normal blended across the face and lit per fragment.
+struct phong {
+    struct primitive {};
+    struct varying {
+        vec3<float> normal;
+    };
+    static constexpr bool flat_color = false;
+
+    scene const& s;
+
+    primitive setup(int32_t) const { return {}; }
+    varying vertex(primitive const&, int32_t face, int32_t corner) const {
+        return {s.mesh->normals()[s.mesh->face_indices(face)[corner]]};
+    }
+    color fragment(primitive const&, varying const& v) const {
+        return detail::grey(
+            detail::lit(math::normalise(v.normal), s.light_dir));
+    }
+};
+
+// Phong lighting of the diffuse map, sampled at the mip level where a
+// pixel of the face takes in about one texel.
+struct textured {
+    struct primitive {
+        int32_t level;
+    };
+    struct varying {
+        vec2<float> uv;
+        vec3<float> normal;
+    };
+    static constexpr bool flat_color = false;
+
+    scene const& s;
+
+    primitive setup(int32_t face) const {
+        const auto f = s.mesh->face_indices(face);
+        const auto uvs = s.mesh->uvs();
+        const auto uv_area =
+            std::abs(math::cross(uvs[f[1]] - uvs[f[0]], uvs[f[2]] - uvs[f[0]])) /
+            2.f;
+        auto const &a = s.pts[f[0]], &b = s.pts[f[1]], &c = s.pts[f[2]];
+        const double pixel_area =
+            std::abs(double(b.x - a.x) * (c.y - a.y) -
+                     double(b.y - a.y) * (c.x - a.x)) / 2;
+        return {s.diffuse->level_for(uv_area, float(pixel_area))};
+    }
+    varying vertex(primitive const&, int32_t face, int32_t corner) const {
+        const auto v = s.mesh->face_indices(face)[corner];
+        return {s.mesh->uvs()[v], s.mesh->normals()[v]};
+    }
+    color fragment(primitive const& p, varying const& v) const {
+        const float l = detail::lit(math::normalise(v.normal), s.light_dir);
+        const auto t = s.diffuse->sample(v.uv, p.level, s.filter);
+        return color(uint8_t((t & 0xFF) * l), uint8_t((t >> 8 & 0xFF) * l),
+                     uint8_t((t >> 16 & 0xFF) * l));
+    }
+};
+
+}  // namespace shaders
+
+}  // namespace tiny
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define TINY_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// Compiles a single function for a newer instruction set than the rest of
+// the build. MSVC emits any intrinsic without it.
+#if defined(TINY_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TINY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TINY_TARGET(isa)
+#endif
+
+namespace tiny {
+
+namespace simd {
+
+enum class isa { scalar, sse41, avx2 };
+
+inline char const* name(isa value) {
+    switch (value) {
+        case isa::sse41: return "sse4.1";
+        case isa::avx2:  return "avx2";
+        default:         return "scalar";
+    }
+}
+
+// Best instruction set the CPU and OS support, from CPUID.
+inline isa detect() {
+#if defined(TINY_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int32_t leaves = info[0];
+    __cpuid(info, 1);
+    const bool sse41   = info[2] & (1 << 19);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx     = info[2] & (1 << 28);
+    bool avx2 = false;
+    if (leaves >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = info[1] & (1 << 5);
+    }
+    if (avx2) return isa::avx2;
+    if (sse41) return isa::sse41;
+#elif defined(TINY_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return isa::avx2;
+    if (__builtin_cpu_supports("sse4.1")) return isa::sse41;
+#endif
+    return isa::scalar;
+}
+
+// Instruction set used by the dispatching kernels. TINY_SIMD=scalar,
+// sse4.1 or avx2 lowers it for validation; it never goes above detect().
+inline isa active() {
+    static const isa selected = [] {
+        const auto best = detect();
+        char const* env = std::getenv("TINY_SIMD");
+        if (!env) return best;
+        for (auto candidate : {isa::scalar, isa::sse41, isa::avx2})
+            if (name(candidate) == std::string(env))
+                return candidate < best ? candidate : best;
+        return best;
+    }();
+    return selected;
+}
+
+// Index of the lowest / highest set bit of a non-zero mask.
+inline int32_t lowest_bit(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int32_t(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline int32_t highest_bit(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return int32_t(index);
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+inline int32_t popcount(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return int32_t(__popcnt(mask));
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+}  // namespace simd
+
+}  // namespace tiny
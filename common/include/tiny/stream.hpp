@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tiny.hpp"
+#include "tiny/profile.hpp"
+
+namespace tiny {
+
+// Drawing meshes too large to load. model holds every face before the
+// first is drawn; here a thread of its own reads the OBJ through a fixed
+// window and hands its triangles on in batches of a fixed size, which the
+// caller transforms and rasterizes while the next ones are parsed.
+//
+// Faces are passed on as soon as they are read and then forgotten, so
+// memory no longer grows with the face count or the file size. Positions
+// have to be kept: OBJ faces index every vertex above them. That table is
+// 12 bytes a vertex, a fraction of the text it comes from.
+namespace stream {
+
+// Fixed capacity FIFO between threads: push() blocks while it is full and
+// pop() while it is empty. Once closed, pop() hands out what is left and
+// then returns false, and push() refuses. The slots are made up front, so
+// moving a batch through allocates nothing.
+template <typename T>
+class bounded_queue {
+   public:
+    explicit bounded_queue(size_t capacity)
+        : m_slots(std::max<size_t>(1, capacity)), m_head(0), m_size(0),
+          m_closed(false) {}
+    bounded_queue(bounded_queue const&) = delete;
+    bounded_queue& operator=(bounded_queue const&) = delete;
+
+   public:
+    bool push(T&& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space.wait(lock,
+                     [this] { return m_closed || m_size < m_slots.size(); });
+        if (m_closed) return false;
+        m_slots[(m_head + m_size) % m_slots.size()] = std::move(item);
+        m_size++;
+        lock.unlock();
+        m_ready.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_closed || m_size > 0; });
+        if (m_size == 0) return false;
+        item = std::move(m_slots[m_head]);
+        m_head = (m_head + 1) % m_slots.size();
+        m_size--;
+        lock.unlock();
+        m_space.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_ready.notify_all();
+        m_space.notify_all();
+    }
+
+    size_t capacity() const { return m_slots.size(); }
+
+   private:
+    std::vector<T> m_slots;
+    size_t m_head;
+    size_t m_size;
+    bool m_closed;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_space;
+};
+
+// Triangles in file order, as the positions of their corners, three each.
+struct batch {
+    std::vector<vec3<float>> corners;
+
+    size_t triangles() const { return corners.size() / 3; }
+    span<vec3<float> const> positions() const { return corners; }
+};
+
+// Every position read so far, in chunks that stay where they are: the
+// table grows without copying what it holds, and without the moment a
+// growing vector has both its old and new storage.
+class position_table {
+   public:
+    static constexpr uint32_t chunk_bits = 16;
+    static constexpr size_t chunk = size_t(1) << chunk_bits;
+
+    void push_back(vec3<float> const& p) {
+        if ((m_size & (chunk - 1)) == 0)
+            m_chunks.push_back(std::make_unique<vec3<float>[]>(chunk));
+        m_chunks.back()[m_size & (chunk - 1)] = p;
+        m_size++;
+    }
+
+    vec3<float> const& operator[](size_t i) const {
+        return m_chunks[i >> chunk_bits][i & (chunk - 1)];
+    }
+
+    size_t size() const { return m_size; }
+    size_t bytes() const { return m_chunks.size() * chunk * sizeof(vec3<float>); }
+
+   private:
+    std::vector<std::unique_ptr<vec3<float>[]>> m_chunks;
+    size_t m_size = 0;
+};
+
+// Reads the "v" and "f" lines of an OBJ a window at a time. Polygons are
+// fanned out from their first corner and one with a position out of
+// range is dropped, as model does, so the triangles come out as model's
+// faces are, in the same order. Texture and normal indices are skipped.
+class obj_reader {
+   public:
+    static constexpr size_t window = size_t(1) << 20;
+
+    obj_reader() = default;
+    ~obj_reader() {
+        if (m_file) std::fclose(m_file);
+    }
+    obj_reader(obj_reader const&) = delete;
+    obj_reader& operator=(obj_reader const&) = delete;
+
+   public:
+    bool open(std::string const& filename) {
+        m_file = std::fopen(filename.c_str(), "rb");
+        m_buffer.resize(window);
+        m_polygon.reserve(16);
+        return m_file != nullptr;
+    }
+
+    // Refills out with up to count triangles; false once there are none
+    // left. A polygon that does not fit carries over to the next batch.
+    bool next(batch& out, size_t count) {
+        out.corners.clear();
+        for (;;) {
+            for (; m_fan + 1 < m_polygon.size(); m_fan++) {
+                if (out.triangles() == count) return true;
+                out.corners.push_back(m_polygon[0]);
+                out.corners.push_back(m_polygon[m_fan]);
+                out.corners.push_back(m_polygon[m_fan + 1]);
+            }
+            char const *begin, *end;
+            if (!line(begin, end)) return !out.corners.empty();
+            parse(begin, end);
+        }
+    }
+
+    uint64_t bytes_read() const { return m_read; }
+    position_table const& positions() const { return m_positions; }
+
+   private:
+    // The next line, without its line break; false at the end of the
+    // file. The part of a line at the end of the window moves to its
+    // front before the file is read on behind it, and a line longer than
+    // the whole window grows it.
+    bool line(char const*& begin, char const*& end) {
+        for (;;) {
+            char* data = m_buffer.data();
+            if (auto* eol = static_cast<char*>(
+                    std::memchr(data + m_begin, '\n', m_end - m_begin))) {
+                begin = data + m_begin;
+                end   = eol;
+                m_begin = size_t(eol - data) + 1;
+                return true;
+            }
+            if (m_eof) {
+                if (m_begin == m_end) return false;
+                begin = data + m_begin;
+                end   = data + m_end;
+                m_begin = m_end;
+                return true;
+            }
+            const size_t rest = m_end - m_begin;
+            std::memmove(data, data + m_begin, rest);
+            m_begin = 0;
+            m_end = rest;
+            if (m_end == m_buffer.size()) m_buffer.resize(m_buffer.size() * 2);
+            const auto n = std::fread(m_buffer.data() + m_end, 1,
+                                      m_buffer.size() - m_end, m_file);
+            m_end  += n;
+            m_read += n;
+            m_eof = n == 0;
+        }
+    }
+
+    void parse(char const* begin, char const* end) {
+        const auto length = end - begin;
+        if (length > 2 && begin[0] == 'v' && begin[1] == ' ') {
+            vec3<float> position{0.f, 0.f, 0.f};
+            detail::parse_floats(begin + 2, end, position.raw, 3);
+            m_positions.push_back(position);
+        } else if (length > 2 && begin[0] == 'f' && begin[1] == ' ') {
+            m_polygon.clear();
+            m_fan = 1;
+            bool valid = true;
+            char const* p = detail::skip_blanks(begin + 2, end);
+            while (p < end) {
+                int32_t idx;
+                char const* next = detail::parse_int(p, end, idx);
+                if (!next) break;
+                const int64_t i = idx > 0 ? int64_t(idx) - 1
+                                          : int64_t(m_positions.size()) + idx;
+                if (idx == 0 || i < 0 || i >= int64_t(m_positions.size()))
+                    valid = false;
+                else if (valid)
+                    m_polygon.push_back(m_positions[size_t(i)]);
+                p = next;
+                while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+                p = detail::skip_blanks(p, end);
+            }
+            if (!valid) m_polygon.clear();
+        }
+    }
+
+   private:
+    std::FILE* m_file = nullptr;
+    std::vector<char> m_buffer;
+    size_t m_begin = 0, m_end = 0;
+    bool m_eof = false;
+    uint64_t m_read = 0;
+    position_table m_positions;
+    std::vector<vec3<float>> m_polygon;
+    size_t m_fan = 0;
+};
+
+// Where a streamed draw spent its time. The reader's time is its own
+// thread's; with the queue never empty the consumer waits for nothing
+// and parsing is hidden behind drawing entirely.
+struct stats {
+    uint64_t bytes = 0;
+    uint64_t vertices = 0;
+    uint64_t triangles = 0;
+    uint64_t batches = 0;
+    size_t batch_triangles = 0;
+    size_t depth = 0;
+    size_t table_bytes = 0;  // of the position table
+    size_t batch_bytes = 0;  // of every batch, queued or not
+    double ms = 0;
+    double parse_ms = 0;          // reading and parsing
+    double producer_wait_ms = 0;  // the reader waiting for a free batch
+    double consumer_wait_ms = 0;  // the caller waiting for a parsed one
+
+    double triangles_per_second() const {
+        return ms > 0 ? triangles / (ms / 1e3) : 0;
+    }
+    double megabytes_per_second() const {
+        return ms > 0 ? bytes / 1e6 / (ms / 1e3) : 0;
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::stream::stats\",";
+        ss << "\"bytes\":"            << bytes            << ",";
+        ss << "\"vertices\":"         << vertices         << ",";
+        ss << "\"triangles\":"        << triangles        << ",";
+        ss << "\"batches\":"          << batches          << ",";
+        ss << "\"batch_triangles\":"  << batch_triangles  << ",";
+        ss << "\"depth\":"            << depth            << ",";
+        ss << "\"table_bytes\":"      << table_bytes      << ",";
+        ss << "\"batch_bytes\":"      << batch_bytes      << ",";
+        ss << "\"ms\":"               << ms               << ",";
+        ss << "\"parse_ms\":"         << parse_ms         << ",";
+        ss << "\"producer_wait_ms\":" << producer_wait_ms << ",";
+        ss << "\"consumer_wait_ms\":" << consumer_wait_ms << ",";
+        ss << "\"triangles_per_second\":" << triangles_per_second() << ",";
+        ss << "\"megabytes_per_second\":" << megabytes_per_second();
+        ss << "}";
+        return ss.str();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, stats const& s) {
+        return os << s.json();
+    }
+};
+
+// Reads filename on a thread of its own and calls consume(batch const&)
+// on the calling thread with its triangles, triangles at a time in file
+// order. At most depth parsed batches wait, and depth + 2 exist in all,
+// allocated before the first is read. False if the file cannot be opened.
+template <typename Consume>
+bool run(std::string const& filename, size_t triangles, size_t depth,
+         Consume&& consume, stats& out) {
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    obj_reader reader;
+    if (!reader.open(filename)) return false;
+    const auto start = clock::now();
+    triangles = std::max<size_t>(1, triangles);
+    depth = std::max<size_t>(1, depth);
+    out = {};
+    out.batch_triangles = triangles;
+    out.depth = depth;
+
+    bounded_queue<batch> parsed(depth), free(depth + 2);
+    for (size_t i = 0; i < depth + 2; i++) {
+        batch b;
+        b.corners.reserve(triangles * 3);
+        out.batch_bytes += b.corners.capacity() * sizeof(vec3<float>);
+        free.push(std::move(b));
+    }
+
+    std::thread producer([&] {
+        batch b;
+        for (;;) {
+            const auto waited = clock::now();
+            if (!free.pop(b)) break;
+            const auto begin = clock::now();
+            bool more;
+            {
+                TINY_PROFILE_SCOPE("parse");
+                more = reader.next(b, triangles);
+            }
+            const auto end = clock::now();
+            out.producer_wait_ms += ms(begin - waited).count();
+            out.parse_ms += ms(end - begin).count();
+            if (!more) break;
+            out.triangles += b.triangles();
+            out.batches++;
+            parsed.push(std::move(b));
+            out.producer_wait_ms += ms(clock::now() - end).count();
+        }
+        parsed.close();
+    });
+
+    batch b;
+    for (;;) {
+        const auto waited = clock::now();
+        if (!parsed.pop(b)) break;
+        out.consumer_wait_ms += ms(clock::now() - waited).count();
+        consume(static_cast<batch const&>(b));
+        free.push(std::move(b));
+    }
+    producer.join();
+
+    out.bytes = reader.bytes_read();
+    out.vertices = reader.positions().size();
+    out.table_bytes = reader.positions().bytes();
+    out.ms = ms(clock::now() - start).count();
+    return true;
+}
+
+}  // namespace stream
+
+}  // namespace tiny
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "stb/stb_image.h"
+#include "tiny.hpp"
+#include "tiny/memory.hpp"
+
+namespace tiny {
+
+enum class texture_layout { linear, tiled };
+enum class texture_filter { nearest, bilinear };
+
+inline char const* name(texture_layout layout) {
+    return layout == texture_layout::tiled ? "tiled" : "linear";
+}
+
+inline char const* name(texture_filter filter) {
+    return filter == texture_filter::bilinear ? "bilinear" : "nearest";
+}
+
+// RGBA8 texture with its chain of mip levels, each half the size of the
+// one above down to 1x1, box filtered once at construction. Texel (0, 0)
+// is the bottom left, where uv (0, 0) is in an OBJ file, and uv outside
+// [0, 1] clamps to the edge.
+//
+// A triangle seldom walks a texture along its rows, so the tiled layout
+// stores each level as 4x4 texel tiles of one 64 byte cache line each:
+// a footprint of any direction touches a handful of lines rather than
+// one per texel row. The mip chain keeps minified triangles from striding
+// over the texture; sampling a level where a pixel covers about one texel
+// keeps the footprint, and the bandwidth, to the pixels drawn.
+class texture {
+   public:
+    static constexpr int32_t tile = 4;
+
+    texture() = default;
+
+    // rgba holds width x height pixels of 4 bytes, top row first, as
+    // images are stored. Without mipmaps there is only level 0.
+    texture(int32_t width, int32_t height, uint8_t const* rgba,
+            texture_layout layout = texture_layout::tiled,
+            bool mipmaps = true)
+        : m_layout(layout) {
+        size_t texels = 0;
+        for (int32_t w = width, h = height;; w = std::max(1, w / 2),
+                     h = std::max(1, h / 2)) {
+            level l;
+            l.width  = w;
+            l.height = h;
+            l.tiles  = (w + tile - 1) / tile;
+            l.offset = texels;
+            texels += layout == texture_layout::tiled
+                          ? size_t(l.tiles) * ((h + tile - 1) / tile) *
+                                tile * tile
+                          : size_t(w) * h;
+            m_levels.push_back(l);
+            if (!mipmaps || (w == 1 && h == 1)) break;
+        }
+        m_size = texels;
+        m_texels = static_cast<uint32_t*>(
+            memory::allocate(m_size * sizeof(uint32_t)));
+        std::memset(m_texels, 0, m_size * sizeof(uint32_t));
+
+        for (int32_t y = 0; y < height; y++) {
+            auto const* row = rgba + size_t(height - 1 - y) * width * 4;
+            for (int32_t x = 0; x < width; x++)
+                std::memcpy(&m_texels[index(m_levels[0], x, y)], row + x * 4,
+                            4);
+        }
+        for (size_t i = 1; i < m_levels.size(); i++)
+            downsample(m_levels[i - 1], m_levels[i]);
+    }
+
+    ~texture() {
+        if (m_texels) memory::release(m_texels);
+    }
+    texture(texture&& other) noexcept { *this = std::move(other); }
+    texture& operator=(texture&& other) noexcept {
+        std::swap(m_texels, other.m_texels);
+        std::swap(m_size, other.m_size);
+        std::swap(m_levels, other.m_levels);
+        std::swap(m_layout, other.m_layout);
+        return *this;
+    }
+    texture(texture const&) = delete;
+    texture& operator=(texture const&) = delete;
+
+    // Any file stb_image reads: PNG, TGA, JPEG, BMP, PNM and the like. An
+    // empty texture when it cannot.
+    static texture load(std::string const& filename,
+                        texture_layout layout = texture_layout::tiled,
+                        bool mipmaps = true) {
+        int32_t width, height, channels;
+        auto* pixels = stbi_load(filename.c_str(), &width, &height, &channels,
+                                 4);
+        if (!pixels) return texture();
+        texture out(width, height, pixels, layout, mipmaps);
+        stbi_image_free(pixels);
+        return out;
+    }
+
+    bool empty() const { return m_levels.empty(); }
+    int32_t get_width()  const { return empty() ? 0 : m_levels[0].width;  }
+    int32_t get_height() const { return empty() ? 0 : m_levels[0].height; }
+    int32_t levels() const { return int32_t(m_levels.size()); }
+    texture_layout get_layout() const { return m_layout; }
+    size_t bytes() const { return m_size * sizeof(uint32_t); }
+
+    // Texel (x, y) of a level as RGBA bytes in a little endian word.
+    uint32_t texel(int32_t level, int32_t x, int32_t y) const {
+        auto const& l = m_levels[level];
+        x = std::min(std::max(x, 0), l.width - 1);
+        y = std::min(std::max(y, 0), l.height - 1);
+        return m_texels[index(l, x, y)];
+    }
+
+    // The level where one pixel of a triangle covering pixel_area pixels
+    // and uv_area of the unit uv square takes in about one texel, picked
+    // once per triangle.
+    int32_t level_for(float uv_area, float pixel_area) const {
+        if (empty()) return 0;
+        if (!(pixel_area > 0.f)) return levels() - 1;
+        const float texels = uv_area * float(get_width()) * get_height();
+        const float lod = .5f * std::log2(std::max(texels / pixel_area, 1e-9f));
+        return std::min(std::max(int32_t(std::floor(lod + .5f)), 0),
+                        levels() - 1);
+    }
+
+    // RGBA of level at uv, as one word like texel().
+    uint32_t sample(vec2<float> const& uv, int32_t level,
+                    texture_filter filter) const {
+        auto const& l = m_levels[level];
+        const float u = uv.x * float(l.width), v = uv.y * float(l.height);
+        if (filter == texture_filter::nearest)
+            return texel(level, floor(u), floor(v));
+        // Texel centres sit at half integers; weights in 1/256ths.
+        const auto x = floor(u - .5f), y = floor(v - .5f);
+        const auto wx = uint32_t((u - .5f - float(x)) * 256.f);
+        const auto wy = uint32_t((v - .5f - float(y)) * 256.f);
+        const auto x0 = std::min(std::max(x, 0), l.width - 1);
+        const auto x1 = std::min(std::max(x + 1, 0), l.width - 1);
+        const auto y0 = std::min(std::max(y, 0), l.height - 1);
+        const auto y1 = std::min(std::max(y + 1, 0), l.height - 1);
+        const auto bottom = lerp(m_texels[index(l, x0, y0)],
+                                 m_texels[index(l, x1, y0)], wx);
+        const auto top = lerp(m_texels[index(l, x0, y1)],
+                              m_texels[index(l, x1, y1)], wx);
+        return lerp(bottom, top, wy);
+    }
+
+    color sample_color(vec2<float> const& uv, int32_t level,
+                       texture_filter filter) const {
+        const auto t = sample(uv, level, filter);
+        return color(uint8_t(t), uint8_t(t >> 8), uint8_t(t >> 16),
+                     uint8_t(t >> 24));
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{";
+        ss << "\"_type\":\"tiny::texture\",";
+        ss << "\"width\":"  << get_width()      << ",";
+        ss << "\"height\":" << get_height()     << ",";
+        ss << "\"levels\":" << levels()         << ",";
+        ss << "\"layout\":\"" << name(m_layout) << "\",";
+        ss << "\"bytes\":"  << bytes();
+        ss << "}";
+        return ss.str();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, texture const& t) {
+        return os << t.json();
+    }
+
+   private:
+    struct level {
+        int32_t width, height;
+        int32_t tiles;  // per row of tiles
+        size_t offset;  // first texel in m_texels
+    };
+
+    size_t index(level const& l, int32_t x, int32_t y) const {
+        if (m_layout == texture_layout::linear)
+            return l.offset + size_t(y) * l.width + x;
+        // x and y are never negative: shifts and masks for the tile of 4.
+        const auto tile_index = size_t(y >> 2) * l.tiles + (x >> 2);
+        return l.offset + (tile_index << 4) + ((y & 3) << 2) + (x & 3);
+    }
+
+    // std::floor() is a library call short of SSE4.1; texel coordinates
+    // stay well inside int32_t.
+    static int32_t floor(float v) {
+        const auto i = int32_t(v);
+        return i - (v < float(i));
+    }
+
+    // a + (b - a) * w / 256 per byte, two bytes of each word at a time:
+    // the products of a byte and a weight up to 256 fit the 16 bits apart
+    // from the next byte.
+    static uint32_t lerp(uint32_t a, uint32_t b, uint32_t w) {
+        const uint32_t rb =
+            (((a & 0x00FF00FF) * (256 - w) + (b & 0x00FF00FF) * w) >> 8) &
+            0x00FF00FF;
+        const uint32_t ga = (((a >> 8) & 0x00FF00FF) * (256 - w) +
+                             ((b >> 8) & 0x00FF00FF) * w) &
+                            0xFF00FF00;
+        return rb | ga;
+    }
+
+    // Each texel of to is the rounded mean of the 2x2 of from under it,
+    // edge texels repeated where from has an odd size.
+    void downsample(level const& from, level const& to) {
+        for (int32_t y = 0; y < to.height; y++)
+            for (int32_t x = 0; x < to.width; x++) {
+                const int32_t x0 = std::min(x * 2, from.width - 1);
+                const int32_t x1 = std::min(x * 2 + 1, from.width - 1);
+                const int32_t y0 = std::min(y * 2, from.height - 1);
+                const int32_t y1 = std::min(y * 2 + 1, from.height - 1);
+                const uint32_t quad[4] = {
+                    m_texels[index(from, x0, y0)], m_texels[index(from, x1, y0)],
+                    m_texels[index(from, x0, y1)], m_texels[index(from, x1, y1)]};
+                uint32_t out = 0;
+                for (int32_t c = 0; c < 32; c += 8) {
+                    uint32_t sum = 2;
+                    for (auto t : quad) sum += (t >> c) & 0xFF;
+                    out |= (sum / 4) << c;
+                }
+                m_texels[index(to, x, y)] = out;
+            }
+    }
+
+    uint32_t* m_texels = nullptr;
+    size_t m_size = 0;
+    std::vector<level> m_levels;
+    texture_layout m_layout = texture_layout::tiled;
+};
+
+}  // namespace tiny
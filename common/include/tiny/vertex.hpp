@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "tiny.hpp"
+#include "tiny/matrix.hpp"
+#include "tiny/simd.hpp"
+
+namespace tiny {
+
+// The vertex stage: model positions through one combined matrix, usually
+// viewport * projection * view * model, then the divide by w, in a single
+// pass. It writes what the rasterizer consumes, pixel coordinates
+// truncated to integers and a float depth.
+//
+// T is the precision of the arithmetic. Every kernel computes
+// ((m0 * x + m1 * y) + m2 * z) + m3 per row and divides by w, without
+// fused multiply-adds, so the SIMD blocks give the scalar loop's results
+// bit for bit. An affine matrix has w = 1 everywhere: its w row and the
+// divides, which dominate the cost, are skipped.
+//
+// With a projection, a vertex at or behind the eye (w <= near_w) has no
+// screen position: it comes out at (0, 0) with depth behind and 1 / w 0,
+// and cull::triangle rejects every triangle using it. Screen coordinates
+// are clamped to +-max_coordinate, with a projection or without, so a
+// vertex just in front of the eye or far off an affine viewport still
+// converts to an integer.
+namespace vertex {
+
+constexpr float near_w = 1e-5f;
+constexpr float behind = -std::numeric_limits<float>::infinity();
+constexpr int32_t max_coordinate = 1 << 30;
+
+namespace detail {
+
+// Whether the bottom row is 0 0 0 1, as for every matrix without a
+// perspective projection.
+template <typename T>
+inline bool is_affine(mat4<T> const& m) {
+    return m.m[3][0] == T(0) && m.m[3][1] == T(0) && m.m[3][2] == T(0) &&
+           m.m[3][3] == T(1);
+}
+
+// N positions of a block split into one array per coordinate.
+template <int32_t N>
+struct soa_block {
+    alignas(32) float x[N];
+    alignas(32) float y[N];
+    alignas(32) float z[N];
+
+    explicit soa_block(vec3<float> const* in) {
+        for (int32_t i = 0; i < N; i++) {
+            x[i] = in[i].x;
+            y[i] = in[i].y;
+            z[i] = in[i].z;
+        }
+    }
+};
+
+template <typename T>
+inline void transform_scalar(vec3<float> const* in, size_t count,
+                             mat4<T> const& m, vec2<int32_t>* pts,
+                             float* depth, float* inv_w) {
+    auto row = [&m](int32_t r, vec3<float> const& v) {
+        return m.m[r][0] * T(v.x) + m.m[r][1] * T(v.y) + m.m[r][2] * T(v.z) +
+               m.m[r][3];
+    };
+    // NaN clamps to the low end, as the SIMD max does.
+    auto screen = [](T v) {
+        v = v > T(-max_coordinate) ? v : T(-max_coordinate);
+        return int32_t(v < T(max_coordinate) ? v : T(max_coordinate));
+    };
+    if (is_affine(m)) {
+        for (size_t i = 0; i < count; i++) {
+            pts[i] = {screen(row(0, in[i])), screen(row(1, in[i]))};
+            depth[i] = float(row(2, in[i]));
+            if (inv_w) inv_w[i] = 1.f;
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const T w = row(3, in[i]);
+        if (!(w > T(near_w))) {
+            pts[i] = {0, 0};
+            depth[i] = behind;
+            if (inv_w) inv_w[i] = 0.f;
+            continue;
+        }
+        pts[i] = {screen(row(0, in[i]) / w), screen(row(1, in[i]) / w)};
+        depth[i] = float(row(2, in[i]) / w);
+        if (inv_w) inv_w[i] = float(T(1) / w);
+    }
+}
+
+#if defined(TINY_X86)
+// Blocks of 4 in float. Returns how many positions it did.
+TINY_TARGET("sse4.1")
+inline size_t transform_sse41(vec3<float> const* in, size_t count,
+                              mat4<float> const& m, vec2<int32_t>* pts,
+                              float* depth, float* inv_w) {
+    __m128 c[4][4];
+    for (int32_t r = 0; r < 4; r++)
+        for (int32_t k = 0; k < 4; k++) c[r][k] = _mm_set1_ps(m.m[r][k]);
+    const bool affine = is_affine(m);
+    const int32_t rows = affine ? 3 : 4;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const detail::soa_block<4> block(in + i);
+        const auto x = _mm_load_ps(block.x);
+        const auto y = _mm_load_ps(block.y);
+        const auto z = _mm_load_ps(block.z);
+        __m128 clip[4];
+        for (int32_t r = 0; r < rows; r++)
+            clip[r] = _mm_add_ps(
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r][0], x),
+                                      _mm_mul_ps(c[r][1], y)),
+                           _mm_mul_ps(c[r][2], z)),
+                c[r][3]);
+        __m128 rcp = _mm_set1_ps(1.f);
+        if (!affine) {
+            const auto front = _mm_cmpgt_ps(clip[3], _mm_set1_ps(near_w));
+            rcp = _mm_and_ps(_mm_div_ps(rcp, clip[3]), front);
+            for (int32_t r = 0; r < 3; r++)
+                clip[r] = _mm_div_ps(clip[r], clip[3]);
+            for (int32_t r = 0; r < 2; r++)
+                clip[r] = _mm_and_ps(clip[r], front);
+            clip[2] = _mm_blendv_ps(_mm_set1_ps(behind), clip[2], front);
+        }
+        for (int32_t r = 0; r < 2; r++)
+            clip[r] = _mm_min_ps(
+                _mm_max_ps(clip[r], _mm_set1_ps(-max_coordinate)),
+                _mm_set1_ps(max_coordinate));
+        const auto sx = _mm_cvttps_epi32(clip[0]);
+        const auto sy = _mm_cvttps_epi32(clip[1]);
+        auto* out = reinterpret_cast<__m128i*>(pts + i);
+        _mm_storeu_si128(out, _mm_unpacklo_epi32(sx, sy));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(sx, sy));
+        _mm_storeu_ps(depth + i, clip[2]);
+        if (inv_w) _mm_storeu_ps(inv_w + i, rcp);
+    }
+    return i;
+}
+
+// Blocks of 2 in double.
+TINY_TARGET("sse4.1")
+inline size_t transform_sse41(vec3<float> const* in, size_t count,
+                              mat4<double> const& m, vec2<int32_t>* pts,
+                              float* depth, float* inv_w) {
+    __m128d c[4][4];
+    for (int32_t r = 0; r < 4; r++)
+        for (int32_t k = 0; k < 4; k++) c[r][k] = _mm_set1_pd(m.m[r][k]);
+    const bool affine = is_affine(m);
+    const int32_t rows = affine ? 3 : 4;
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const detail::soa_block<2> block(in + i);
+        const auto x = _mm_setr_pd(block.x[0], block.x[1]);
+        const auto y = _mm_setr_pd(block.y[0], block.y[1]);
+        const auto z = _mm_setr_pd(block.z[0], block.z[1]);
+        __m128d clip[4];
+        for (int32_t r = 0; r < rows; r++)
+            clip[r] = _mm_add_pd(
+                _mm_add_pd(_mm_add_pd(_mm_mul_pd(c[r][0], x),
+                                      _mm_mul_pd(c[r][1], y)),
+                           _mm_mul_pd(c[r][2], z)),
+                c[r][3]);
+        __m128d rcp = _mm_set1_pd(1.);
+        if (!affine) {
+            const auto front = _mm_cmpgt_pd(clip[3], _mm_set1_pd(near_w));
+            rcp = _mm_and_pd(_mm_div_pd(rcp, clip[3]), front);
+            for (int32_t r = 0; r < 3; r++)
+                clip[r] = _mm_div_pd(clip[r], clip[3]);
+            for (int32_t r = 0; r < 2; r++)
+                clip[r] = _mm_and_pd(clip[r], front);
+            clip[2] = _mm_blendv_pd(_mm_set1_pd(behind), clip[2], front);
+        }
+        for (int32_t r = 0; r < 2; r++)
+            clip[r] = _mm_min_pd(
+                _mm_max_pd(clip[r], _mm_set1_pd(-max_coordinate)),
+                _mm_set1_pd(max_coordinate));
+        const auto sx = _mm_cvttpd_epi32(clip[0]);
+        const auto sy = _mm_cvttpd_epi32(clip[1]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pts + i),
+                         _mm_unpacklo_epi32(sx, sy));
+        _mm_storel_pi(reinterpret_cast<__m64*>(depth + i),
+                      _mm_cvtpd_ps(clip[2]));
+        if (inv_w)
+            _mm_storel_pi(reinterpret_cast<__m64*>(inv_w + i),
+                          _mm_cvtpd_ps(rcp));
+    }
+    return i;
+}
+
+// Blocks of 8 in float.
+TINY_TARGET("avx2")
+inline size_t transform_avx2(vec3<float> const* in, size_t count,
+                             mat4<float> const& m, vec2<int32_t>* pts,
+                             float* depth, float* inv_w) {
+    __m256 c[4][4];
+    for (int32_t r = 0; r < 4; r++)
+        for (int32_t k = 0; k < 4; k++) c[r][k] = _mm256_set1_ps(m.m[r][k]);
+    const bool affine = is_affine(m);
+    const int32_t rows = affine ? 3 : 4;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const detail::soa_block<8> block(in + i);
+        const auto x = _mm256_load_ps(block.x);
+        const auto y = _mm256_load_ps(block.y);
+        const auto z = _mm256_load_ps(block.z);
+        __m256 clip[4];
+        for (int32_t r = 0; r < rows; r++)
+            clip[r] = _mm256_add_ps(
+                _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[r][0], x),
+                                            _mm256_mul_ps(c[r][1], y)),
+                              _mm256_mul_ps(c[r][2], z)),
+                c[r][3]);
+        __m256 rcp = _mm256_set1_ps(1.f);
+        if (!affine) {
+            const auto front =
+                _mm256_cmp_ps(clip[3], _mm256_set1_ps(near_w), _CMP_GT_OQ);
+            rcp = _mm256_and_ps(_mm256_div_ps(rcp, clip[3]), front);
+            for (int32_t r = 0; r < 3; r++)
+                clip[r] = _mm256_div_ps(clip[r], clip[3]);
+            for (int32_t r = 0; r < 2; r++)
+                clip[r] = _mm256_and_ps(clip[r], front);
+            clip[2] = _mm256_blendv_ps(_mm256_set1_ps(behind), clip[2], front);
+        }
+        for (int32_t r = 0; r < 2; r++)
+            clip[r] = _mm256_min_ps(
+                _mm256_max_ps(clip[r], _mm256_set1_ps(-max_coordinate)),
+                _mm256_set1_ps(max_coordinate));
+        const auto sx = _mm256_cvttps_epi32(clip[0]);
+        const auto sy = _mm256_cvttps_epi32(clip[1]);
+        // Interleaving works within 128 bit lanes: lo holds vertices 0, 1,
+        // 4, 5 and hi 2, 3, 6, 7.
+        const auto lo = _mm256_unpacklo_epi32(sx, sy);
+        const auto hi = _mm256_unpackhi_epi32(sx, sy);
+        auto* out = reinterpret_cast<__m256i*>(pts + i);
+        _mm256_storeu_si256(out, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+        _mm256_storeu_ps(depth + i, clip[2]);
+        if (inv_w) _mm256_storeu_ps(inv_w + i, rcp);
+    }
+    return i;
+}
+
+// Blocks of 4 in double.
+TINY_TARGET("avx2")
+inline size_t transform_avx2(vec3<float> const* in, size_t count,
+                             mat4<double> const& m, vec2<int32_t>* pts,
+                             float* depth, float* inv_w) {
+    __m256d c[4][4];
+    for (int32_t r = 0; r < 4; r++)
+        for (int32_t k = 0; k < 4; k++) c[r][k] = _mm256_set1_pd(m.m[r][k]);
+    const bool affine = is_affine(m);
+    const int32_t rows = affine ? 3 : 4;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const detail::soa_block<4> block(in + i);
+        const auto x = _mm256_cvtps_pd(_mm_load_ps(block.x));
+        const auto y = _mm256_cvtps_pd(_mm_load_ps(block.y));
+        const auto z = _mm256_cvtps_pd(_mm_load_ps(block.z));
+        __m256d clip[4];
+        for (int32_t r = 0; r < rows; r++)
+            clip[r] = _mm256_add_pd(
+                _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c[r][0], x),
+                                            _mm256_mul_pd(c[r][1], y)),
+                              _mm256_mul_pd(c[r][2], z)),
+                c[r][3]);
+        __m256d rcp = _mm256_set1_pd(1.);
+        if (!affine) {
+            const auto front =
+                _mm256_cmp_pd(clip[3], _mm256_set1_pd(near_w), _CMP_GT_OQ);
+            rcp = _mm256_and_pd(_mm256_div_pd(rcp, clip[3]), front);
+            for (int32_t r = 0; r < 3; r++)
+                clip[r] = _mm256_div_pd(clip[r], clip[3]);
+            for (int32_t r = 0; r < 2; r++)
+                clip[r] = _mm256_and_pd(clip[r], front);
+            clip[2] = _mm256_blendv_pd(_mm256_set1_pd(behind), clip[2], front);
+        }
+        for (int32_t r = 0; r < 2; r++)
+            clip[r] = _mm256_min_pd(
+                _mm256_max_pd(clip[r], _mm256_set1_pd(-max_coordinate)),
+                _mm256_set1_pd(max_coordinate));
+        const auto sx = _mm256_cvttpd_epi32(clip[0]);
+        const auto sy = _mm256_cvttpd_epi32(clip[1]);
+        auto* out = reinterpret_cast<__m128i*>(pts + i);
+        _mm_storeu_si128(out, _mm_unpacklo_epi32(sx, sy));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(sx, sy));
+        _mm_storeu_ps(depth + i,
+                      _mm256_cvtpd_ps(clip[2]));
+        if (inv_w) _mm_storeu_ps(inv_w + i, _mm256_cvtpd_ps(rcp));
+    }
+    return i;
+}
+#endif
+
+}  // namespace detail
+
+// Transforms every position by m into pts and depth, which hold at least
+// as many entries. T is float or double. inv_w, when not empty, gets 1 / w
+// of every vertex for perspective-correct interpolation; it is 1 for an
+// affine matrix.
+template <typename T>
+void transform(span<vec3<float> const> positions, mat4<T> const& m,
+               span<vec2<int32_t>> pts, span<float> depth,
+               span<float> inv_w = {}, simd::isa isa = simd::active()) {
+    size_t done = 0;
+    float* w = inv_w.empty() ? nullptr : inv_w.data();
+#if defined(TINY_X86)
+    if (isa >= simd::isa::avx2)
+        done = detail::transform_avx2(positions.data(), positions.size(), m,
+                                      pts.data(), depth.data(), w);
+    else if (isa >= simd::isa::sse41)
+        done = detail::transform_sse41(positions.data(), positions.size(), m,
+                                       pts.data(), depth.data(), w);
+#endif
+    detail::transform_scalar(positions.data() + done, positions.size() - done,
+                             m, pts.data() + done, depth.data() + done,
+                             w ? w + done : nullptr);
+}
+
+}  // namespace vertex
+
+}  // namespace tiny
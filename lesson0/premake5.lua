@@ -31,8 +31,9 @@ project 'lesson0'
   filter "system:macosx"
     system "macosx"
 
-  filter "system:linx"
+  filter "system:linux"
     system "linux"
+    links {"pthread"}
 
   filter "system:windows"
     system "windows"
@@ -45,3 +46,6 @@ project 'lesson0'
     defines {"_RELEASE"}
     optimize "On"
 
+  filter {"configurations:release", "options:profile"}
+    defines {"TINY_PROFILE=1"}
+
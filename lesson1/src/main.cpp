@@ -117,8 +117,7 @@ int32_t main(int32_t argc, char const *argv[]) {
     line(20, 13, 40, 80, image, red);
     line(80, 40, 13, 20, image, red);
 
-    image.flipv();
-    image.write_png("lesson1.png");
+    image.write_png("lesson1.png", true);
 
     std::cout << image.get_color(10, 10) << '\n';
     std::cout << image << "\n";
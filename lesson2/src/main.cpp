@@ -1,12 +1,33 @@
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <array>
+#include <string>
 #include <vector>
 
+// Counts every heap allocation, for the per-frame figures of the report.
+#define TINY_MEMORY_COUNT_NEW
+#include "tiny/memory.hpp"
+
 #include "nlohmann/json.hpp"
 #include "tiny.hpp"
+#include "tiny/arena.hpp"
+#include "tiny/codec.hpp"
+#include "tiny/cull.hpp"
+#include "tiny/lines.hpp"
+#include "tiny/msaa.hpp"
+#include "tiny/profile.hpp"
+#include "tiny/raster.hpp"
+#include "tiny/scheduler.hpp"
+#include "tiny/shader.hpp"
+#include "tiny/stream.hpp"
+#include "tiny/texture.hpp"
+#include "tiny/vertex.hpp"
 
 void line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, tiny::image &image,
           tiny::color const &color) {
@@ -106,7 +127,7 @@ void triangle_4(tiny::vec2<int32_t> t0, tiny::vec2<int32_t> t1,
             .y =
                 int32_t(t0.y + (t1.y - t0.y) * beta)};  // t0 + (t1 - t0) * beta
         if (A.x > B.x) std::swap(A, B);
-        for (int32_t j = A.x; j < B.x; j++) image.set(j, y, color);
+        image.fill_span(A.x, B.x, y, color);
     }
     for (int32_t y = t1.y; y <= t2.y; y++) {
         int32_t segment_height = t2.y - t1.y + 1;
@@ -121,7 +142,7 @@ void triangle_4(tiny::vec2<int32_t> t0, tiny::vec2<int32_t> t1,
             .y =
                 int32_t(t1.y + (t2.y - t1.y) * beta)};  // t1 + (t2 - t1) * beta
         if (A.x > B.x) std::swap(A, B);
-        for (int32_t j = A.x; j < B.x; j++) image.set(j, y, color);
+        image.fill_span(A.x, B.x, y, color);
     }
 }
 
@@ -154,7 +175,7 @@ void triangle_5(tiny::vec2<int32_t> t0, tiny::vec2<int32_t> t1,
             B.y = int32_t(t0.y + (t1.y - t0.y) * beta);
         }
         if (A.x > B.x) std::swap(A, B);
-        for (int32_t j = A.x; j <= B.x; j++) image.set(j, t0.y + i, color);
+        image.fill_span(A.x, B.x + 1, t0.y + i, color);
     }
 }
 
@@ -197,8 +218,7 @@ void triangle_6(tiny::vec2<int32_t> t0, tiny::vec2<int32_t> t1,
         tiny::vec2<int32_t> A = t0 + (t2 - t0) * alpha;
         tiny::vec2<int32_t> B = second_half ? t1 + (t2 - t1) * beta : t0 + (t1 - t0) * beta;
         if (A.x > B.x) std::swap(A, B);
-        for (int32_t j = A.x; j <= B.x; j++)
-            image.set(j, t0.y + i, color);
+        image.fill_span(A.x, B.x + 1, t0.y + i, color);
     }
 }
 
@@ -224,8 +244,8 @@ tiny::vec3<float> barycentric(std::array<tiny::vec2<int32_t>, 3> const& pts,
     };
 }
 
-void triangle(std::array<tiny::vec2<int32_t>, 3> const& pts, tiny::image &image,
-              tiny::color const& color) {
+void triangle_7(std::array<tiny::vec2<int32_t>, 3> const& pts,
+                tiny::image &image, tiny::color const& color) {
     tiny::vec2<int32_t> bboxmin{image.get_width() - 1, image.get_height() - 1};
     tiny::vec2<int32_t> bboxmax{0, 0};
     tiny::vec2<int32_t> clamp{image.get_width() - 1, image.get_height() - 1};
@@ -246,48 +266,735 @@ void triangle(std::array<tiny::vec2<int32_t>, 3> const& pts, tiny::image &image,
     }
 }
 
-int32_t main(int32_t argc, char const *argv[]) {
-    constexpr int32_t WIDTH  = 800;
-    constexpr int32_t HEIGHT = 800;
+// Integer edge functions stepped row by row, see tiny::raster::rasterize.
+void triangle(std::array<tiny::vec2<int32_t>, 3> const& pts, tiny::image &image,
+              tiny::color const& color) {
+    tiny::raster::triangle(pts,
+                           {0, 0, image.get_width(), image.get_height()},
+                           image, color);
+}
 
-    tiny::image image(WIDTH, HEIGHT);
-    //tiny::model model("assets/suzanne.obj");
-    tiny::model model("assets/african_head.obj");
-    tiny::vec3<float> light_dir{ 0, 0, -1 };
+// Depth tested variant; z holds the depth of each vertex, 0 nearest.
+void triangle(std::array<tiny::vec2<int32_t>, 3> const& pts,
+              std::array<float, 3> const& z, tiny::image &image,
+              tiny::depth_buffer &depth, tiny::color const& color,
+              tiny::raster::depth_stats *stats = nullptr) {
+    tiny::raster::triangle(pts, z,
+                           {0, 0, image.get_width(), image.get_height()},
+                           image, depth, color, stats);
+}
+
+struct draw {
+    std::array<tiny::vec2<int32_t>, 3> pts;
+    std::array<float, 3> depth;
+    tiny::color color;
+    int32_t face;
+};
 
+// Screen position and depth of every model vertex. Each vertex is
+// transformed once, however many faces share it.
+struct screen_vertices {
+    tiny::span<tiny::vec2<int32_t>> pts;
+    tiny::span<float> depth;
+    tiny::span<float> inv_w;
+};
+
+// The model's [-1, 1] cube seen from +z by an orthographic camera: the
+// projection * view matrix. Depth comes out as (1 - z) / 2 on the
+// viewport, 0 nearest. In double every product is exact, so pixels come
+// out as the hand-written mapping's did. With perspective the camera
+// backs off to z = 3 and narrows its view to keep the cube in frame.
+tiny::mat4<double> view_projection(bool perspective = false) {
+    using namespace tiny::math;
+    if (perspective)
+        return tiny::math::perspective<double>(2 * std::atan(.37), 1, 1, 5) *
+               look_at<double>({0, 0, 3}, {0, 0, 0}, {0, 1, 0});
+    return orthographic<double>(-1, 1, -1, 1, 0, 2) *
+           look_at<double>({0, 0, 1}, {0, 0, 0}, {0, 1, 0});
+}
+
+// The vertices live in the frame's arena.
+screen_vertices transform(tiny::span<tiny::vec3<float> const> positions,
+                          int32_t width, int32_t height,
+                          tiny::mat4<double> const &projection,
+                          tiny::arena &arena) {
+    screen_vertices out;
+    out.pts = arena.allocate<tiny::vec2<int32_t>>(positions.size());
+    out.depth = arena.allocate<float>(positions.size());
+    out.inv_w = arena.allocate<float>(positions.size());
+    const auto m = tiny::math::viewport<double>(0, 0, width, height) *
+                   projection;
+    tiny::vertex::transform(positions, m, out.pts, out.depth, out.inv_w);
+    return out;
+}
+
+// lesson2's light: one grey per face from its model space normal. Front
+// faces turned away from the light are drawn black.
+tiny::color flat_color(tiny::vec3<float> const &a, tiny::vec3<float> const &b,
+                       tiny::vec3<float> const &c,
+                       tiny::vec3<float> const &light_dir) {
+    const auto n = tiny::math::normalise(tiny::math::cross(c - a, b - a));
+    const auto intensity = std::max(0.f, tiny::math::dot(n, light_dir));
+    const auto grey = uint8_t(intensity * 255.);
+    return tiny::color(grey, grey, grey);
+}
+
+// Appends the pieces the cull kept of a face to draws[0, count). A face
+// clipped to the guard band takes several draws, so the list starts at
+// one per face and moves to a bigger span of the arena when clipping
+// outgrows it.
+void append(tiny::span<draw> &draws, size_t &count,
+            std::array<tiny::cull::piece, tiny::cull::max_pieces> const &pieces,
+            int32_t kept, tiny::color const &color, int32_t face,
+            tiny::arena &arena) {
+    if (count + kept > draws.size()) {
+        auto grown = arena.allocate<draw>(draws.size() * 2 + kept);
+        std::copy(draws.begin(), draws.begin() + count, grown.begin());
+        draws = grown;
+    }
+    for (int32_t j = 0; j < kept; j++)
+        draws[count++] = {pieces[j].pts, pieces[j].depth, color, face};
+}
+
+// Culls the faces in screen space, then flat shades what is left, in model
+// order, into the frame's arena.
+tiny::span<draw> setup(tiny::model const &model, screen_vertices const &screen,
+                       tiny::vec3<float> const &light_dir,
+                       tiny::rect const &frame, tiny::arena &arena,
+                       tiny::cull::stats &culled) {
+    auto draws = arena.allocate<draw>(model.nfaces());
+    size_t count = 0;
+    const auto positions = model.positions();
+    std::array<tiny::cull::piece, tiny::cull::max_pieces> pieces;
     for (int32_t i = 0; i < model.nfaces(); i++) {
-        std::vector<int32_t> face = model.face(i);
+        const auto face = model.face_indices(i);
         std::array<tiny::vec2<int32_t>, 3> screen_coords;
-        std::array<tiny::vec3<float>,   3> world_coords;
+        std::array<float, 3> depth;
         for (int32_t j = 0; j < screen_coords.size(); j++) {
-            auto v = model.vert(face[j]);
-            screen_coords[j] = tiny::vec2<int32_t>{
-                int32_t((v.x + 1.) * WIDTH  / 2.),
-                int32_t((v.y + 1.) * HEIGHT / 2.)
-            };
-            world_coords[j] = v;
+            screen_coords[j] = screen.pts[face[j]];
+            depth[j] = screen.depth[face[j]];
+        }
+        const auto kept = tiny::cull::triangle(screen_coords, depth, frame,
+                                               pieces, &culled);
+        if (kept == 0) continue;
+        append(draws, count, pieces, kept,
+               flat_color(positions[face[0]], positions[face[1]],
+                          positions[face[2]], light_dir),
+               i, arena);
+    }
+    return draws.subspan(0, count);
+}
+
+// The same for a streamed batch, whose vertices are its triangles'
+// corners, three in a row. Its faces are numbered within the batch, which
+// only the flat draws it makes can do with.
+tiny::span<draw> setup(tiny::stream::batch const &batch,
+                       screen_vertices const &screen,
+                       tiny::vec3<float> const &light_dir,
+                       tiny::rect const &frame, tiny::arena &arena,
+                       tiny::cull::stats &culled) {
+    auto draws = arena.allocate<draw>(batch.triangles());
+    size_t count = 0;
+    std::array<tiny::cull::piece, tiny::cull::max_pieces> pieces;
+    for (size_t i = 0; i < batch.triangles(); i++) {
+        const auto *corner = &batch.corners[i * 3];
+        const std::array<tiny::vec2<int32_t>, 3> screen_coords = {
+            screen.pts[i * 3], screen.pts[i * 3 + 1], screen.pts[i * 3 + 2]};
+        const std::array<float, 3> depth = {
+            screen.depth[i * 3], screen.depth[i * 3 + 1],
+            screen.depth[i * 3 + 2]};
+        const auto kept = tiny::cull::triangle(screen_coords, depth, frame,
+                                               pieces, &culled);
+        if (kept == 0) continue;
+        append(draws, count, pieces, kept,
+               flat_color(corner[0], corner[1], corner[2], light_dir),
+               int32_t(i), arena);
+    }
+    return draws.subspan(0, count);
+}
+
+enum class shading_mode { flat, gouraud, phong, texture };
+
+// The shader of the smooth modes and what it reads.
+struct shading {
+    shading_mode mode = shading_mode::flat;
+    tiny::shaders::scene scene;
+    screen_vertices const *screen = nullptr;
+};
+
+// One draw through the mode's shader, interpolated across the whole face
+// it was cut from, into target: an image and its depth buffer, or the
+// samples of an msaa_buffer. The mode is switched on once per triangle;
+// each case is a rasterizer specialised for its shader.
+template <typename... Target>
+void shade(draw const &d, shading const &s, tiny::rect const &clip,
+           tiny::raster::depth_stats *stats, Target &...target) {
+    const auto face = s.scene.mesh->face_indices(d.face);
+    std::array<tiny::vec2<int32_t>, 3> corners;
+    std::array<float, 3> inv_w;
+    for (int32_t k = 0; k < 3; k++) {
+        corners[k] = s.screen->pts[face[k]];
+        inv_w[k] = s.screen->inv_w[face[k]];
+    }
+    auto draw = [&](auto const &shader) {
+        tiny::shaders::draw(shader, d.face, d.pts, d.depth, corners, inv_w,
+                            clip, target..., stats);
+    };
+    switch (s.mode) {
+        case shading_mode::flat:    draw(tiny::shaders::flat{s.scene});     break;
+        case shading_mode::gouraud: draw(tiny::shaders::gouraud{s.scene});  break;
+        case shading_mode::phong:   draw(tiny::shaders::phong{s.scene});    break;
+        case shading_mode::texture: draw(tiny::shaders::textured{s.scene}); break;
+    }
+}
+
+// One draw into the samples of msaa, flat unless shaded is given.
+void draw_samples(draw const &d, shading const *shaded, tiny::rect const &clip,
+                  tiny::msaa_buffer &msaa, tiny::raster::depth_stats *stats) {
+    if (shaded)
+        shade(d, *shaded, clip, stats, msaa);
+    else
+        tiny::msaa::triangle(d.pts, d.depth, clip, msaa, d.color, stats);
+}
+
+// Flat draws unless shaded asks for a smooth mode, which needs depth.
+// With msaa the draws go to its samples instead, depth tested there.
+void render(tiny::span<draw> const &draws, tiny::image &image,
+            tiny::depth_buffer *depth, tiny::raster::depth_stats *stats,
+            shading const *shaded = nullptr,
+            tiny::msaa_buffer *msaa = nullptr) {
+    const tiny::rect frame{0, 0, image.get_width(), image.get_height()};
+    for (auto const &d : draws) {
+        if (msaa)
+            draw_samples(d, shaded, frame, *msaa, stats);
+        else if (depth && shaded)
+            shade(d, *shaded, frame, stats, image, *depth);
+        else if (depth)
+            triangle(d.pts, d.depth, image, *depth, d.color, stats);
+        else
+            triangle(d.pts, image, d.color);
+    }
+}
+
+// Bins the triangles into screen tiles and lets the scheduler's workers
+// fill whole tiles. Tiles never overlap, so no pixel, depth value or
+// depth pyramid tile is written by more than one thread.
+void render(tiny::span<draw> const &draws, tiny::scheduler &scheduler,
+            tiny::tile_bins &bins, tiny::image &image,
+            tiny::depth_buffer *depth, tiny::raster::depth_stats *stats,
+            tiny::arena &arena, shading const *shaded = nullptr,
+            tiny::msaa_buffer *msaa = nullptr) {
+    bins.build(uint32_t(draws.size()),
+               [&](uint32_t i) { return tiny::raster::bounds(draws[i].pts); },
+               &arena);
+    auto worker_stats =
+        arena.allocate<tiny::raster::depth_stats>(scheduler.size());
+    scheduler.parallel_for(bins.ntiles(), [&](uint32_t tile, uint32_t worker) {
+        TINY_PROFILE_SCOPE("tile");
+        const auto clip = bins.tile(tile);
+        for (auto const i : bins.items(tile)) {
+            auto const &d = draws[i];
+            auto *counters = stats ? &worker_stats[worker] : nullptr;
+            if (msaa)
+                draw_samples(d, shaded, clip, *msaa, counters);
+            else if (depth && shaded)
+                shade(d, *shaded, clip, counters, image, *depth);
+            else if (depth)
+                tiny::raster::triangle(d.pts, d.depth, clip, image, *depth,
+                                       d.color, counters);
+            else
+                tiny::raster::triangle(d.pts, clip, image, d.color);
         }
-        auto n = tiny::math::cross(
-                    world_coords[2] - world_coords[0],
-                    world_coords[1] - world_coords[0]
-                );
-        n = tiny::math::normalise(n);
-        auto intensity = n * light_dir;
-        if (intensity > 0)
-            triangle_5(screen_coords[0], screen_coords[1], screen_coords[2],
-                       image,
-                       tiny::color(
-                           uint8_t(intensity * 255.),
-                           uint8_t(intensity * 255.),
-                           uint8_t(intensity * 255.)
-                      ));
-    }
-
-    image.flipv();
-    image.write_png("lesson2.png");
+    });
+    if (stats)
+        for (auto const &s : worker_stats) *stats += s;
+}
+
+// The model's edges, each once, over the shaded frame.
+void overlay(tiny::span<tiny::lines::edge const> edges,
+             screen_vertices const &screen, tiny::image &image,
+             tiny::lines::mode mode, tiny::lines::stats *stats) {
+    tiny::lines::draw(edges, screen.pts,
+                      {0, 0, image.get_width(), image.get_height()}, image,
+                      tiny::color::green(), mode, stats);
+}
+
+// What --stream draws with: one flat shaded frame, depth tested unless
+// use_depth is off.
+struct stream_options {
+    std::string filename;
+    std::string output;
+    uint32_t threads = 1;
+    size_t batch = size_t(1) << 16;
+    size_t queue = 4;
+    bool use_depth = true;
+    tiny::depth_format format = tiny::depth_format::f32;
+    bool hierarchical = true;
+    bool perspective = false;
+    bool with_stats = false;
+    bool profiling = false;
+    std::string trace_file;
+};
+
+// Draws the file without loading it: a reader thread parses it into
+// batches of triangles, which go through transform, cull and raster here
+// as they come, while it reads on. Memory stays at the batches in flight
+// and the position table, however many faces the file has. Triangles are
+// drawn in file order and through the same steps as a loaded model's, so
+// the frame comes out the same; only the whole mesh cull is missing, for
+// there is no bounding sphere before the last vertex is read.
+int32_t stream(stream_options const &o, int32_t width, int32_t height) {
+    tiny::profile::profiler profiler(size_t(1) << 16, 1);
+    if (o.profiling) {
+        tiny::profile::set_current(&profiler);
+        profiler.begin_frame();
+    }
+
+    tiny::arena arena;
+    tiny::image image(width, height);
+    tiny::depth_buffer depth(width, height, o.format, o.hierarchical);
+    auto *zbuffer = o.use_depth ? &depth : nullptr;
+    tiny::raster::depth_stats stats;
+    auto *counters = o.with_stats || o.profiling ? &stats : nullptr;
+    tiny::scheduler scheduler(o.threads);
+    tiny::tile_bins bins(width, height);
+    tiny::cull::stats culled;
+    const tiny::rect frame{0, 0, width, height};
+    const auto projection = view_projection(o.perspective);
+    const tiny::vec3<float> light_dir{0, 0, -1};
+
+    std::chrono::duration<double, std::milli> draw_elapsed{};
+    tiny::stream::stats streamed;
+    const bool opened = tiny::stream::run(
+        o.filename, o.batch, o.queue,
+        [&](tiny::stream::batch const &batch) {
+            const auto start = std::chrono::steady_clock::now();
+            arena.reset();
+            TINY_PROFILE_COUNT(triangles_in, batch.triangles());
+            screen_vertices screen;
+            {
+                TINY_PROFILE_SCOPE("transform");
+                screen = transform(batch.positions(), width, height,
+                                   projection, arena);
+            }
+            tiny::span<draw> draws;
+            {
+                TINY_PROFILE_SCOPE("cull");
+                draws = setup(batch, screen, light_dir, frame, arena, culled);
+            }
+            TINY_PROFILE_COUNT(triangles_rasterized, draws.size());
+            {
+                TINY_PROFILE_SCOPE("raster");
+                if (o.threads > 1)
+                    render(draws, scheduler, bins, image, zbuffer, counters,
+                           arena);
+                else
+                    render(draws, image, zbuffer, counters);
+            }
+            draw_elapsed += std::chrono::steady_clock::now() - start;
+        },
+        streamed);
+    if (!opened) {
+        std::cerr << "cannot open " << o.filename << "\n";
+        return 1;
+    }
+    TINY_PROFILE_COUNT(triangles_culled,
+                       culled.near_plane + culled.backface +
+                           culled.degenerate + culled.frustum);
+    TINY_PROFILE_COUNT(fragments_tested, stats.fragments_tested);
+    TINY_PROFILE_COUNT(fragments_written, stats.fragments_passed);
+
+    const auto write_start = std::chrono::steady_clock::now();
+    const auto written = o.output.empty() ? std::string("lesson2.png")
+                                          : o.output;
+    {
+        TINY_PROFILE_SCOPE("encode");
+        if (o.output.empty())
+            image.write_png(written, true);
+        else
+            tiny::codec::write(image, written, true, &scheduler);
+    }
+    const std::chrono::duration<double, std::milli> write_elapsed =
+        std::chrono::steady_clock::now() - write_start;
+    if (o.profiling) {
+        TINY_PROFILE_COUNT(
+            bytes_written,
+            std::ifstream(written, std::ios::binary | std::ios::ate).tellg());
+        profiler.end_frame(uint64_t(width) * height);
+        tiny::profile::set_current(nullptr);
+        if (!o.trace_file.empty() && !profiler.write_trace(o.trace_file))
+            std::cerr << "cannot write " << o.trace_file << "\n";
+    }
 
     using json = nlohmann::json;
-    std::cout << json::parse(image.json()).dump(2) << "\n";
+    auto report = json::parse(image.json());
+    report["threads"] = o.threads;
+    report["stream"] = json::parse(streamed.json());
+    report["stream"]["draw_ms"] = draw_elapsed.count();
+    report["peak_resident_bytes"] = tiny::memory::peak_resident_bytes();
+    report["write_ms"] = write_elapsed.count();
+    if (o.use_depth) report["depth"] = json::parse(depth.json());
+    if (o.with_stats) report["stats"] = json::parse(stats.json());
+    report["cull"] = json::parse(culled.json());
+    report["arena"] = json::parse(arena.json());
+    if (o.profiling) report["profile"] = json::parse(profiler.json());
+    std::cout << report.dump(2) << "\n";
     return 0;
 }
 
+int32_t main(int32_t argc, char const *argv[]) {
+    constexpr int32_t WIDTH  = 800;
+    constexpr int32_t HEIGHT = 800;
+
+    uint32_t threads = 1;
+    bool verify = false;
+    bool use_depth = true;
+    bool hierarchical = true;
+    bool with_stats = false;
+    bool cache = true;
+    bool optimize = false;
+    bool wireframe = false;
+    bool perspective = false;
+    bool profiling = false;
+    int32_t samples = 0;
+    bool streaming = false;
+    size_t batch = size_t(1) << 16;
+    std::string trace_file;
+    auto mode = shading_mode::flat;
+    auto filter = tiny::texture_filter::bilinear;
+    std::string texture_file;
+    auto line_mode = tiny::lines::mode::aliased;
+    int32_t frames = 1;
+    auto format = tiny::depth_format::f32;
+    std::string filename = "assets/african_head.obj";
+    std::string output;
+    for (int32_t i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--model" && i + 1 < argc) {
+            filename = argv[++i];
+        } else if (arg == "--depth" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            use_depth = value != "off";
+            if (value == "u16") format = tiny::depth_format::u16;
+            if (value == "u24") format = tiny::depth_format::u24;
+        } else if (arg == "--no-hiz") {
+            hierarchical = false;
+        } else if (arg == "--stats") {
+            with_stats = true;
+        } else if (arg == "--no-cache") {
+            cache = false;
+        } else if (arg == "--optimize") {
+            optimize = true;
+        } else if (arg == "--wireframe" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            wireframe = value != "off";
+            if (value == "aa") line_mode = tiny::lines::mode::antialiased;
+        } else if (arg == "--shading" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            if (value == "gouraud") mode = shading_mode::gouraud;
+            if (value == "phong") mode = shading_mode::phong;
+            if (value == "texture") mode = shading_mode::texture;
+        } else if (arg == "--texture" && i + 1 < argc) {
+            texture_file = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            if (std::string(argv[++i]) == "nearest")
+                filter = tiny::texture_filter::nearest;
+        } else if (arg == "--perspective") {
+            perspective = true;
+        } else if (arg == "--msaa" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            if (value != "4" && value != "8") {
+                std::cerr << "--msaa takes 4 or 8 samples, not " << value
+                          << "\n";
+                return 1;
+            }
+            samples = std::atoi(value.c_str());
+        } else if (arg == "--stream") {
+            streaming = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch = size_t(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--profile") {
+            profiling = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            profiling = true;
+            trace_file = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        }
+    }
+
+    // The diffuse map does not ship with the model; texturing needs one.
+    if (mode == shading_mode::texture && texture_file.empty()) {
+        std::cerr << "usage: lesson2 --shading texture --texture FILE "
+                     "[--filter nearest|bilinear]\n";
+        return 1;
+    }
+
+    // --stream draws the file as it is read instead of loading it, one
+    // flat shaded frame in batches of --batch triangles.
+    if (streaming) {
+        if (mode != shading_mode::flat || samples || wireframe || optimize ||
+            verify || frames > 1) {
+            std::cerr << "--stream draws one flat shaded frame\n";
+            return 1;
+        }
+        stream_options o;
+        o.filename = filename;
+        o.output = output;
+        o.threads = threads;
+        o.batch = batch;
+        o.use_depth = use_depth;
+        o.format = format;
+        o.hierarchical = hierarchical;
+        o.perspective = perspective;
+        o.with_stats = with_stats;
+        o.profiling = profiling;
+        o.trace_file = trace_file;
+        return stream(o, WIDTH, HEIGHT);
+    }
+
+    // --profile times the stages of every frame, loading counting towards
+    // the first and writing the image towards the last, and --trace also
+    // writes them out as a Chrome trace. Fragments are counted through
+    // the depth stats, so only with depth.
+    tiny::profile::profiler profiler(size_t(1) << 16, size_t(frames));
+    if (profiling) {
+        tiny::profile::set_current(&profiler);
+        profiler.begin_frame();
+    }
+
+    //tiny::model model("assets/suzanne.obj");
+    tiny::scheduler scheduler(threads);
+    const auto load_start = std::chrono::steady_clock::now();
+    tiny::model model;
+    {
+        TINY_PROFILE_SCOPE("load");
+        model = tiny::model(filename, cache, &scheduler);
+    }
+    if (!model.is_load()) {
+        std::cerr << "cannot open " << filename << "\n";
+        return 1;
+    }
+    const std::chrono::duration<double, std::milli> load_elapsed =
+        std::chrono::steady_clock::now() - load_start;
+    tiny::mesh::optimize_stats optimized;
+    if (optimize) {
+        TINY_PROFILE_SCOPE("optimize");
+        optimized = model.optimize();
+    }
+    tiny::vec3<float> light_dir{ 0, 0, -1 };
+
+    // The smooth modes shade through the depth tested fragment stage;
+    // with --depth off the frame stays flat.
+    if (mode != shading_mode::flat && model.normals().empty()) {
+        std::cerr << filename << " has no normals to shade with\n";
+        return 1;
+    }
+    if (mode == shading_mode::texture && model.uvs().empty()) {
+        std::cerr << filename << " has no uvs to texture with\n";
+        return 1;
+    }
+    tiny::texture diffuse;
+    if (mode == shading_mode::texture) {
+        diffuse = tiny::texture::load(texture_file);
+        if (diffuse.empty()) {
+            std::cerr << "cannot load " << texture_file << "\n";
+            return 1;
+        }
+    }
+
+    tiny::arena arena;
+    tiny::image_pool images(1);
+    tiny::image image = images.acquire(WIDTH, HEIGHT);
+    tiny::depth_buffer depth(WIDTH, HEIGHT, format, hierarchical);
+    tiny::raster::depth_stats stats, frame_stats;
+    auto *zbuffer = use_depth ? &depth : nullptr;
+
+    tiny::tile_bins bins(WIDTH, HEIGHT);
+
+    // --msaa 4 or 8 draws into the samples of a multisample buffer, with
+    // a depth of its own, and resolves them into the image every frame.
+    std::unique_ptr<tiny::msaa_buffer> msaa;
+    if (samples) msaa = std::make_unique<tiny::msaa_buffer>(WIDTH, HEIGHT,
+                                                            samples);
+    std::chrono::duration<double, std::milli> resolve_elapsed{};
+
+    // Every frame after the first has to find its memory in the arena, the
+    // image pool and the buffers kept from the frame before.
+    std::vector<uint64_t> allocations(frames);
+    const tiny::rect frame_rect{0, 0, WIDTH, HEIGHT};
+    const auto projection = view_projection(perspective);
+    const tiny::cull::frustum<double> frustum(projection);
+    const auto sphere = tiny::cull::bounding_sphere(model);
+    tiny::cull::stats culled;
+    const auto edges = wireframe
+                           ? tiny::lines::unique_edges(model.indices())
+                           : std::vector<tiny::lines::edge>{};
+    tiny::lines::stats lines;
+    std::chrono::duration<double, std::milli> wireframe_elapsed{};
+    screen_vertices screen;
+    shading shaded{mode, {&model, {}, light_dir, &diffuse, filter}, &screen};
+    auto *smooth = mode != shading_mode::flat ? &shaded : nullptr;
+    tiny::span<draw> draws;
+    std::chrono::duration<double, std::milli> elapsed{};
+    for (int32_t frame = 0; frame < frames; frame++) {
+        if (profiling && frame > 0) profiler.begin_frame();
+        // A first frame that outgrew the arena's block left a chain; it is
+        // merged here, between frames, rather than by the reset inside one.
+        arena.reserve(arena.peak());
+        const auto allocated = tiny::memory::allocation_count();
+        arena.reset();
+        if (frame > 0) {
+            TINY_PROFILE_SCOPE("clear");
+            images.release(std::move(image));
+            image = images.acquire(WIDTH, HEIGHT);
+            depth.clear();
+            if (msaa) msaa->clear();
+        }
+        culled = {};
+        TINY_PROFILE_COUNT(triangles_in, model.nfaces());
+        if (tiny::cull::mesh(frustum, sphere, model.nfaces(), &culled)) {
+            {
+                TINY_PROFILE_SCOPE("transform");
+                screen = transform(model.positions(), WIDTH, HEIGHT, projection,
+                                   arena);
+            }
+            shaded.scene.pts = screen.pts;
+            TINY_PROFILE_SCOPE("cull");
+            draws = setup(model, screen, light_dir, frame_rect, arena,
+                          culled);
+        } else {
+            screen = {};
+            draws = {};
+        }
+        TINY_PROFILE_COUNT(triangles_culled, culled.mesh + culled.near_plane +
+                                                 culled.backface +
+                                                 culled.degenerate +
+                                                 culled.frustum);
+        TINY_PROFILE_COUNT(triangles_rasterized, draws.size());
+
+        frame_stats = {};
+        auto *frame_counters =
+            (with_stats && frame + 1 == frames) || profiling ? &frame_stats
+                                                             : nullptr;
+        const auto start = std::chrono::steady_clock::now();
+        {
+            TINY_PROFILE_SCOPE("raster");
+            if (threads > 1)
+                render(draws, scheduler, bins, image, zbuffer, frame_counters,
+                       arena, smooth, msaa.get());
+            else
+                render(draws, image, zbuffer, frame_counters, smooth,
+                       msaa.get());
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+        if (msaa) {
+            TINY_PROFILE_SCOPE("resolve");
+            const auto resolve_start = std::chrono::steady_clock::now();
+            msaa->resolve(image, &scheduler);
+            resolve_elapsed =
+                std::chrono::steady_clock::now() - resolve_start;
+        }
+        if (with_stats) stats = frame_stats;
+        TINY_PROFILE_COUNT(fragments_tested, frame_stats.fragments_tested);
+        TINY_PROFILE_COUNT(fragments_written, frame_stats.fragments_passed);
+        if (wireframe && !screen.pts.empty()) {
+            TINY_PROFILE_SCOPE("wireframe");
+            lines = {};
+            const auto wireframe_start = std::chrono::steady_clock::now();
+            overlay(edges, screen, image, line_mode, &lines);
+            wireframe_elapsed =
+                std::chrono::steady_clock::now() - wireframe_start;
+        }
+        allocations[frame] = tiny::memory::allocation_count() - allocated;
+        if (profiling && frame + 1 < frames)
+            profiler.end_frame(uint64_t(WIDTH) * HEIGHT);
+    }
+    const auto steady_allocations =
+        frames > 1 ? *std::max_element(allocations.begin() + 1,
+                                       allocations.end())
+                   : 0;
+
+    // The reference is serial and without early-Z, which must not change
+    // a single pixel.
+    bool identical = true;
+    if (verify) {
+        TINY_PROFILE_SCOPE("verify");
+        tiny::image serial(WIDTH, HEIGHT);
+        tiny::depth_buffer serial_depth(WIDTH, HEIGHT, format, false);
+        std::unique_ptr<tiny::msaa_buffer> serial_msaa;
+        if (msaa)
+            serial_msaa =
+                std::make_unique<tiny::msaa_buffer>(WIDTH, HEIGHT, samples);
+        render(draws, serial, use_depth ? &serial_depth : nullptr, nullptr,
+               smooth, serial_msaa.get());
+        if (serial_msaa) serial_msaa->resolve(serial);
+        if (wireframe && !screen.pts.empty())
+            overlay(edges, screen, serial, line_mode, nullptr);
+        identical = std::equal(image.data(), image.data() + image.size(),
+                               serial.data());
+    }
+
+    // stb's PNG by default; --output picks the format by extension and
+    // deflates PNG strips over the render threads.
+    const auto write_start = std::chrono::steady_clock::now();
+    const auto written = output.empty() ? std::string("lesson2.png") : output;
+    {
+        TINY_PROFILE_SCOPE("encode");
+        if (output.empty())
+            image.write_png(written, true);
+        else
+            tiny::codec::write(image, written, true, &scheduler);
+    }
+    const std::chrono::duration<double, std::milli> write_elapsed =
+        std::chrono::steady_clock::now() - write_start;
+    if (profiling) {
+        TINY_PROFILE_COUNT(
+            bytes_written,
+            std::ifstream(written, std::ios::binary | std::ios::ate).tellg());
+        profiler.end_frame(uint64_t(WIDTH) * HEIGHT);
+        tiny::profile::set_current(nullptr);
+        if (!trace_file.empty() && !profiler.write_trace(trace_file))
+            std::cerr << "cannot write " << trace_file << "\n";
+    }
+
+    using json = nlohmann::json;
+    auto report = json::parse(image.json());
+    report["model_cached"] = model.is_cached();
+    report["load_ms"] = load_elapsed.count();
+    if (optimize) report["optimize"] = json::parse(optimized.json());
+    report["threads"] = threads;
+    report["render_ms"] = elapsed.count();
+    report["write_ms"] = write_elapsed.count();
+    if (use_depth && !msaa) report["depth"] = json::parse(depth.json());
+    if (msaa) {
+        report["msaa"] = json::parse(msaa->json());
+        report["msaa"]["resolve_ms"] = resolve_elapsed.count();
+    }
+    if (mode == shading_mode::texture) {
+        report["texture"] = json::parse(diffuse.json());
+        report["texture"]["filter"] = tiny::name(filter);
+    }
+    if (with_stats) report["stats"] = json::parse(stats.json());
+    report["cull"] = json::parse(culled.json());
+    if (wireframe) {
+        report["wireframe"] = json::parse(lines.json());
+        report["wireframe"]["ms"] = wireframe_elapsed.count();
+        report["wireframe"]["lines_per_second"] =
+            lines.lines / (wireframe_elapsed.count() / 1e3);
+    }
+    if (verify) report["identical"] = identical;
+    report["frames"] = frames;
+    report["allocations"] = {{"first_frame", allocations[0]},
+                             {"steady_frame", steady_allocations}};
+    report["arena"] = json::parse(arena.json());
+    if (profiling) report["profile"] = json::parse(profiler.json());
+    std::cout << report.dump(2) << "\n";
+    return identical && steady_allocations == 0 ? 0 : 1;
+}
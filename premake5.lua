@@ -4,6 +4,11 @@ workspace 'tinyrenderer'
     'release'
   }
 
+newoption {
+  trigger     = 'profile',
+  description = 'Keep the frame profiler (tiny/profile.hpp) in release builds of every project'
+}
+
 -- Include directories
 
 -- Include projects
@@ -13,3 +18,7 @@ include 'lesson0'
 include 'lesson1'
 include 'lesson2'
 
+include 'batch'
+
+include 'benchmark'
+